@@ -68,8 +68,11 @@ setlocal DisableDelayedExpansion
 :+ bind.c
 :+ con_.c
 :+ chunklets/fastspin.c
+:+ chunklets/lz.c
 :+ chunklets/msg.c
+:+ chunklets/queue.c
 :+ crypto.c
+:+ demochunk.c
 :+ democustom.c
 :+ demorec.c
 :+ engineapi.c
@@ -118,7 +121,8 @@ if %host64%==1 (
 -L.build %lbcryptprimitives_host% -o .build/mkgamedata.exe src/build/mkgamedata.c src/os.c || goto :end
 %HOSTCC% -fuse-ld=lld -municode -O2 -g %warnings% -D_CRT_SECURE_NO_WARNINGS -include stdbool.h ^
 -L.build %lbcryptprimitives_host% -o .build/mkentprops.exe src/build/mkentprops.c src/os.c || goto :end
-.build\codegen.exe%src% || goto :end
+:: msg tests also have msgstructs in them, to test the generated code
+.build\codegen.exe%src% test/msg.test.c test/msg.bench.c || goto :end
 .build\mkgamedata.exe gamedata/engine.txt gamedata/gamelib.txt gamedata/inputsystem.txt ^
 gamedata/matchmaking.txt gamedata/vgui2.txt gamedata/vguimatsurface.txt || goto :end
 .build\mkentprops.exe gamedata/entprops.txt || goto :end
@@ -140,9 +144,27 @@ del .build\sst.lib
 
 %HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/bitbuf.test.exe test/bitbuf.test.c || goto :end
 .build\bitbuf.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/demochunk.test.exe test/demochunk.test.c || goto :end
+.build\demochunk.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/demoextract.test.exe test/demoextract.test.c || goto :end
+.build\demoextract.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/demofile.test.exe test/demofile.test.c || goto :end
+.build\demofile.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/demoindex.test.exe test/demoindex.test.c || goto :end
+.build\demoindex.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -lntdll -include test/test.h -o .build/fastspin.test.exe test/fastspin.test.c || goto :end
+.build\fastspin.test.exe || goto :end
 :: special case: test must be 32-bit
 %HOSTCC% -fuse-ld=lld -m32 -O2 -g -L.build -lbcryptprimitives -include test/test.h -o .build/hook.test.exe test/hook.test.c || goto :end
 .build\hook.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/lz.test.exe test/lz.test.c || goto :end
+.build\lz.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -I.build/include -include test/test.h -o .build/msg.test.exe test/msg.test.c || goto :end
+.build\msg.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -lntdll -include test/test.h -o .build/queue.test.exe test/queue.test.c || goto :end
+.build\queue.test.exe || goto :end
+%HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/seqlock.test.exe test/seqlock.test.c || goto :end
+.build\seqlock.test.exe || goto :end
 %HOSTCC% -fuse-ld=lld -O2 -g -include test/test.h -o .build/x86.test.exe test/x86.test.c || goto :end
 .build\x86.test.exe || goto :end
 
@@ -16,6 +16,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 
 #ifdef _WIN32
 #include <Windows.h>
@@ -24,10 +25,12 @@
 #include <sys/mman.h>
 #endif
 
+#include "ac.h"
 #include "alias.h"
 #include "bind.h"
 #include "chunklets/fastspin.h"
 #include "chunklets/msg.h"
+#include "chunklets/queue.h"
 #include "con_.h"
 #include "crypto.h"
 #include "democustom.h"
@@ -42,6 +45,7 @@
 #include "intdefs.h"
 #include "langext.h"
 #include "mem.h"
+#include "msgstruct.h"
 #include "os.h"
 #include "ppmagic.h"
 #include "sst.h"
@@ -77,6 +81,21 @@ const uchar lbpubkeys[1][32] = {
 	0x40, 0x05, 0xE9, 0x60, 0x43, 0xE8, 0xE2, 0x03
 };
 
+// messages logged in custom demo data; these get encode/decode functions
+// generated by build/codegen.c (see msgstruct.h)
+DEF_MSGSTRUCT(FakeKey) {
+	uint vk;
+	uint scan;
+};
+DEF_MSGSTRUCT(KeyInput) {
+	int key;
+	char btn[5]; // "DOWN", "UP" or "DBL"
+};
+
+#include <msgstruct_ac.gen.h> // generated by build/codegen.c
+
+static int hdrdemonum; // last demo file to get a session header (see ac.h)
+
 static void newsessionkeys(void) {
 	crypto_rng_read(&keybox->rng, keybox->prv, sizeof(keybox->prv));
 	crypto_x25519_public_key(keybox->pub, keybox->prv);
@@ -87,12 +106,28 @@ static void newsessionkeys(void) {
 	crypto_blake2b(keybox->shr, sizeof(keybox->tmp), keybox->tmp, 96);
 	crypto_wipe(keybox->tmp, sizeof(keybox->tmp));
 	keybox->nonce = 0;
+	hdrdemonum = 0;
 }
 
 static void wipesessionkeys(void) {
 	crypto_wipe(keybox->prv, offsetof(struct keybox, rng));
 }
 
+// Every demo file gets a session header at the start, whether or not there's
+// anything else to log in it, so that a demo with its custom data stripped out
+// can't pass for a clean one. The file doesn't exist yet when recording starts,
+// and there's a new one on each map load, so this just gets checked each tick.
+static void checksessionhdr(void) {
+	int demonum = demorec_demonum();
+	if (demonum < 1 || demonum == hdrdemonum) return;
+	uchar buf[AC_SESSIONHDR_SZ];
+	memcpy(buf, AC_SESSIONHDR_MAGIC, 6);
+	memcpy(buf + 6, keybox->pub, 32);
+	memcpy(buf + 38, keybox->nonce_bytes, 8);
+	democustom_write_raw(buf, sizeof(buf)); // random bytes, basically
+	hdrdemonum = demonum;
+}
+
 HANDLE_EVENT(DemoRecordStarting, void) { if (enabled) newsessionkeys(); }
 HANDLE_EVENT(DemoRecordStopped, int ndemos) { if (enabled) wipesessionkeys(); }
 
@@ -101,32 +136,43 @@ HANDLE_EVENT(DemoRecordStopped, int ndemos) { if (enabled) wipesessionkeys(); }
 static void *gamewin, *inhookwin, *inhookthr;
 static ulong inhooktid;
 
+// demo writing isn't thread-safe, so the hook thread hands input off to the
+// main thread through here, to be written out on the next tick. the push is
+// wait-free, so this doesn't add any latency to the user's input.
+static struct queue_spsc fakekeys;
+static struct FakeKey fakekeybuf[64]; // many more per tick would be... odd
+
 static ssize __stdcall kproc(int code, usize wp, ssize lp) {
 	KBDLLHOOKSTRUCT *data = (KBDLLHOOKSTRUCT *)lp;
 	if_cold (enabled && data->flags & LLKHF_INJECTED) {
 		// fast-path the next branch because alt-tabbed speed is irrelevant
 		if_hot (GetForegroundWindow() == gamewin) {
-			// maybe this input is reasonable, but log it for closer inspection
-			// TODO(rta): figure out what to do with this stuff
-			// something like the following, but with a proper abstraction...
-			//uchar buf[28 + 16], *p = buf;
-			//msg_putasz4(p, 2); p += 1;
-			//	msg_putssz5(p, 8); memcpy(p + 1, "FakeKey", 7); p += 8;
-			//	msg_putmsz4(p, 2); p += 1;
-			//		msg_putssz5(p, 3); memcpy(p + 1, "vk", 2); p += 3;
-			//			p += msg_putu32(p, data->vkCode);
-			//		msg_putssz5(p, 3); memcpy(p + 1, "scan", 4); p += 5;
-			//			p += msg_putu32(p, data->scanCode);
-			//++keybox->nonce;
-			//// append mac at end of message
-			//crypto_aead_lock_djb(buf, p, keybox->shr, keybox->nonce_bytes, 0,
-			//		0, buf, p - buf);
-			//democustom_write(buf, p - buf + 16);
+			// maybe this input is reasonable, but log it for closer inspection.
+			// if the queue's full, something's already gone very wrong; there's
+			// no sensible way to wait for space here, so the key goes unlogged
+			queue_spsc_push(&fakekeys,
+					&(struct FakeKey){data->vkCode, data->scanCode});
 		}
 	}
 	return CallNextHookEx(0, code, wp, lp);
 }
 
+static void drainfakekeys(void) {
+	struct FakeKey k;
+	while (queue_spsc_pop(&fakekeys, &k)) {
+		// TODO(rta): figure out what else to do with this stuff
+		int demonum = demorec_demonum();
+		if (demonum < 1) continue; // no demo to log it in (yet)
+		uchar buf[MSG_MAXSZ_FakeKey + 16];
+		uint len = msg_encode_FakeKey(buf, &k);
+		++keybox->nonce;
+		// append mac at end of message
+		crypto_aead_lock_djb(buf, buf + len, keybox->shr, keybox->nonce_bytes,
+				0, 0, buf, len);
+		democustom_write_raw(buf, len + 16); // encrypted, so won't compress
+	}
+}
+
 static ssize __stdcall mproc(int code, usize wp, ssize lp) {
 	MSLLHOOKSTRUCT *data = (MSLLHOOKSTRUCT *)lp;
 	if_cold (enabled && data->flags & LLMHF_INJECTED) {
@@ -232,11 +278,18 @@ static void inhook_stop(void) {
 bool ac_enable(void) {
 	if (!enabled) {
 #ifdef _WIN32
-		volatile int sig = 0;
+		// static, since the thread might still write to it after a timeout
+		static volatile int sig;
+		sig = 0;
 		inhook_start(&sig);
-		fastspin_wait(&sig);
-		if_cold (sig == 2) { // else 1 for success
+		// don't hang the game if the thread gets stuck for whatever reason
+		int ret = fastspin_wait_timeout(&sig, 3000);
+		if_cold (ret != 1) { // 1 for success, 2 for failure, 0 for timeout
 			con_warn("** sst: ERROR starting message loop, can't continue! **");
+			// XXX: on timeout, the thread could in theory still come to life
+			// later. this is best-effort; it'll see WM_QUIT if it gets that far
+			// and won't do anything harmful anyway, since enabled stays false.
+			if (!ret) PostThreadMessageW(inhooktid, WM_QUIT, 0, 0);
 			CloseHandle(inhookthr);
 			return false;
 		}
@@ -247,10 +300,14 @@ bool ac_enable(void) {
 }
 
 HANDLE_EVENT(Tick, bool simulating) {
+	if (enabled) checksessionhdr(); // before anything else gets logged
 #ifdef _WIN32
 	static uint fewticks = 0;
-	// just check this every so often (roughly 0.1-0.3s depending on game)
-	if (enabled && !(++fewticks & 7)) inhook_check();
+	if (enabled) {
+		drainfakekeys();
+		// just check this every so often (roughly 0.1-0.3s depending on game)
+		if (!(++fewticks & 7)) inhook_check();
+	}
 #endif
 }
 
@@ -288,21 +345,14 @@ DECL_VFUNC_DYN(void, DispatchAllStoredGameMessages)
 typedef void (*Key_Event_func)(struct inputevent *);
 static Key_Event_func orig_Key_Event;
 static void hook_Key_Event(struct inputevent *ev) {
-	//const char *desc[] = {"DOWN", "UP", "DBL"};
-	//const char desclen[] = {4, 2, 3};
+	//static const char desc[][5] = {"DOWN", "UP", "DBL"};
 	switch (ev->type) {
 		CASES(BTNDOWN, BTNUP, BTNDOUBLECLICK):;
 			// TODO(rta): do something interesting with button data
-			//uchar buf[28], *p = buf;
-			//msg_putasz4(p, 2); p += 1;
-			//	msg_putssz5(p, 8); memcpy(p + 1, "KeyInput", 8); p += 9;
-			//	msg_putmsz4(p, 2); p += 1;
-			//		msg_putssz5(p, 3); memcpy(p + 1, "key", 3); p += 4;
-			//			p += msg_puts32(p, ev->data);
-			//		msg_putssz5(p, 3); memcpy(p + 1, "btn", 3); p += 4;
-			//			int idx = ev->type - BTNDOWN;
-			//			msg_putssz5(p++, desclen[idx]);
-			//			memcpy(p, desc[idx], desclen[idx]); p += desclen[idx];
+			//struct KeyInput k = {ev->data};
+			//memcpy(k.btn, desc[ev->type - BTNDOWN], sizeof(k.btn));
+			//uchar buf[MSG_MAXSZ_KeyInput];
+			//uint len = msg_encode_KeyInput(buf, &k);
 	}
 	orig_Key_Event(ev);
 }
@@ -407,6 +457,8 @@ INIT {
 		goto e2;
 	}
 	if_cold (!win32_init()) goto e;
+	queue_spsc_init(&fakekeys, fakekeybuf, sizeof(*fakekeybuf),
+			countof(fakekeybuf));
 #else
 	keybox = mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANON, -1, 0);
 	if_cold (keybox == MAP_FAILED) {
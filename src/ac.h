@@ -17,6 +17,24 @@
 #ifndef INC_AC_H
 #define INC_AC_H
 
+/*
+ * Anticheat messages are logged as custom demo data, each one encrypted with
+ * crypto_aead_lock_djb() with its MAC appended. The key is derived from a fresh
+ * X25519 key pair for each recording session and the leaderboard's public key,
+ * as BLAKE2b(X25519 shared secret || session public key || leaderboard key).
+ * Every message takes the next nonce, counting up from 1 at the start of the
+ * session (the nonce is a little-endian 64-bit number).
+ *
+ * At the start of each demo file, a session header is written in the clear:
+ * AC_SESSIONHDR_MAGIC, the 32-byte session public key, and the last nonce used
+ * before this file. That way each demo can be verified on its own by anyone
+ * holding the leaderboard's private key; see tools/demoverify.c. The header is
+ * written even if nothing else is, so a demo without one has been tampered
+ * with.
+ */
+#define AC_SESSIONHDR_MAGIC "SSTAC1"
+#define AC_SESSIONHDR_SZ (6 + 32 + 8)
+
 bool ac_enable(void);
 void ac_disable(void);
 
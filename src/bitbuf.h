@@ -17,18 +17,46 @@
 #ifndef INC_BITBUF_H
 #define INC_BITBUF_H
 
+#include <string.h>
+
 #include "intdefs.h"
 
 // NOTE: This code is not big-endian-safe, because the game itself is little-
-// endian. This could theoretically break tests in odd cross-compile scenarios,
-// but no tests currently look at actual bit values so it's fine for now.
+// endian. The tests that check exact encodings would fail on a big-endian
+// machine, but that's fine since we'd never run on one anyway.
 
-// handle one machine word at a time (SIMD is probably not worth it... yet?)
+// SIMD is only worth it for bulk appends of unaligned buffers. Like msg.c, we
+// stick to what's baseline for the target, so there's no runtime detection:
+// SSE2 on x86, or AVX2 if the compiler is told it's there, and NEON on AArch64.
+// Define BITBUF_NO_SIMD to use plain C only (e.g. to compare in benchmarks).
+#ifndef BITBUF_NO_SIMD
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define _BITBUF_AVX2
+#define _BITBUF_SSE2
+#elif defined(__SSE2__) || defined(_M_X64) || \
+		defined(_M_IX86_FP) && _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define _BITBUF_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define _BITBUF_NEON
+#endif
+#endif
+
+// otherwise, handle one machine word at a time
 typedef usize bitbuf_cell;
 static const int bitbuf_cell_bits = sizeof(bitbuf_cell) * 8;
 static const int bitbuf_align = _Alignof(bitbuf_cell);
 
-/* A bit buffer, ABI-compatible with bf_write defined in tier1/bitbuf.h */
+/*
+ * A bit buffer, ABI-compatible with bf_write defined in tier1/bitbuf.h
+ *
+ * The plain append functions don't do any bounds checking, for speed. Either
+ * call bitbuf_reserve() first to check there's room for everything that's about
+ * to be appended, or use the _checked variants, which check each time. Both set
+ * overflow on failure, and it stays set until the next reset, like in bf_write.
+ */
 struct bitbuf {
 	union {
 		char *buf; /* NOTE: the buffer SHOULD be aligned as bitbuf_cell! */
@@ -48,7 +76,9 @@ static inline void _bitbuf_append(struct bitbuf *bb, bitbuf_cell x, int nbits) {
 	bb->cells[idx] |= x << shift;
 	// assign the next cell (that also clears the upper bits for the next OR)
 	// if nbits fits in the first cell, this zeros the next cell, which is fine
-	bb->cells[idx + 1] = x >> (bitbuf_cell_bits - shift);
+	// (shifting in two steps avoids a full-width shift when shift is 0, which
+	// would be UB and, on x86, would copy x into the next cell verbatim)
+	bb->cells[idx + 1] = x >> 1 >> (bitbuf_cell_bits - 1 - shift);
 	bb->curbit += nbits;
 }
 
@@ -62,42 +92,498 @@ static inline void bitbuf_appendbyte(struct bitbuf *bb, uchar x) {
 	_bitbuf_append(bb, x, 8);
 }
 
+// detail: loads a cell's worth of bytes from anywhere, aligned or not
+static inline bitbuf_cell _bitbuf_loadu(const uchar *p) {
+	bitbuf_cell x;
+	memcpy(&x, p, sizeof(x)); // plain (unaligned) mov
+	return x;
+}
+
+// detail: after storing whole bytes directly rather than via _bitbuf_append,
+// clear everything from curbit to the end of its cell, so the next append can
+// OR into it as usual
+static inline void _bitbuf_clearabove(struct bitbuf *bb) {
+	bb->cells[bb->curbit / bitbuf_cell_bits] &=
+			~((bitbuf_cell)-1 << (bb->curbit % bitbuf_cell_bits));
+}
+
+#if defined(_BITBUF_SSE2) || defined(_BITBUF_NEON)
+// detail: the bulk of an unaligned appendbuf, with len >= 24. returns how many
+// bytes it got through, leaving the rest to the scalar loop. kept separate so
+// that the common cases can still get inlined
+static inline uint _bitbuf_appendbulk(struct bitbuf *bb, const uchar *src,
+		uint len) {
+	uint i = 0;
+	// The first 8 bytes get ORed in the normal way. After that, each byte of
+	// output depends only on two bytes of input, so whole vectors can just be
+	// stored. Viewed as 64-bit lanes, each output lane is a funnel shift of the
+	// input lane and the one 8 bytes before it. Overlapping loads are cheaper
+	// than shuffling the previous vector around.
+	for (; i < 8; i += sizeof(bitbuf_cell)) {
+		_bitbuf_append(bb, _bitbuf_loadu(src + i), bitbuf_cell_bits);
+	}
+	uchar *dst = (uchar *)bb->buf + (bb->curbit >> 3) - 8;
+	int shift = bb->curbit & 7;
+#ifdef _BITBUF_AVX2
+	__m128i shl = _mm_cvtsi32_si128(shift);
+	__m128i shr = _mm_cvtsi32_si128(64 - shift);
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+		__m256i w = _mm256_loadu_si256((const __m256i *)(src + i - 8));
+		_mm256_storeu_si256((__m256i *)(dst + i), _mm256_or_si256(
+				_mm256_sll_epi64(v, shl), _mm256_srl_epi64(w, shr)));
+	}
+#endif
+#ifdef _BITBUF_SSE2
+#ifndef _BITBUF_AVX2
+	__m128i shl = _mm_cvtsi32_si128(shift);
+	__m128i shr = _mm_cvtsi32_si128(64 - shift);
+#endif
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i w = _mm_loadu_si128((const __m128i *)(src + i - 8));
+		_mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(
+				_mm_sll_epi64(v, shl), _mm_srl_epi64(w, shr)));
+	}
+#else
+	int64x2_t shl = vdupq_n_s64(shift), shr = vdupq_n_s64(shift - 64);
+	for (; i + 16 <= len; i += 16) {
+		uint64x2_t v = vreinterpretq_u64_u8(vld1q_u8(src + i));
+		uint64x2_t w = vreinterpretq_u64_u8(vld1q_u8(src + i - 8));
+		vst1q_u8(dst + i, vreinterpretq_u8_u64(vorrq_u64(
+				vshlq_u64(v, shl), vshlq_u64(w, shr))));
+	}
+#endif
+	// put the bits carried out of the last byte in place, and get back into a
+	// state where _bitbuf_append can carry on
+	dst[i] = src[i - 1] >> (8 - shift);
+	bb->curbit += (i - 8) << 3;
+	_bitbuf_clearabove(bb);
+	return i;
+}
+#endif
+
 /* Appends a sequence of bytes to the bit buffer, with length given in bytes. */
 static inline void bitbuf_appendbuf(struct bitbuf *bb, const char *buf,
 		uint len) {
-	// NOTE! This function takes advantage of the fact that nothing unaligned
-	// is page aligned, so accessing slightly outside the bounds of buf can't
-	// segfault. This is absolutely definitely technically UB, but it's unit
-	// tested and apparently works in practice. If something weird happens
-	// further down the line, sorry!
-	usize unalign = (usize)buf & (bitbuf_align - 1);
-	if (unalign) {
-		// round down the pointer
-		bitbuf_cell *p = (bitbuf_cell *)((usize)buf - unalign);
-		// shift the stored value (if it were big endian, the shift would have
-		// to be the other way, or something)
-		_bitbuf_append(bb, *p >> (unalign << 3), (bitbuf_align - unalign) << 3);
-		buf += (int)sizeof(bitbuf_cell) - unalign;
-		len -= unalign;
-	}
-	bitbuf_cell *aligned = (bitbuf_cell *)buf;
-	for (; len >= (int)sizeof(bitbuf_cell); len -= (int)sizeof(bitbuf_cell),
-			++aligned) {
-		_bitbuf_append(bb, *aligned, bitbuf_cell_bits);
-	}
-	// unaligned end bytes
-	_bitbuf_append(bb, *aligned, len << 3);
+	const uchar *src = (const uchar *)buf;
+	if (!(bb->curbit & 7)) {
+		// byte aligned, as in democustom: no shifting needed at all
+		memcpy(bb->buf + (bb->curbit >> 3), src, len);
+		bb->curbit += len << 3;
+		_bitbuf_clearabove(bb);
+		return;
+	}
+	uint i = 0;
+#if defined(_BITBUF_SSE2) || defined(_BITBUF_NEON)
+	if (len >= 24) i = _bitbuf_appendbulk(bb, src, len);
+#endif
+	for (; i + sizeof(bitbuf_cell) <= len; i += sizeof(bitbuf_cell)) {
+		_bitbuf_append(bb, _bitbuf_loadu(src + i), bitbuf_cell_bits);
+	}
+	// gather up the end bytes, taking care not to read past the end of buf
+	if (i < len) {
+		bitbuf_cell x = 0;
+		for (uint j = 0; i + j < len; ++j) {
+			x |= (bitbuf_cell)src[i + j] << (j << 3);
+		}
+		_bitbuf_append(bb, x, (len - i) << 3);
+	}
+}
+
+/*
+ * Appends a null-terminated string to the bit buffer, including the null
+ * terminator, as bf_write::WriteString() does.
+ */
+static inline void bitbuf_appendstr(struct bitbuf *bb, const char *s) {
+	bitbuf_appendbuf(bb, s, strlen(s) + 1);
+}
+
+/*
+ * Appends an unsigned value in the engine's UBitVar format: a 2-bit selector
+ * followed by 4, 8, 12 or 32 bits of value, whichever is the smallest that
+ * fits.
+ */
+static inline void bitbuf_appendubitvar(struct bitbuf *bb, uint x) {
+	// same trick as the engine: n is -3 to 0, computed without branches
+	int n = -(x < 0x10u) - (x < 0x100u) - (x < 0x1000u);
+	int nbits = 18 + n * 4;
+	// the 32-bit case is split in two, so that this part always fits in a uint
+	bitbuf_appendbits(bb, (x << 2 | (n + 3)) & ((1u << nbits) - 1), nbits);
+	if (x >= 0x1000u) bitbuf_appendbits(bb, x >> 16, 16);
+}
+
+/*
+ * Appends an unsigned value as a varint32 (as in protobuf): 7 bits per byte,
+ * least significant first, with the top bit of each byte set if more follow.
+ * Takes 1 to 5 bytes.
+ */
+static inline void bitbuf_appendvarint32(struct bitbuf *bb, uint x) {
+	for (; x > 0x7F; x >>= 7) bitbuf_appendbyte(bb, x | 0x80);
+	bitbuf_appendbyte(bb, x);
+}
+
+/*
+ * Appends a signed value as a varint32, zigzag-encoded so that small negative
+ * values are as short as small positive ones.
+ */
+static inline void bitbuf_appendsvarint32(struct bitbuf *bb, int x) {
+	bitbuf_appendvarint32(bb, (uint)x << 1 ^ (uint)(x >> 31));
+}
+
+/*
+ * Appends a world coordinate in the engine's BitCoord format: flags for whether
+ * there's an integer part and a fractional part, and if either, a sign bit, the
+ * integer part minus 1 in 14 bits and the fraction in 1/32nds in 5 bits. Takes
+ * 2 to 22 bits. Values outside +/-16384 don't survive the trip.
+ */
+static inline void bitbuf_appendcoord(struct bitbuf *bb, float f) {
+	int i = (int)f, fi = (int)(f * 32);
+	uint intval = i < 0 ? -i : i, fracval = (fi < 0 ? -fi : fi) & 31;
+	uint hasint = !!intval, hasfrac = !!fracval;
+	// build up the whole thing and append it all at once
+	uint x = hasint | hasfrac << 1;
+	int n = 2;
+	if (hasint | hasfrac) {
+		x |= (f <= -1.0 / 32) << 2;
+		x |= ((intval - 1) & 0x3FFF & -hasint) << 3;
+		n = 3 + (14 & -hasint);
+		x |= fracval << n; // nothing to mask, since it's just 0 if absent
+		n += 5 & -hasfrac;
+	}
+	bitbuf_appendbits(bb, x, n);
+}
+
+/*
+ * Appends a component of a unit vector in the engine's BitNormal format: a sign
+ * bit and an 11-bit magnitude, in 2047ths.
+ */
+static inline void bitbuf_appendnormal(struct bitbuf *bb, float f) {
+	int fi = (int)(f * 2047);
+	uint fracval = fi < 0 ? -fi : fi;
+	if (fracval > 2047) fracval = 2047;
+	bitbuf_appendbits(bb, fracval << 1 | (f <= -1.0 / 2047), 12);
+}
+
+/*
+ * Appends an angle in degrees in the engine's BitAngle format: a fraction of a
+ * full turn in nbits bits, where 0 < nbits <= 32. Wraps around, so negative
+ * angles and angles past 360 are fine.
+ */
+static inline void bitbuf_appendangle(struct bitbuf *bb, float deg,
+		int nbits) {
+	// vlong so that nbits = 32 can't overflow, unlike the engine's int
+	uint x = (uint)(vlong)(deg / 360.0 * ((uvlong)1 << nbits));
+	bitbuf_appendbits(bb, x & ((uint)-1 >> (32 - nbits)), nbits);
 }
 
 /* 0-pad the bit buffer up to the next whole byte boundary. */
 static inline void bitbuf_roundup(struct bitbuf *bb) {
-	bb->curbit += -(uint)bb->curbit & 7;
+	// append zeros rather than just bumping curbit, since this might cross into
+	// a cell that no append has cleared yet
+	uint pad = -(uint)bb->curbit & 7;
+	if (pad) _bitbuf_append(bb, 0, pad);
 }
 
 /* Clear the bit buffer to make it ready to append new data. */
 static inline void bitbuf_reset(struct bitbuf *bb) {
-	bb->buf[0] = 0; // we have to zero out the lowest cell since it gets ORed
+	bb->cells[0] = 0; // we have to zero out the lowest cell since it gets ORed
 	bb->curbit = 0;
+	bb->overflow = false;
+}
+
+/*
+ * Checks that there's room to append nbits more bits. Returns true if so, in
+ * which case that many bits can be appended with the unchecked functions above.
+ * Otherwise, sets overflow and returns false. Also returns false if overflow
+ * was already set, so a sequence of reserves can be checked once at the end.
+ *
+ * Note that since appending writes one cell ahead, the usable space is the size
+ * of the buffer minus a cell (and minus any partial cell at the end).
+ */
+static inline bool bitbuf_reserve(struct bitbuf *bb, uint nbits) {
+	uvlong end = (uvlong)bb->curbit + nbits + bitbuf_cell_bits;
+	if (end > (uint)bb->nbits / bitbuf_cell_bits * bitbuf_cell_bits) {
+		bb->overflow = true;
+	}
+	return !bb->overflow;
+}
+
+// checked variants: each reserves the space it needs and then appends, or
+// returns false and does nothing if there's no room
+
+static inline bool bitbuf_appendbits_checked(struct bitbuf *bb, uint x,
+		int nbits) {
+	if (!bitbuf_reserve(bb, nbits)) return false;
+	bitbuf_appendbits(bb, x, nbits);
+	return true;
+}
+
+static inline bool bitbuf_appendbyte_checked(struct bitbuf *bb, uchar x) {
+	if (!bitbuf_reserve(bb, 8)) return false;
+	bitbuf_appendbyte(bb, x);
+	return true;
+}
+
+static inline bool bitbuf_appendbuf_checked(struct bitbuf *bb, const char *buf,
+		uint len) {
+	// (stop len << 3 from wrapping around for absurdly large len)
+	if (!bitbuf_reserve(bb, len > (uint)-1 >> 3 ? (uint)-1 : len << 3)) {
+		return false;
+	}
+	bitbuf_appendbuf(bb, buf, len);
+	return true;
+}
+
+static inline bool bitbuf_appendstr_checked(struct bitbuf *bb, const char *s) {
+	return bitbuf_appendbuf_checked(bb, s, strlen(s) + 1);
+}
+
+static inline bool bitbuf_appendubitvar_checked(struct bitbuf *bb, uint x) {
+	int n = -(x < 0x10u) - (x < 0x100u) - (x < 0x1000u);
+	if (!bitbuf_reserve(bb, 18 + n * 4 + (x >= 0x1000u) * 16)) return false;
+	bitbuf_appendubitvar(bb, x);
+	return true;
+}
+
+static inline bool bitbuf_appendvarint32_checked(struct bitbuf *bb, uint x) {
+	int nbytes = 1 + (x > 0x7F) + (x > 0x3FFF) + (x > 0x1FFFFF) +
+			(x > 0xFFFFFFF);
+	if (!bitbuf_reserve(bb, nbytes << 3)) return false;
+	bitbuf_appendvarint32(bb, x);
+	return true;
+}
+
+static inline bool bitbuf_appendsvarint32_checked(struct bitbuf *bb, int x) {
+	return bitbuf_appendvarint32_checked(bb, (uint)x << 1 ^ (uint)(x >> 31));
+}
+
+// (this one just reserves the maximum possible size, for simplicity)
+static inline bool bitbuf_appendcoord_checked(struct bitbuf *bb, float f) {
+	if (!bitbuf_reserve(bb, 22)) return false;
+	bitbuf_appendcoord(bb, f);
+	return true;
+}
+
+static inline bool bitbuf_appendnormal_checked(struct bitbuf *bb, float f) {
+	if (!bitbuf_reserve(bb, 12)) return false;
+	bitbuf_appendnormal(bb, f);
+	return true;
+}
+
+static inline bool bitbuf_appendangle_checked(struct bitbuf *bb, float deg,
+		int nbits) {
+	if (!bitbuf_reserve(bb, nbits)) return false;
+	bitbuf_appendangle(bb, deg, nbits);
+	return true;
+}
+
+static inline bool bitbuf_roundup_checked(struct bitbuf *bb) {
+	if (!bitbuf_reserve(bb, -(uint)bb->curbit & 7)) return false;
+	bitbuf_roundup(bb);
+	return true;
+}
+
+/*
+ * A reader for parsing bit buffers, such as those produced above or those found
+ * inside demo packets. Unlike struct bitbuf, this is not ABI-compatible with
+ * anything in the engine; it's for our own (mostly offline) use.
+ *
+ * The buffer need not be aligned. Reads past the end set overflow and return
+ * 0, and leave curbit at the end. There's no need to check for overflow after
+ * each read; just check it once after parsing a whole message.
+ */
+struct bitbuf_reader {
+	const uchar *buf;
+	uint sz; // in bytes
+	uint nbits; // may be less than sz * 8, if the last byte is partial
+	uint curbit;
+	bool overflow;
+};
+
+/* Sets up a reader for sz bytes of buf, starting at the first bit. */
+static inline void bitbuf_initreader(struct bitbuf_reader *r, const void *buf,
+		uint sz) {
+	r->buf = buf;
+	r->sz = sz;
+	r->nbits = sz << 3;
+	r->curbit = 0;
+	r->overflow = false;
+}
+
+// detail: loads a whole cell, without reading past the end of the buffer. only
+// the very last cell ever takes the slow path
+static inline bitbuf_cell _bitbuf_loadcell(const struct bitbuf_reader *r,
+		uint idx) {
+	bitbuf_cell x;
+	uint off = idx * sizeof(bitbuf_cell);
+	if (off + sizeof(bitbuf_cell) <= r->sz) {
+		memcpy(&x, r->buf + off, sizeof(x)); // plain (unaligned) mov
+		return x;
+	}
+	x = 0;
+	for (uint i = 0; off + i < r->sz; ++i) {
+		x |= (bitbuf_cell)r->buf[off + i] << (i << 3);
+	}
+	return x;
+}
+
+// detail: the inverse of _bitbuf_append. nbits must be 1 to bitbuf_cell_bits
+static inline bitbuf_cell _bitbuf_read(struct bitbuf_reader *r, int nbits) {
+	if (r->curbit + nbits > r->nbits) {
+		r->curbit = r->nbits;
+		r->overflow = true;
+		return 0;
+	}
+	uint idx = r->curbit / bitbuf_cell_bits;
+	uint shift = r->curbit % bitbuf_cell_bits;
+	bitbuf_cell x = _bitbuf_loadcell(r, idx) >> shift;
+	// only touch the next cell if the value actually straddles both. as a
+	// bonus, this means shift can't be 0 here, so the shift below is defined
+	if (shift + nbits > bitbuf_cell_bits) {
+		x |= _bitbuf_loadcell(r, idx + 1) << (bitbuf_cell_bits - shift);
+	}
+	r->curbit += nbits;
+	return x & ((bitbuf_cell)-1 >> (bitbuf_cell_bits - nbits));
+}
+
+/* Reads a value of nbits bits from the bit buffer, where 0 < nbits <= 32. */
+static inline uint bitbuf_readbits(struct bitbuf_reader *r, int nbits) {
+	return _bitbuf_read(r, nbits);
+}
+
+/* Reads a single bit from the bit buffer. */
+static inline bool bitbuf_readbool(struct bitbuf_reader *r) {
+	return _bitbuf_read(r, 1);
+}
+
+/* Reads a byte from the bit buffer. */
+static inline uchar bitbuf_readbyte(struct bitbuf_reader *r) {
+	return _bitbuf_read(r, 8);
+}
+
+/*
+ * Reads len bytes from the bit buffer into out. If this would go past the end
+ * of the bit buffer, out is zeroed and overflow is set.
+ */
+static inline void bitbuf_readbuf(struct bitbuf_reader *r, void *out,
+		uint len) {
+	uchar *p = out;
+	if (r->curbit + ((uvlong)len << 3) > r->nbits) {
+		memset(out, 0, len);
+		r->curbit = r->nbits;
+		r->overflow = true;
+		return;
+	}
+	if (!(r->curbit & 7)) { // byte aligned: easy
+		memcpy(p, r->buf + (r->curbit >> 3), len);
+		r->curbit += len << 3;
+		return;
+	}
+	// otherwise, shift out a whole cell at a time, and the rest byte by byte
+	for (; len >= sizeof(bitbuf_cell); len -= sizeof(bitbuf_cell)) {
+		bitbuf_cell x = _bitbuf_read(r, bitbuf_cell_bits);
+		memcpy(p, &x, sizeof(x));
+		p += sizeof(x);
+	}
+	while (len--) *p++ = _bitbuf_read(r, 8);
+}
+
+/*
+ * Reads a null-terminated string from the bit buffer into out, which has room
+ * for outsz bytes, including the terminator. If the string is too long, it's
+ * truncated to fit, but the rest of it is still consumed, as with
+ * bf_read::ReadString(). Returns false if the string was truncated or if the
+ * end of the buffer was reached before the terminator; out is null-terminated
+ * either way (as long as outsz is nonzero).
+ */
+static inline bool bitbuf_readstring(struct bitbuf_reader *r, char *out,
+		uint outsz) {
+	uint i = 0;
+	bool fits = true;
+	for (;;) {
+		char c = _bitbuf_read(r, 8);
+		if (r->overflow) { fits = false; break; }
+		if (!c) break;
+		if (i + 1 < outsz) out[i++] = c; else fits = false;
+	}
+	if (outsz) out[i] = '\0';
+	return fits;
+}
+
+/* Reads a value in UBitVar format, as written by bitbuf_appendubitvar(). */
+static inline uint bitbuf_readubitvar(struct bitbuf_reader *r) {
+	// the 4-bit case is the common one, and it needs only one read
+	uint sixbits = _bitbuf_read(r, 6), sel = sixbits & 3;
+	if (!sel) return sixbits >> 2;
+	// otherwise, go back and read the full width: 8, 12 or 32 bits
+	r->curbit -= 4;
+	return _bitbuf_read(r, 4 + sel * 4 + ((2 - (int)sel) >> 31 & 16));
+}
+
+/* Reads a varint32, as written by bitbuf_appendvarint32(). */
+static inline uint bitbuf_readvarint32(struct bitbuf_reader *r) {
+	uint x = 0;
+	// like the engine, give up after 5 bytes rather than reading forever
+	for (int shift = 0; shift < 35; shift += 7) {
+		uint b = _bitbuf_read(r, 8);
+		x |= (b & 0x7F) << shift;
+		if (!(b & 0x80)) break;
+	}
+	return x;
+}
+
+/* Reads a zigzag-encoded varint32, as written by bitbuf_appendsvarint32(). */
+static inline int bitbuf_readsvarint32(struct bitbuf_reader *r) {
+	uint x = bitbuf_readvarint32(r);
+	return (int)(x >> 1 ^ -(x & 1));
+}
+
+/* Reads a world coordinate, as written by bitbuf_appendcoord(). */
+static inline float bitbuf_readcoord(struct bitbuf_reader *r) {
+	uint flags = _bitbuf_read(r, 2);
+	if (!flags) return 0;
+	bool neg = _bitbuf_read(r, 1);
+	uint hasint = flags & 1, hasfrac = flags >> 1;
+	// read the integer and fraction together, then pick them apart
+	int intbits = 14 & -hasint;
+	uint x = _bitbuf_read(r, intbits + (5 & -hasfrac));
+	uint intval = (x & (0x3FFF & -hasint)) + hasint, fracval = x >> intbits;
+	float f = intval + fracval * (1.0f / 32);
+	return neg ? -f : f;
+}
+
+/* Reads a unit vector component, as written by bitbuf_appendnormal(). */
+static inline float bitbuf_readnormal(struct bitbuf_reader *r) {
+	uint x = _bitbuf_read(r, 12);
+	// multiply as a double like the engine does, to get identical rounding
+	float f = (float)((x >> 1) * (1.0 / 2047));
+	return x & 1 ? -f : f;
+}
+
+/* Reads an angle in degrees, as written by bitbuf_appendangle(). */
+static inline float bitbuf_readangle(struct bitbuf_reader *r, int nbits) {
+	return (float)(_bitbuf_read(r, nbits) * (360.0 / ((uvlong)1 << nbits)));
+}
+
+/*
+ * Moves the reader to an absolute bit position. Seeking past the end sets
+ * overflow, as with reads.
+ */
+static inline void bitbuf_seek(struct bitbuf_reader *r, uint bit) {
+	if (bit > r->nbits) { bit = r->nbits; r->overflow = true; }
+	r->curbit = bit;
+}
+
+/* Skips over nbits bits, as with bitbuf_seek(). */
+static inline void bitbuf_skip(struct bitbuf_reader *r, uint nbits) {
+	if (nbits > r->nbits - r->curbit) {
+		r->curbit = r->nbits;
+		r->overflow = true;
+	}
+	else {
+		r->curbit += nbits;
+	}
 }
 
 #endif
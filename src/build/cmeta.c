@@ -402,4 +402,78 @@ void cmeta_evhandlermacros(const struct cmeta *cm, const char *modname,
 	}
 }
 
+static char *tokdup(const Token *t) {
+	char *s = malloc(t->len + 1);
+	if (!s) die("couldn't allocate memory");
+	memcpy(s, t->loc, t->len);
+	s[t->len] = '\0';
+	return s;
+}
+
+// NOTE: this only accepts the simplest possible field declarations - one field
+// per declaration, with the type being everything before the name, plus maybe
+// a single array size after it, which is tacked onto the type as e.g. char[16].
+// Anything fancier is an error, rather than something we'd silently get wrong.
+void cmeta_msgstructmacros(const struct cmeta *cm, void (*cb)(const char *name,
+		const char *const *types, const char *const *fields, int nfields,
+		void *ctxt), void *ctxt) {
+	const Token *tp = (const Token *)cm;
+	while (tp) {
+		if (!equal(tp, "DEF_MSGSTRUCT") || !equal(tp->next, "(")) {
+			tp = tp->next;
+			continue;
+		}
+		tp = tp->next->next;
+		if (!tp || tp->kind != TK_IDENT || !equal(tp->next, ")") ||
+				!equal(tp->next->next, "{")) {
+			fprintf(stderr, "cmeta: fatal: malformed DEF_MSGSTRUCT in %s\n",
+					tp ? tp->filename : "(EOF)");
+			exit(2);
+		}
+		char *name = tokdup(tp);
+		struct vec_str types = {0}, fields = {0};
+		for (tp = tp->next->next->next; tp && !equal(tp, "}"); tp = tp->next) {
+			const Token *start = tp, *last = 0, *field = 0, *dim = 0;
+			for (; tp && !equal(tp, ";"); last = tp, tp = tp->next) {
+				if (equal(tp, "[") && !dim && last && tp->next &&
+						equal(tp->next->next, "]") &&
+						equal(tp->next->next->next, ";")) {
+					field = last; dim = tp->next;
+					tp = dim->next; // skip to the ], which the ; should follow
+					continue;
+				}
+				if (equal(tp, "*") || equal(tp, "[") || equal(tp, ",") ||
+						equal(tp, "(") || equal(tp, "{") || equal(tp, "}")) {
+					fprintf(stderr, "cmeta: fatal: unsupported field in "
+							"DEF_MSGSTRUCT(%s) in %s\n", name, tp->filename);
+					exit(2);
+				}
+			}
+			if (!dim) field = last;
+			if (!tp || !field || field == start || field->kind != TK_IDENT) {
+				fprintf(stderr, "cmeta: fatal: malformed field in "
+						"DEF_MSGSTRUCT(%s) in %s\n", name, start->filename);
+				exit(2);
+			}
+			char *type = join_tokens(start, field);
+			if (dim) {
+				int len = strlen(type);
+				type = realloc(type, len + dim->len + 3);
+				if (!type) die("couldn't allocate memory");
+				snprintf(type + len, dim->len + 3, "[%.*s]", dim->len,
+						dim->loc);
+			}
+			if (!vec_push(&types, type) || !vec_push(&fields, tokdup(field))) {
+				die("couldn't append to array");
+			}
+		}
+		if (!tp) {
+			fprintf(stderr, "cmeta: fatal: unexpected EOF in DEF_MSGSTRUCT(%s)"
+					"\n", name);
+			exit(2);
+		}
+		cb(name, types.data, fields.data, fields.sz, ctxt);
+	}
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80 fdm=marker
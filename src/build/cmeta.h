@@ -82,6 +82,16 @@ void cmeta_evdefmacros(const struct cmeta *cm, void (*cb)(const char *name,
  */
 void cmeta_evhandlermacros(const struct cmeta *cm, const char *modname,
 		void (*cb)(const char *evname, const char *modname));
+
+/*
+ * Iterates through all structs defined using DEF_MSGSTRUCT() from msgstruct.h,
+ * passing each one's name and list of field types and names to the callback cb.
+ * Array fields have their size appended to the type, e.g. "char[16]".
+ */
+void cmeta_msgstructmacros(const struct cmeta *cm, void (*cb)(const char *name,
+		const char *const *types, const char *const *fields, int nfields,
+		void *ctxt), void *ctxt);
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -280,6 +280,386 @@ F( "	has_%s = status_%s == FEAT_OK;", f->modname, f->modname)
 	f->dfsstate = SEEN;
 }
 
+enum msgkind {
+	MK_BOOL, MK_S32, MK_U32, MK_S64, MK_U64, MK_FLOAT, MK_DOUBLE,
+	MK_STR // fixed-size char array holding a null-terminated string
+};
+static const struct msgtype {
+	const char *name;
+	enum msgkind kind;
+	int min; uint max; // extra range checks for narrow types; 0 = none needed
+} msgtypes[] = {
+	{"bool", MK_BOOL}, {"_Bool", MK_BOOL},
+	{"float", MK_FLOAT}, {"double", MK_DOUBLE},
+	{"schar", MK_S32, -128, 127}, {"s8", MK_S32, -128, 127},
+	{"signed char", MK_S32, -128, 127},
+	{"short", MK_S32, -32768, 32767}, {"s16", MK_S32, -32768, 32767},
+	{"int", MK_S32}, {"s32", MK_S32},
+	{"uchar", MK_U32, 0, 255}, {"u8", MK_U32, 0, 255},
+	{"unsigned char", MK_U32, 0, 255},
+	{"ushort", MK_U32, 0, 65535}, {"u16", MK_U32, 0, 65535},
+	{"unsigned short", MK_U32, 0, 65535},
+	{"uint", MK_U32}, {"u32", MK_U32}, {"unsigned int", MK_U32},
+	{"unsigned", MK_U32},
+	{"vlong", MK_S64}, {"s64", MK_S64}, {"long long", MK_S64},
+	{"uvlong", MK_U64}, {"u64", MK_U64}, {"unsigned long long", MK_U64},
+	{"char[]", MK_STR} // array sizes are matched separately
+};
+static const int msgkindmaxsz[] = {1, 5, 5, 9, 9, 5, 9};
+
+// msgpack's integer encodings, smallest first, matching what msg_puts() and
+// msg_putu() pick. a byte count of 0 means a fixnum, where the value is the
+// marker byte
+static const struct msgintwidth {
+	vlong min; uvlong max;
+	uchar marker, nbytes;
+} msguints[] = {
+	{0, 127, 0, 0}, {0, 255, 0xCC, 1}, {0, 65535, 0xCD, 2},
+	{0, 4294967295, 0xCE, 4}, {0, 18446744073709551615ull, 0xCF, 8}
+}, msgsints[] = {
+	{-32, 127, 0, 0}, {-128, 127, 0xD0, 1}, {-32768, 32767, 0xD1, 2},
+	{-2147483647 - 1, 2147483647, 0xD2, 4},
+	{-9223372036854775807ll - 1, 9223372036854775807ll, 0xD3, 8}
+};
+
+// returns the smallest encoding that fits every value of an integer type; any
+// wider ones can never be used, and this one is the type's worst case
+static const struct msgintwidth *msgintmaxwidth(const struct msgtype *t) {
+	const struct msgintwidth *w;
+	vlong min; uvlong max;
+	switch (t->kind) {
+		case MK_S32:
+			w = msgsints; min = -2147483647 - 1; max = 2147483647;
+			break;
+		case MK_U32:
+			w = msguints; min = 0; max = 4294967295;
+			break;
+		case MK_S64: return msgsints + countof(msgsints) - 1;
+		case MK_U64: return msguints + countof(msguints) - 1;
+		default: unreachable;
+	}
+	if (t->max) { min = t->min; max = t->max; }
+	while (w->min > min || w->max < max) ++w;
+	return w;
+}
+
+// writes out the smallest-encoding branches for an integer field inline, so
+// that the generated encoder doesn't have to call msg_puts() and such for every
+// single field. like msg_putu8() and msg_puts8(), fixnums and 1-byte values are
+// picked between without a branch, since small values tend to be all over the
+// place on either side of that line; wider values are rarer and predictable.
+// widths which the field's type could never need are left out entirely
+static void putintfield(FILE *out, const struct msgtype *t, const char *field) {
+	bool issigned = t->kind == MK_S32 || t->kind == MK_S64;
+	bool is64 = t->kind == MK_S64 || t->kind == MK_U64;
+	const struct msgintwidth *w = issigned ? msgsints : msguints;
+	const struct msgintwidth *last = msgintmaxwidth(t);
+	// comparisons are done on the field's own type, and the stores on an
+	// unsigned copy, so that the shifts are all well defined
+	if (issigned) {
+F( "		%s v = s->%s;", is64 ? "long long" : "int", field)
+F( "		%s x = v;", is64 ? "unsigned long long" : "unsigned int")
+	}
+	else {
+F( "		%s x = s->%s;", is64 ? "unsigned long long" : "unsigned int", field)
+	}
+	for (++w; w <= last; ++w) {
+		const char *else_ = w - 1 == msgsints || w - 1 == msguints ? "" :
+				"else ";
+		int indent = 2;
+		if (w != last) {
+			if (!issigned) {
+F( "		%sif (x <= %llu) {", else_, w->max)
+			}
+			else if (w->min < -2147483647) {
+				// spell out INT_MIN the portable way, just in case
+F( "		%sif (v >= %lld - 1 && v <= %lld) {", else_, w->min + 1,
+		(vlong)w->max)
+			}
+			else {
+F( "		%sif (v >= %lld && v <= %lld) {", else_, w->min, (vlong)w->max)
+			}
+			++indent;
+		}
+		else if (*else_) {
+_( "		else {")
+			++indent;
+		}
+		const char *tabs = "\t\t\t" + 3 - indent;
+		if (w->nbytes == 1) {
+			// fixnums are the value as-is; otherwise it's after the marker
+			if (issigned) {
+F( "%sint off = v < %lld;", tabs, w[-1].min)
+			}
+			else {
+F( "%sint off = x > %llu;", tabs, w[-1].max)
+			}
+F( "%sp[0] = 0x%02X; p[off] = x; p += off + 1;", tabs, w->marker)
+		}
+		else {
+			if (fprintf(out, "%sp[0] = 0x%02X;", tabs, w->marker) < 0) {
+				die("couldn't write to file");
+			}
+			for (int i = 1; i <= w->nbytes; ++i) {
+				// 4 stores to a line, so that nothing goes past 80 columns
+				if (fprintf(out, "%s", i % 4 ? " " : "\n") < 0 ||
+						!(i % 4) && fputs(tabs, out) < 0) {
+					die("couldn't write to file");
+				}
+				int shift = (w->nbytes - i) * 8;
+				if (fprintf(out, shift ? "p[%d] = x >> %d;" : "p[%d] = x;", i,
+						shift) < 0) {
+					die("couldn't write to file");
+				}
+			}
+F( " p += %d;", w->nbytes + 1)
+		}
+		if (indent == 3) _( "		}")
+	}
+}
+
+struct msgstructctxt {
+	const char *modname;
+	FILE *out; // opened on first use, so most modules get no file at all
+};
+
+// appends a pre-encoded string header and contents to buf, returning its length
+static int msgstr(uchar *buf, const char *s) {
+	int len = strlen(s), hdr;
+	if (len < 32) { buf[0] = 0xA0 | len; hdr = 1; }
+	else if (len < 256) { buf[0] = 0xD9; buf[1] = len; hdr = 2; }
+	else { die("msgstruct name is way too long"); }
+	memcpy(buf + hdr, s, len);
+	return hdr + len;
+}
+
+// writes a string literal of raw bytes; every byte is escaped so that nothing
+// can run into a preceding hex escape
+static void putbytes(FILE *out, const uchar *buf, int len) {
+	if (fputc('"', out) == EOF) die("couldn't write to file");
+	for (int i = 0; i < len; ++i) {
+		if (fprintf(out, "\\x%02X", buf[i]) < 0) die("couldn't write to file");
+	}
+	if (fputc('"', out) == EOF) die("couldn't write to file");
+}
+
+static void onmsgstruct(const char *name, const char *const *types,
+		const char *const *fields, int nfields, void *ctxt) {
+	struct msgstructctxt *msc = ctxt;
+	FILE *out = msc->out;
+	if (!out) {
+		char path[256];
+		if (snprintf(path, sizeof(path), ".build/include/msgstruct_%s.gen.h",
+				msc->modname) >= sizeof(path)) {
+			die("module name is too long");
+		}
+		out = msc->out = fopen(path, "wb");
+		if (!out) die("couldn't open msgstruct gen header");
+H()
+_( "#include <string.h>")
+	}
+	if (nfields > 65535) die("msgstruct has too many fields");
+	const struct msgtype **ft = malloc(nfields * sizeof(*ft));
+	int *strmax = malloc(nfields * sizeof(*strmax)); // only for MK_STR
+	if (!ft || !strmax) die("couldn't allocate memory");
+	for (int i = 0; i < nfields; ++i) {
+		// arrays are looked up without their size, e.g. char[16] as char[]
+		const char *type = types[i], *dim = strchr(type, '[');
+		char buf[64];
+		if (dim) {
+			char *end;
+			long n = strtol(dim + 1, &end, 10);
+			// the null terminator takes up one of the chars, and the rest has
+			// to fit in a str16 (not that anything should be anywhere near)
+			if (n < 2 || n > 65536 || strcmp(end, "]")) {
+				fprintf(stderr, "codegen: error: unsupported array size for "
+						"field `%s` of msgstruct `%s`\n", fields[i], name);
+				exit(2);
+			}
+			strmax[i] = n - 1;
+			snprintf(buf, sizeof(buf), "%.*s[]", (int)(dim - type), type);
+			type = buf;
+		}
+		for (const struct msgtype *t = msgtypes; t - msgtypes <
+				countof(msgtypes); ++t) {
+			if (!strcmp(t->name, type)) { ft[i] = t; goto ok; }
+		}
+		fprintf(stderr, "codegen: error: unsupported type `%s` for field `%s` "
+				"of msgstruct `%s`\n", types[i], fields[i], name);
+		exit(2);
+ok:;
+	}
+	// the array header, struct name, map header and first key all go together
+	// in one constant, since they all come before any actual data
+	uchar prefix[1 + 257 + 3 + 257];
+	int prefixlen = 1;
+	prefix[0] = 0x92;
+	prefixlen += msgstr(prefix + prefixlen, name);
+	if (nfields < 16) {
+		prefix[prefixlen++] = 0x80 | nfields;
+	}
+	else {
+		prefix[prefixlen++] = 0xDE;
+		prefix[prefixlen++] = nfields >> 8; prefix[prefixlen++] = nfields;
+	}
+	int maxsz = prefixlen, hdrlen = prefixlen;
+	if (nfields) prefixlen += msgstr(prefix + prefixlen, fields[0]);
+	uchar key[257];
+	for (int i = 0; i < nfields; ++i) {
+		maxsz += msgstr(key, fields[i]);
+		switch_exhaust_enum (msgkind, ft[i]->kind) {
+			case MK_S32: case MK_U32: case MK_S64: case MK_U64:
+				maxsz += 1 + msgintmaxwidth(ft[i])->nbytes;
+				break;
+			case MK_BOOL: case MK_FLOAT: case MK_DOUBLE:
+				maxsz += msgkindmaxsz[ft[i]->kind];
+				break;
+			case MK_STR:
+				maxsz += (strmax[i] < 32 ? 1 : strmax[i] < 256 ? 2 : 3) +
+						strmax[i];
+		}
+	}
+_( "")
+F( "#define MSG_MAXSZ_%s %d", name, maxsz)
+_( "")
+F( "static inline unsigned int msg_encode_%s(unsigned char *out,", name)
+F( "		const struct %s *s) {", name)
+_( "	unsigned char *p = out;")
+	fputs("\tmemcpy(p, ", out); putbytes(out, prefix, prefixlen);
+F( ", %d); p += %d;", prefixlen, prefixlen)
+	for (int i = 0; i < nfields; ++i) {
+		if (i) {
+			int keylen = msgstr(key, fields[i]);
+			fputs("\tmemcpy(p, ", out); putbytes(out, key, keylen);
+F( ", %d); p += %d;", keylen, keylen)
+		}
+		switch_exhaust_enum (msgkind, ft[i]->kind) {
+			case MK_BOOL:
+F( "	*p++ = 0xC2 | s->%s;", fields[i])
+				break;
+			case MK_S32: case MK_U32: case MK_S64: case MK_U64:
+_( "	{")
+				putintfield(out, ft[i], fields[i]);
+_( "	}")
+				break;
+			case MK_STR:
+				// an unterminated string gets cut short instead of running off
+				// the end of the array
+_( "	{")
+F( "		const char *e = memchr(s->%s, 0, %d);", fields[i], strmax[i])
+F( "		unsigned int len = e ? e - s->%s : %d;", fields[i], strmax[i])
+				if (strmax[i] < 32) {
+_( "		*p++ = 0xA0 | len;")
+				}
+				else {
+_( "		p += msg_putssz(p, len);")
+				}
+F( "		memcpy(p, s->%s, len); p += len;", fields[i])
+_( "	}")
+				break;
+			case MK_FLOAT:
+_( "	{")
+_( "		unsigned int x;")
+F( "		memcpy(&x, &s->%s, 4);", fields[i])
+_( "		p[0] = 0xCA; p[1] = x >> 24; p[2] = x >> 16; p[3] = x >> 8;")
+_( "		p[4] = x; p += 5;")
+_( "	}")
+				break;
+			case MK_DOUBLE:
+_( "	{")
+_( "		unsigned long long x;")
+F( "		memcpy(&x, &s->%s, 8);", fields[i])
+_( "		p[0] = 0xCB; p[1] = x >> 56; p[2] = x >> 48; p[3] = x >> 40;")
+_( "		p[4] = x >> 32; p[5] = x >> 24; p[6] = x >> 16; p[7] = x >> 8;")
+_( "		p[8] = x; p += 9;")
+_( "	}")
+		}
+	}
+_( "	return p - out;")
+_( "}")
+_( "")
+F( "static inline bool msg_decode_%s(struct msg_cursor *cur,", name)
+F( "		struct %s *s) {", name)
+_( "	struct msg_cursor c = *cur;")
+_( "	unsigned int n; const char *k;")
+	// fast path: if the header is exactly what we'd have written, skip it in
+	// one go. otherwise, take the slow path in case someone else has encoded
+	// things a bit differently (e.g. not picking the smallest sizes)
+F( "	if ((unsigned long)(c.end - c.p) >= %d &&", hdrlen)
+	fputs("\t\t\t!memcmp(c.p, ", out); putbytes(out, prefix, hdrlen);
+F( ", %d)) {", hdrlen)
+F( "		c.p += %d; n = %d;", hdrlen, nfields)
+_( "	}")
+_( "	else {")
+_( "		if (!msg_getasz(&c, &n) || n != 2) return false;")
+_( "		if (!msg_getstr(&c, &k, &n)) return false;")
+F( "		if (n != %d || memcmp(k, \"%s\", %d)) return false;",
+		(int)strlen(name), name, (int)strlen(name))
+_( "		if (!msg_getmsz(&c, &n)) return false;")
+_( "	}")
+	if (nfields) { // (empty struct literals aren't a thing)
+F( "	*s = (struct %s){0};", name)
+	}
+_( "	for (; n; --n) {")
+_( "		unsigned int klen;")
+_( "		if (!msg_getstr(&c, &k, &klen)) return false;")
+	for (int i = 0; i < nfields; ++i) {
+		int len = strlen(fields[i]);
+F( "		%sif (klen == %d && !memcmp(k, \"%s\", %d)) {", i ? "else " : "",
+		len, fields[i], len)
+		switch_exhaust_enum (msgkind, ft[i]->kind) {
+			case MK_BOOL:
+_( "			_Bool x; if (!msg_getbool(&c, &x)) return false;")
+				break;
+			case MK_S32:
+_( "			int x; if (!msg_gets32(&c, &x)) return false;")
+				if (ft[i]->max) {
+F( "			if (x < %d || x > %u) return false;", ft[i]->min, ft[i]->max)
+				}
+				break;
+			case MK_U32:
+_( "			unsigned int x; if (!msg_getu32(&c, &x)) return false;")
+				if (ft[i]->max) {
+F( "			if (x > %u) return false;", ft[i]->max)
+				}
+				break;
+			case MK_S64:
+_( "			long long x; if (!msg_gets(&c, &x)) return false;")
+				break;
+			case MK_U64:
+_( "			unsigned long long x; if (!msg_getu(&c, &x)) return false;")
+				break;
+			case MK_FLOAT: case MK_DOUBLE:
+_( "			double x; if (!msg_getd(&c, &x)) return false;")
+				break;
+			case MK_STR:
+_( "			const char *x; unsigned int len;")
+F( "			if (!msg_getstr(&c, &x, &len) || len > %d) return false;",
+		strmax[i])
+F( "			memcpy(s->%s, x, len); s->%s[len] = '\\0';", fields[i],
+		fields[i])
+		}
+		if (ft[i]->kind != MK_STR) { // (strings get copied in place above)
+F( "			s->%s = x;", fields[i])
+		}
+_( "		}")
+	}
+	if (nfields) {
+_( "		else if (!msg_skip(&c)) {")
+_( "			return false;")
+_( "		}")
+	}
+	else {
+_( "		if (!msg_skip(&c)) return false;")
+	}
+_( "	}")
+_( "	*cur = c;")
+_( "	return true;")
+_( "}")
+	free(strmax);
+	free(ft);
+}
+
 int OS_MAIN(int argc, os_char *argv[]) {
 	for (++argv; *argv; ++argv) {
 		const struct cmeta *cm = cmeta_loadfile(*argv);
@@ -354,6 +734,11 @@ int OS_MAIN(int argc, os_char *argv[]) {
 			}
 		}
 		cmeta_evhandlermacros(cm, modname, &onevhandler);
+		struct msgstructctxt msc = {modname};
+		cmeta_msgstructmacros(cm, &onmsgstruct, &msc);
+		if (msc.out && fclose(msc.out) == EOF) {
+			die("couldn't fully write msgstruct gen header");
+		}
 	}
 	// yet another pass because I am stupid and don't want to think harder :)
 	for (struct feature *f = features.x[0]; f; f = f->hdr.x[0]) {
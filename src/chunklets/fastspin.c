@@ -53,16 +53,23 @@ void _mm_pause(); // don't pull in emmintrin.h for this
 #include <sys/syscall.h>
 #include <unistd.h>
 
-// some arches only have a _time64 variant. doesn't actually matter what
-// timespec ABI is used here, as we don't use/expose that functionality
+// some arches only have a _time64 variant. we pass our own timespec struct in
+// the layout the kernel expects, so that the libc's _TIME_BITS doesn't matter
 #if !defined(SYS_futex) && defined( SYS_futex_time64)
 #define SYS_futex SYS_futex_time64
+struct futex_ts { long long s, ns; };
+#else
+struct futex_ts { long s, ns; };
 #endif
 
 // glibc and musl have never managed and/or bothered to provide a futex wrapper
 static inline void futex_wait(int *p, int val) {
 	syscall(SYS_futex, p, FUTEX_WAIT, val, (void *)0, (void *)0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct futex_ts ts = {ms / 1000, ms % 1000 * 1000000};
+	syscall(SYS_futex, p, FUTEX_WAIT, val, &ts, (void *)0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	syscall(SYS_futex, p, FUTEX_WAKE, (1u << 31) - 1, (void *)0, (void *)0, 0);
 }
@@ -78,6 +85,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	futex(p, FUTEX_WAIT, val, (void *)0, (void *)0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	futex(p, FUTEX_WAIT, val, &ts, (void *)0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	futex(p, FUTEX_WAKE, (1u << 31) - 1, (void *)0, (void *)0, 0);
 }
@@ -97,6 +108,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	syscall(SYS_futex, p, FUTEX_WAIT, val, (void *)0, (void *)0, 0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	syscall(SYS_futex, p, FUTEX_WAIT, val, &ts, (void *)0, 0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	syscall(SYS_futex, p, FUTEX_WAKE, (1u << 31) - 1, (void *)0, (void *)0, 0, 0);
 }
@@ -112,6 +127,11 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	_umtx_op(p, UMTX_OP_WAIT_UINT, val, 0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	// the size goes in uaddr to distinguish timespec from struct _umtx_time
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	_umtx_op(p, UMTX_OP_WAIT_UINT, val, (void *)sizeof(ts), &ts);
+}
 static inline void futex_wakeall(int *p) {
 	_umtx_op(p, UMTX_OP_WAKE, p, (1u << 31) - 1, 0, 0);
 }
@@ -127,6 +147,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	umtx_sleep(p, val, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	// timeout is in microseconds, and has to fit in an int. callers loop anyway
+	umtx_sleep(p, val, ms > 2000000 ? 2000000000 : ms * 1000);
+}
 static inline void futex_wakeall(int *p) {
 	umtx_wakeup(p, 0);
 }
@@ -150,6 +174,11 @@ extern int __ulock_wake(unsigned int op, void *addr, unsigned long long val);
 static inline void futex_wait(int *p, int val) {
 	__ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, p, val, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	// microseconds again, and 0 means forever, so round up to at least 1
+	__ulock_wait(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO, p, val,
+			ms > 4000000 ? 4000000000u : ms ? ms * 1000 : 1);
+}
 static inline void futex_wakeall(int *p) {
 	__ulock_wake(UL_COMPARE_AND_WAIT | ULF_NO_ERRNO | ULF_WAKE_ALL, uaddr, 0);
 }
@@ -173,6 +202,10 @@ long __stdcall RtlWakeAddressSingle(void *p);
 static inline void futex_wait(int *p, int val) {
 	RtlWaitOnAddress(p, &val, 4, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	long long timeout = ms * -10000ll; // 100ns units, negative = relative
+	RtlWaitOnAddress(p, &val, 4, &timeout);
+}
 static inline void futex_wakeall(int *p) {
 	RtlWakeAddressAll(p);
 }
@@ -189,6 +222,10 @@ static inline void futex_wake1(int *p) {
 static inline void futex_wait(int *p, int val) {
 	futex(p, FUTEX_WAIT, val, 0, 0, 0);
 }
+static inline void futex_waitfor(int *p, int val, unsigned int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	futex(p, FUTEX_WAIT, val, &ts, 0, 0);
+}
 static inline void futex_wakeall(int *p) {
 	futex(p, FUTEX_WAKE, 0, 0, 0, 0);
 }
@@ -209,7 +246,208 @@ performance. Need either CPU spinlock hints or futexes, ideally both.
 #endif
 
 #ifndef RELAX
-#define RELAX do; while (0) // avoid having to #ifdef RELAX everywhere now
+#define RELAX() do; while (0) // avoid having to #ifdef RELAX everywhere now
+#endif
+
+// timeouts need a clock that doesn't jump around. millisecond resolution is
+// plenty since the futex calls are only accurate to a scheduler tick anyway
+#ifdef _WIN32
+unsigned long long __stdcall GetTickCount64(void);
+int __stdcall QueryPerformanceCounter(long long *t);
+int __stdcall QueryPerformanceFrequency(long long *freq);
+static inline unsigned long long nowms(void) { return GetTickCount64(); }
+static inline unsigned long long nowns(void) {
+	long long t, freq;
+	QueryPerformanceFrequency(&freq); // cheap; just reads shared memory
+	QueryPerformanceCounter(&t);
+	return (unsigned long long)(t / freq) * 1000000000ull +
+			(unsigned long long)(t % freq) * 1000000000ull / freq;
+}
+#else
+#include <time.h>
+static inline unsigned long long nowms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+}
+static inline unsigned long long nowns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+#endif
+
+#if defined(FASTSPIN_ADAPTIVE) || defined(FASTSPIN_STATS)
+#include <stddef.h>
+
+static inline unsigned int addrhash(const volatile void *p) {
+	return (unsigned int)((size_t)p >> 2) * 2654435769u;
+}
+#endif
+
+#ifdef FASTSPIN_STATS
+
+// Opt-in contention statistics. Each counter is bumped with a relaxed atomic
+// add, both in a global total and in a per-lock entry in a small open-addressed
+// table keyed by address. With FASTSPIN_STATS undefined, STAT() is nothing and
+// the code comes out exactly as before.
+enum { ST_FAST, ST_SPINWIN, ST_SLEEP, ST_WAKE, ST_SPINS, ST_COUNT };
+
+static struct statent {
+	_Atomic(const volatile void *) key;
+	_Atomic unsigned long long n[ST_COUNT];
+} stattab[256], stattotal;
+
+#define STATTAB_COUNT (sizeof(stattab) / sizeof(*stattab))
+
+static struct statent *findstat(const volatile void *p, _Bool add) {
+	unsigned int i = addrhash(p) >> 24;
+	for (unsigned int n = 0; n < STATTAB_COUNT; ++n, i = (i + 1) & 255) {
+		const volatile void *k = atomic_load_explicit(&stattab[i].key,
+				memory_order_relaxed);
+		if (k == p) return stattab + i;
+		if (!k) {
+			if (!add) return 0;
+			if (atomic_compare_exchange_strong_explicit(&stattab[i].key, &k,
+					p, memory_order_relaxed, memory_order_relaxed) || k == p) {
+				return stattab + i;
+			}
+		}
+	}
+	return 0; // table's full; only count the total
+}
+
+static void stat(const volatile void *p, int which, unsigned long long n) {
+	atomic_fetch_add_explicit(stattotal.n + which, n, memory_order_relaxed);
+	struct statent *e = findstat(p, 1);
+	if (e) atomic_fetch_add_explicit(e->n + which, n, memory_order_relaxed);
+}
+
+#define STAT(p, which, n) stat(p, which, n)
+
+static void copystats(struct statent *e, struct fastspin_stats *out) {
+	unsigned long long n[ST_COUNT] = {0};
+	if (e) for (int i = 0; i < ST_COUNT; ++i) {
+		n[i] = atomic_load_explicit(e->n + i, memory_order_relaxed);
+	}
+	out->fastacquires = n[ST_FAST];
+	out->spinacquires = n[ST_SPINWIN];
+	out->sleeps = n[ST_SLEEP];
+	out->wakes = n[ST_WAKE];
+	out->spins = n[ST_SPINS];
+}
+
+void fastspin_stats(const volatile int *p, struct fastspin_stats *out) {
+	copystats(p ? findstat(p, 0) : &stattotal, out);
+}
+
+void fastspin_resetstats(void) {
+	for (int i = 0; i < ST_COUNT; ++i) {
+		atomic_store_explicit(stattotal.n + i, 0, memory_order_relaxed);
+	}
+	for (unsigned int i = 0; i < STATTAB_COUNT; ++i) {
+		atomic_store_explicit(&stattab[i].key, 0, memory_order_relaxed);
+		for (int j = 0; j < ST_COUNT; ++j) {
+			atomic_store_explicit(stattab[i].n + j, 0, memory_order_relaxed);
+		}
+	}
+}
+
+#else
+#define STAT(p, which, n) ((void)0)
+#endif
+
+#ifndef NO_FUTEX
+
+// Spinning before sleeping only pays off for about as long as a futex sleep and
+// wakeup would have taken. The cost of RELAX() varies wildly between CPUs (x86
+// pause went from ~10 cycles to ~140 in Skylake) so rather than hardcoding an
+// iteration count, we time some RELAX()es the first time any lock contends and
+// work out how many fit in the target time. Define FASTSPIN_SPIN_NS to tune it.
+#ifndef FASTSPIN_SPIN_NS
+#define FASTSPIN_SPIN_NS 3000
+#endif
+#define SPIN_MIN 16
+#define SPIN_MAX 100000
+
+static _Atomic int spinbudget = 0; // 0 = not calibrated yet
+
+#ifdef FASTSPIN_ADAPTIVE
+
+// Opt-in: additionally keep a running average of how many spins it took to
+// acquire each lock (well, each hash bucket of locks) and spin up to about
+// twice that, like glibc's adaptive mutexes. Spinning which ends in sleeping
+// anyway drags the average down, so locks that tend to be held for a long time
+// settle into going to sleep quickly, while briefly-held ones keep spinning.
+static _Atomic int spinavgs[64];
+
+static inline _Atomic int *spinavg(const volatile void *p) {
+	return spinavgs + (addrhash(p) >> 26);
+}
+#endif
+
+static int calibrate(void) {
+	// ramp up until a batch is long enough to time properly, then take the best
+	// of a few runs, in case we got preempted or interrupted along the way
+	unsigned int n = 64;
+	unsigned long long t;
+	for (;;) {
+		t = nowns();
+		for (unsigned int i = 0; i < n; ++i) RELAX();
+		t = nowns() - t;
+		if (t >= 20000 || n >= 1u << 20) break;
+		n *= 2;
+	}
+	for (int run = 0; run < 2; ++run) {
+		unsigned long long t1 = nowns();
+		for (unsigned int i = 0; i < n; ++i) RELAX();
+		t1 = nowns() - t1;
+		if (t1 < t) t = t1;
+	}
+	unsigned long long budget = t ? FASTSPIN_SPIN_NS * n / t : SPIN_MAX;
+	if (budget < SPIN_MIN) budget = SPIN_MIN;
+	else if (budget > SPIN_MAX) budget = SPIN_MAX;
+#ifdef FASTSPIN_ADAPTIVE
+	for (int i = 0; i < sizeof(spinavgs) / sizeof(*spinavgs); ++i) {
+		atomic_store_explicit(spinavgs + i, budget / 2, memory_order_relaxed);
+	}
+#endif
+	// if multiple threads race to get here, they'll all get about the same
+	// answer anyway, so it doesn't matter who wins
+	atomic_store_explicit(&spinbudget, budget, memory_order_relaxed);
+	return budget;
+}
+
+// Returns how many times to spin on p before sleeping.
+static inline int spinlimit(const volatile void *p) {
+	int n = atomic_load_explicit(&spinbudget, memory_order_relaxed);
+	if (!n) n = calibrate();
+#ifdef FASTSPIN_ADAPTIVE
+	int lim = atomic_load_explicit(spinavg(p), memory_order_relaxed) * 2 +
+			SPIN_MIN;
+	if (lim < n) n = lim;
+#endif
+	return n;
+}
+
+// Records how a contended acquire on p went: how many spins it used and whether
+// spinning alone was enough. Does nothing unless FASTSPIN_ADAPTIVE is defined.
+static inline void spinresult(const volatile void *p, int used, _Bool won) {
+	STAT(p, ST_SPINS, used);
+	if (won) STAT(p, ST_SPINWIN, 1);
+#ifdef FASTSPIN_ADAPTIVE
+	_Atomic int *a = spinavg(p);
+	int avg = atomic_load_explicit(a, memory_order_relaxed);
+	// racing updates can get lost, but this is only a heuristic anyway
+	avg += ((won ? used : 0) - avg) / 8;
+	atomic_store_explicit(a, avg, memory_order_relaxed);
+#else
+	(void)p; (void)used; (void)won;
+#endif
+}
+
+#else
+#define spinresult(p, used, won) ((void)(used), (void)(won)) // fewer #ifdefs
 #endif
 
 void fastspin_raise(volatile int *p_, int val) {
@@ -220,70 +458,142 @@ void fastspin_raise(volatile int *p_, int val) {
 	// for the futex implementation, try to avoid the wake syscall if we know
 	// nothing had to sleep
 	if (atomic_exchange_explicit(p, val, memory_order_release)) {
+		STAT(p, ST_WAKE, 1);
 		futex_wakeall((int *)p);
 	}
 #endif
 }
 
-int fastspin_wait(volatile int *p_) {
-	_Atomic int *p = (_Atomic int *)p_;
+// The wait and lock functions are each shared between the timed and untimed
+// variants. timed is always a constant, so the untimed variants compile down to
+// the same code they would be if written out separately.
+
+static inline int dowait(_Atomic int *p, unsigned int ms, _Bool timed) {
 	int x = atomic_load_explicit(p, memory_order_acquire);
+	if (x > 0) {
+		STAT(p, ST_FAST, 1);
+		return x;
+	}
+	unsigned long long deadline = timed ? nowms() + ms : 0;
 #ifdef NO_FUTEX
-	if (x) return x;
 	// only need acquire ordering once, then can avoid cache coherence overhead.
-	do {
+	for (unsigned int c = 1; ; ++c) {
 		x = atomic_load_explicit(p, memory_order_relaxed);
+		if (x) break;
 		RELAX();
-	} while (x);
+		if (timed && !(c & 1023) && nowms() >= deadline) return 0;
+	}
+	atomic_thread_fence(memory_order_acquire);
+	return x;
 #else
-	if (x > 0) return x;
 	if (!x) {
-		for (int c = 1000; c; --c) {
+		int n = spinlimit(p);
+		for (int c = n; c; --c) {
 			x = atomic_load_explicit(p, memory_order_relaxed);
 			RELAX();
-			if (x > 0) return x;
+			if (x > 0) {
+				spinresult(p, n - c + 1, 1);
+				atomic_thread_fence(memory_order_acquire);
+				return x;
+			}
 		}
+		spinresult(p, n, 0);
 		// cmpxchg a negative (invalid) value. this will fail in two cases:
 		// 1. someone else already cmpxchg'd: the futex_wait() will work fine
 		// 2. raise() was already called: the futex_wait() will return instantly
 		atomic_compare_exchange_strong_explicit(p, &(int){0}, -1,
 				memory_order_acq_rel, memory_order_relaxed);
-		futex_wait((int *)p, -1);
 	}
-	return atomic_load_explicit(p, memory_order_relaxed);
+	for (;;) {
+		if (timed) {
+			unsigned long long now = nowms();
+			if (now >= deadline) break;
+			STAT(p, ST_SLEEP, 1);
+			futex_waitfor((int *)p, -1, deadline - now);
+		}
+		else {
+			STAT(p, ST_SLEEP, 1);
+			futex_wait((int *)p, -1);
+		}
+		// loop in case of spurious wakeups (e.g. signals on some OSes)
+		x = atomic_load_explicit(p, memory_order_acquire);
+		if (x > 0) return x;
+	}
+	// one last check in case we timed out just as the event was raised
+	x = atomic_load_explicit(p, memory_order_acquire);
+	return x > 0 ? x : 0;
 #endif
 }
 
-void fastspin_lock(volatile int *p_) {
-	_Atomic int *p = (_Atomic int *)p_;
-	int x;
-	for (;;) {
+int fastspin_wait(volatile int *p) {
+	return dowait((_Atomic int *)p, 0, 0);
+}
+
+int fastspin_wait_timeout(volatile int *p, unsigned int ms) {
+	return dowait((_Atomic int *)p, ms, 1);
+}
+
+static inline _Bool dolock(_Atomic int *p, unsigned int ms, _Bool timed) {
+	int x = 0;
+	if (atomic_compare_exchange_weak_explicit(p, &x, 1,
+			memory_order_acquire, memory_order_relaxed)) {
+		STAT(p, ST_FAST, 1);
+		return 1;
+	}
+	unsigned long long deadline = timed ? nowms() + ms : 0;
 #ifdef NO_FUTEX
-		if (!atomic_exchange_explicit(p, 1, memory_order_acquire)) return;
-		do {
-			x = atomic_load_explicit(p, memory_order_relaxed);
-			RELAX();
-		} while (x);
+	for (unsigned int c = 1; ; ++c) {
+		if (!x && !atomic_exchange_explicit(p, 1, memory_order_acquire)) {
+			return 1;
+		}
+		RELAX();
+		x = atomic_load_explicit(p, memory_order_relaxed);
+		if (timed && !(c & 1023) && nowms() >= deadline) return 0;
+	}
 #else
-top:	x = 0;
-		if (atomic_compare_exchange_weak_explicit(p, &x, 1,
+	int n = spinlimit(p);
+	for (int c = n; c; --c) {
+		RELAX();
+		x = atomic_load_explicit(p, memory_order_relaxed);
+		if (!x && atomic_compare_exchange_weak_explicit(p, &x, 1,
 				memory_order_acquire, memory_order_relaxed)) {
-			return;
+			spinresult(p, n - c + 1, 1);
+			return 1;
 		}
-		if (x) {
-			for (int c = 1000; c; --c) {
-				x = atomic_load_explicit(p, memory_order_relaxed);
-				RELAX();
-				// note: top sets x to 0 unnecessarily but clang actually does
-				// that regardless(!), probably to break loop-carried dependency
-				if (!x) goto top;
-			}
-			atomic_compare_exchange_strong_explicit(p, &(int){0}, -1,
-					memory_order_acq_rel, memory_order_relaxed);
-			futex_wait((int *)p, -1); // (then spin once more to avoid spuria)
+	}
+	spinresult(p, n, 0);
+	// Still contended, so go to sleep. -1 means locked with (possible) sleepers
+	// and tells unlock() to wake someone up. Once we do get the lock this way,
+	// it has to stay at -1 since we can't know whether anyone else is asleep.
+	while (atomic_exchange_explicit(p, -1, memory_order_acquire)) {
+		if (timed) {
+			unsigned long long now = nowms();
+			if (now >= deadline) return 0;
+			STAT(p, ST_SLEEP, 1);
+			futex_waitfor((int *)p, -1, deadline - now);
+		}
+		else {
+			STAT(p, ST_SLEEP, 1);
+			futex_wait((int *)p, -1);
 		}
-#endif
 	}
+	return 1;
+#endif
+}
+
+void fastspin_lock(volatile int *p) {
+	dolock((_Atomic int *)p, 0, 0);
+}
+
+_Bool fastspin_lock_timeout(volatile int *p, unsigned int ms) {
+	return dolock((_Atomic int *)p, ms, 1);
+}
+
+_Bool fastspin_trylock(volatile int *p) {
+	_Bool ret = atomic_compare_exchange_strong_explicit((_Atomic int *)p,
+			&(int){0}, 1, memory_order_acquire, memory_order_relaxed);
+	if (ret) STAT(p, ST_FAST, 1);
+	return ret;
 }
 
 void fastspin_unlock(volatile int *p_) {
@@ -292,9 +602,285 @@ void fastspin_unlock(volatile int *p_) {
 	atomic_store_explicit((_Atomic int *)p, 0, memory_order_release);
 #else
 	if (atomic_exchange_explicit(p, 0, memory_order_release) < 0) {
+		STAT(p, ST_WAKE, 1);
 		futex_wake1((int *)p);
 	}
 #endif
 }
 
+// Everything beyond plain locks and events packs some state into the low bits
+// of the int and uses this flag to say someone might be in futex_wait(), so
+// needs waking. The sign bit is left alone for sanity.
+#define SLEEPFLAG (1 << 30)
+
+// Everyone sleeps on the same address, so wakers always clear SLEEPFLAG (thus
+// changing the value, so nobody can fall asleep on a stale one) and then wake
+// everyone. This is only used where wakeups are rare or really do need to reach
+// everyone, so the thundering herd is acceptable.
+static inline void flagwake(_Atomic int *p) {
+#ifndef NO_FUTEX
+	atomic_fetch_and_explicit(p, ~SLEEPFLAG, memory_order_relaxed);
+	STAT(p, ST_WAKE, 1);
+	futex_wakeall((int *)p);
+#endif
+}
+
+// Sets SLEEPFLAG (if it's not already set) and goes to sleep. Returns false if
+// the value changed in the meantime, meaning the caller should just retry.
+static inline _Bool flagsleep(_Atomic int *p, int x) {
+#ifdef NO_FUTEX
+	RELAX();
+	return 1;
+#else
+	if (!(x & SLEEPFLAG) && !atomic_compare_exchange_weak_explicit(p, &x,
+			x | SLEEPFLAG, memory_order_relaxed, memory_order_relaxed)) {
+		return 0;
+	}
+	STAT(p, ST_SLEEP, 1);
+	futex_wait((int *)p, x | SLEEPFLAG);
+	return 1;
+#endif
+}
+
+// Reader/writer lock state: reader count in the low bits, then writer flags.
+#define RW_READERS 0x0FFFFFFF
+#define RW_WRWAIT (1 << 28) // writer waiting: new readers must hold off
+#define RW_WRLOCKED (1 << 29)
+
+void fastspin_rdlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_relaxed);
+	if (!(x & (RW_WRLOCKED | RW_WRWAIT)) &&
+			atomic_compare_exchange_weak_explicit(p, &x, x + 1,
+				memory_order_acquire, memory_order_relaxed)) {
+		STAT(p, ST_FAST, 1);
+		return;
+	}
+#ifdef NO_FUTEX
+	int n = 1, c = 1; // flagsleep() just spins, so there's no budget needed
+#else
+	int n = spinlimit(p), c = n;
+#endif
+	for (;;) {
+		if (!(x & (RW_WRLOCKED | RW_WRWAIT))) {
+			if (atomic_compare_exchange_weak_explicit(p, &x, x + 1,
+					memory_order_acquire, memory_order_relaxed)) {
+				if (c != n) spinresult(p, n - c, c);
+				return;
+			}
+			continue; // x was reloaded; likely just another reader
+		}
+		if (c) {
+			--c;
+			RELAX();
+		}
+		else {
+			flagsleep(p, x);
+		}
+		x = atomic_load_explicit(p, memory_order_relaxed);
+	}
+}
+
+void fastspin_rdunlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_fetch_sub_explicit(p, 1, memory_order_release) - 1;
+	// last reader out lets any sleeping writer(s) in
+	if (!(x & RW_READERS) && x & SLEEPFLAG) flagwake(p);
+}
+
+void fastspin_wrlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = 0;
+	if (atomic_compare_exchange_weak_explicit(p, &x, RW_WRLOCKED,
+			memory_order_acquire, memory_order_relaxed)) {
+		STAT(p, ST_FAST, 1);
+		return;
+	}
+#ifdef NO_FUTEX
+	int n = 1, c = 1;
+#else
+	int n = spinlimit(p), c = n;
+#endif
+	for (;;) {
+		if (!(x & (RW_READERS | RW_WRLOCKED))) {
+			// keep SLEEPFLAG so that unlock still wakes up anyone else waiting.
+			// RW_WRWAIT gets cleared, but any other writers still waiting will
+			// just set it again, and readers can't get in until we're done.
+			if (atomic_compare_exchange_weak_explicit(p, &x,
+					RW_WRLOCKED | (x & SLEEPFLAG), memory_order_acquire,
+					memory_order_relaxed)) {
+				spinresult(p, n - c, c);
+				return;
+			}
+			continue;
+		}
+		if (!(x & RW_WRWAIT)) {
+			// writer preference: stop more readers piling in while we wait
+			atomic_compare_exchange_weak_explicit(p, &x, x | RW_WRWAIT,
+					memory_order_relaxed, memory_order_relaxed);
+			continue;
+		}
+		if (c) {
+			--c;
+			RELAX();
+		}
+		else {
+			flagsleep(p, x);
+		}
+		x = atomic_load_explicit(p, memory_order_relaxed);
+	}
+}
+
+void fastspin_wrunlock(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	// nobody else can hold the lock, so just clear everything out. any waiting
+	// writers will set RW_WRWAIT again once woken.
+	if (atomic_exchange_explicit(p, 0, memory_order_release) & SLEEPFLAG) {
+#ifndef NO_FUTEX
+		STAT(p, ST_WAKE, 1);
+		futex_wakeall((int *)p);
+#endif
+	}
+}
+
+// Latches: just a count, plus SLEEPFLAG.
+#define LATCH_COUNT (SLEEPFLAG - 1)
+
+void fastspin_latch_arrive(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	// release so that waiters see everything done before arriving. since this
+	// is an RMW, the last arrival carries all the previous ones' releases too
+	int x = atomic_fetch_sub_explicit(p, 1, memory_order_release) - 1;
+	if (x == SLEEPFLAG) flagwake(p); // 0 left, and someone's asleep
+}
+
+void fastspin_latch_wait(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_acquire);
+	if (!(x & LATCH_COUNT)) {
+		STAT(p, ST_FAST, 1);
+		return;
+	}
+#ifdef NO_FUTEX
+	int n = 1, c = 1;
+#else
+	int n = spinlimit(p), c = n;
+#endif
+	do {
+		if (c) {
+			--c;
+			RELAX();
+		}
+		else {
+			flagsleep(p, x);
+		}
+		x = atomic_load_explicit(p, memory_order_relaxed);
+	} while (x & LATCH_COUNT);
+	spinresult(p, n - c, c);
+	atomic_thread_fence(memory_order_acquire);
+}
+
+// Barriers: the arrival count goes in the low bits, followed by a generation
+// number which changes each time everyone has arrived. Waiters watch that
+// rather than the count, so they can't miss their release if the barrier gets
+// reused (and thus the count starts going up again) straight away.
+#define BAR_COUNT 0x3FFF
+#define BAR_GENONE (BAR_COUNT + 1)
+#define BAR_GEN (SLEEPFLAG - BAR_GENONE)
+
+_Bool fastspin_barrier_wait(volatile int *p_, int n) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_fetch_add_explicit(p, 1, memory_order_acq_rel) + 1;
+	if ((x & BAR_COUNT) == n) {
+		// everyone else is waiting for this, so nobody else can be arriving.
+		// reset the count and bump the generation, letting it wrap around
+		int next = ((unsigned int)x + BAR_GENONE) & BAR_GEN;
+		if (atomic_exchange_explicit(p, next, memory_order_release) &
+				SLEEPFLAG) {
+#ifndef NO_FUTEX
+			STAT(p, ST_WAKE, 1);
+			futex_wakeall((int *)p);
+#endif
+		}
+		return 1;
+	}
+	int gen = x & BAR_GEN;
+#ifdef NO_FUTEX
+	int lim = 1, c = 1;
+#else
+	int lim = spinlimit(p), c = lim;
+#endif
+	do {
+		if (c) {
+			--c;
+			RELAX();
+		}
+		else {
+			flagsleep(p, x);
+		}
+		x = atomic_load_explicit(p, memory_order_relaxed);
+	} while ((x & BAR_GEN) == gen);
+	spinresult(p, lim - c, c);
+	atomic_thread_fence(memory_order_acquire);
+	return 0;
+}
+
+// Semaphores: also just a count, plus SLEEPFLAG.
+#define SEM_COUNT (SLEEPFLAG - 1)
+
+void fastspin_sem_post(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_fetch_add_explicit(p, 1, memory_order_release);
+	// one flag can't say how many are asleep. waking just one could leave
+	// others asleep even with more posts to come, since the flag is then clear.
+	// so, wake everyone; whoever doesn't get a unit just goes back to sleep.
+	if (x & SLEEPFLAG) flagwake(p);
+}
+
+_Bool fastspin_sem_trywait(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_relaxed);
+	while (x & SEM_COUNT) {
+		if (atomic_compare_exchange_weak_explicit(p, &x, x - 1,
+				memory_order_acquire, memory_order_relaxed)) {
+			STAT(p, ST_FAST, 1);
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void fastspin_sem_wait(volatile int *p_) {
+	_Atomic int *p = (_Atomic int *)p_;
+	int x = atomic_load_explicit(p, memory_order_relaxed);
+	if ((x & SEM_COUNT) && atomic_compare_exchange_weak_explicit(p, &x, x - 1,
+			memory_order_acquire, memory_order_relaxed)) {
+		STAT(p, ST_FAST, 1);
+		return;
+	}
+#ifdef NO_FUTEX
+	int n = 1, c = 1;
+#else
+	int n = spinlimit(p), c = n;
+#endif
+	for (;;) {
+		if (x & SEM_COUNT) {
+			if (atomic_compare_exchange_weak_explicit(p, &x, x - 1,
+					memory_order_acquire, memory_order_relaxed)) {
+				spinresult(p, n - c, c);
+				return;
+			}
+			continue;
+		}
+		if (c) {
+			--c;
+			RELAX();
+		}
+		else {
+			flagsleep(p, x);
+		}
+		x = atomic_load_explicit(p, memory_order_relaxed);
+	}
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -18,7 +18,10 @@
 #define INC_CHUNKLETS_FASTSPIN_H
 
 #ifdef __cplusplus
+#define _fastspin_Bool bool
 extern "C" {
+#else
+#define _fastspin_Bool _Bool
 #endif
 
 /*
@@ -35,18 +38,143 @@ void fastspin_raise(volatile int *p, int val);
  */
 int fastspin_wait(volatile int *p);
 
+/*
+ * Like fastspin_wait(), but gives up after roughly ms milliseconds.
+ *
+ * Returns the positive value that was passed to fastspin_raise(), or 0 if the
+ * timeout was reached first.
+ */
+int fastspin_wait_timeout(volatile int *p, unsigned int ms);
+
 /*
  * Takes a mutual exclusion, i.e. a lock. *p must be initialised to 0 before
  * anything starts using it as a lock.
  */
 void fastspin_lock(volatile int *p);
 
+/*
+ * Takes a lock only if it is immediately available. Returns true if the lock
+ * was taken, in which case it must later be released with fastspin_unlock().
+ */
+_fastspin_Bool fastspin_trylock(volatile int *p);
+
+/*
+ * Like fastspin_lock(), but gives up after roughly ms milliseconds. Returns
+ * true if the lock was taken before the timeout.
+ */
+_fastspin_Bool fastspin_lock_timeout(volatile int *p, unsigned int ms);
+
 /*
  * Releases a lock such that other threads may claim it. Immediately as a lock
  * is released, its value will be 0, as though it had just been initialised.
  */
 void fastspin_unlock(volatile int *p);
 
+/*
+ * Takes a shared (read) lock on a reader/writer lock. Any number of readers can
+ * hold the lock at once, but not while a writer holds it. *p must be
+ * initialised to 0 before anything starts using it as a lock.
+ *
+ * Reader/writer locks are not interchangeable with regular locks; use only the
+ * rdlock/wrlock functions on them.
+ *
+ * Writers are preferred: once a writer is waiting, new readers will wait too,
+ * so a constant stream of readers can't lock writers out indefinitely.
+ */
+void fastspin_rdlock(volatile int *p);
+
+/*
+ * Releases a shared lock taken by fastspin_rdlock().
+ */
+void fastspin_rdunlock(volatile int *p);
+
+/*
+ * Takes an exclusive (write) lock on a reader/writer lock, waiting for any
+ * current readers to finish.
+ */
+void fastspin_wrlock(volatile int *p);
+
+/*
+ * Releases an exclusive lock taken by fastspin_wrlock(). As with a regular
+ * lock, its value will then be 0, as though it had just been initialised.
+ */
+void fastspin_wrunlock(volatile int *p);
+
+/*
+ * Counts down a latch. *p must first be initialised to the number of arrivals
+ * to wait for (at most 2^30 - 1). Once that many calls have been made, everyone
+ * in fastspin_latch_wait() is released. A latch is single-use; to go again,
+ * initialise it again once nothing's waiting on it any more.
+ */
+void fastspin_latch_arrive(volatile int *p);
+
+/*
+ * Waits until a latch has been counted down to zero, returning immediately if
+ * it already has been. Anything done by each thread before it called
+ * fastspin_latch_arrive() is visible once this returns.
+ */
+void fastspin_latch_wait(volatile int *p);
+
+/*
+ * Waits until n threads (at most 16383) have called this with the same p, then
+ * releases them all. *p must be initialised to 0, and n must be the same in
+ * every call. The barrier resets itself, so it can be reused as many times as
+ * needed, for instance once per step of a multi-threaded pipeline.
+ *
+ * Returns true in exactly one of the threads (the last to arrive) and false in
+ * the rest, which is handy if one thread has to do something in between steps.
+ */
+_fastspin_Bool fastspin_barrier_wait(volatile int *p, int n);
+
+/*
+ * Adds one unit to a counting semaphore, waking a waiter if there is one. *p
+ * must be initialised to the starting count (at most 2^30 - 1). As with the
+ * other primitives, values are not interchangeable with regular locks.
+ */
+void fastspin_sem_post(volatile int *p);
+
+/*
+ * Takes one unit from a counting semaphore, waiting for one to be posted if
+ * the count is currently zero.
+ */
+void fastspin_sem_wait(volatile int *p);
+
+/*
+ * Takes one unit from a counting semaphore if one is available, returning true;
+ * otherwise returns false straight away.
+ */
+_fastspin_Bool fastspin_sem_trywait(volatile int *p);
+
+/*
+ * Contention statistics, as counted when fastspin.c is compiled with
+ * FASTSPIN_STATS defined. Each count covers all lock and wait operations,
+ * including the reader/writer lock functions.
+ */
+struct fastspin_stats {
+	unsigned long long fastacquires; /* got the lock/event without spinning */
+	unsigned long long spinacquires; /* got it after spinning for a while */
+	unsigned long long sleeps; /* number of times going to sleep in the OS */
+	unsigned long long wakes; /* number of OS calls to wake sleepers */
+	unsigned long long spins; /* total spin loop iterations */
+};
+
+/*
+ * Gets the statistics for a specific lock or event, or the totals for all of
+ * them if p is null. Per-lock counts are kept in a fixed-size table; once that
+ * fills up, locks not already in it only count towards the totals.
+ *
+ * Only available if fastspin.c was compiled with FASTSPIN_STATS defined.
+ */
+void fastspin_stats(const volatile int *p, struct fastspin_stats *out);
+
+/*
+ * Zeroes all the statistics and forgets about all locks seen so far. If other
+ * threads are using locks at the same time, some of their counts may be lost.
+ *
+ * Only available if fastspin.c was compiled with FASTSPIN_STATS defined.
+ */
+void fastspin_resetstats(void);
+
 #ifdef __cplusplus
 }
 
@@ -58,8 +186,25 @@ struct fastspin_lock_guard {
 	volatile int *_p;
 };
 
+/* Same idea, but for reader/writer locks. */
+struct fastspin_rdlock_guard {
+	fastspin_rdlock_guard(volatile int &i): _p(&i) { fastspin_rdlock(_p); }
+	fastspin_rdlock_guard() = delete;
+	~fastspin_rdlock_guard() { fastspin_rdunlock(_p); }
+	volatile int *_p;
+};
+
+struct fastspin_wrlock_guard {
+	fastspin_wrlock_guard(volatile int &i): _p(&i) { fastspin_wrlock(_p); }
+	fastspin_wrlock_guard() = delete;
+	~fastspin_wrlock_guard() { fastspin_wrunlock(_p); }
+	volatile int *_p;
+};
+
 #endif
 
+#undef _fastspin_Bool
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,159 @@
+/* This file is dedicated to the public domain. */
+
+#include <limits.h>
+#include <string.h>
+
+#include "lz.h"
+
+// The format: the uncompressed size as a little-endian base-128 varint, then a
+// series of sequences, each of which is a run of literal bytes followed by a
+// match (a copy of some earlier output). A sequence starts with a token byte;
+// the top 4 bits are the number of literals and the bottom 4 bits are the match
+// length, minus MINMATCH. A field value of 15 means more length follows, in
+// extra bytes which are added on until one of them isn't 255. Next come the
+// literals themselves, then a 2-byte little-endian offset saying how far back
+// the match starts. The final sequence just has literals, ending the data.
+
+#define MINMATCH 4
+#define MAXOFF 65535
+#define MAXHASHBITS 12
+
+static inline unsigned int load32(const unsigned char *p) {
+	unsigned int x;
+	memcpy(&x, p, sizeof(x)); // compiles down to a plain load
+	return x;
+}
+
+static inline unsigned int hash(unsigned int x, int bits) {
+	return x * 2654435761u >> (32 - bits); // Knuth's multiplicative hash
+}
+
+static inline unsigned char *putlen(unsigned char *p, unsigned int n) {
+	for (; n >= 255; n -= 255) *p++ = 255;
+	*p++ = n;
+	return p;
+}
+
+static inline unsigned char *putlits(unsigned char *p, int token,
+		const unsigned char *lits, unsigned int nlits) {
+	*p++ = (nlits < 15 ? nlits : 15) << 4 | token;
+	if (nlits >= 15) p = putlen(p, nlits - 15);
+	memcpy(p, lits, nlits);
+	return p + nlits;
+}
+
+unsigned int lz_compress(void *out_, const void *in_, unsigned int sz) {
+	unsigned char *out = out_, *p = out;
+	const unsigned char *in = in_;
+	unsigned int x = sz;
+	for (; x >= 0x80; x >>= 7) *p++ = x | 0x80;
+	*p++ = x;
+	// use a smaller table for smaller inputs. the inputs this is meant for are
+	// small enough that clearing out a big table could easily take longer
+	// than compressing them!
+	int bits = 8;
+	while (bits < MAXHASHBITS && (1u << bits) < sz) ++bits;
+	unsigned int table[1 << MAXHASHBITS]; // positions, plus 1 so 0 is empty
+	memset(table, 0, sizeof(*table) << bits);
+	unsigned int i = 0, anchor = 0;
+	if (sz >= MINMATCH) {
+		unsigned int last = sz - MINMATCH; // the last place a match can start
+		while (i <= last) {
+			unsigned int v = load32(in + i), h = hash(v, bits);
+			unsigned int ref = table[h];
+			table[h] = i + 1;
+			if (!ref || i - --ref > MAXOFF || load32(in + ref) != v) {
+				// skip ahead faster the longer we go without finding
+				// anything, so incompressible data doesn't cost too much
+				i += 1 + ((i - anchor) >> 5);
+				continue;
+			}
+			unsigned int len = MINMATCH;
+			while (i + len < sz && in[ref + len] == in[i + len]) ++len;
+			while (i > anchor && ref > 0 && in[i - 1] == in[ref - 1]) {
+				--i; --ref; ++len;
+			}
+			unsigned int off = i - ref, mlen = len - MINMATCH;
+			p = putlits(p, mlen < 15 ? mlen : 15, in + anchor, i - anchor);
+			*p++ = off;
+			*p++ = off >> 8;
+			if (mlen >= 15) p = putlen(p, mlen - 15);
+			i += len;
+			anchor = i;
+		}
+	}
+	p = putlits(p, 0, in + anchor, sz - anchor);
+	return p - out;
+}
+
+// reads the size header, returning its length, or 0 if it's bad
+static unsigned int getsize(const unsigned char *in, unsigned int sz,
+		unsigned int *out) {
+	unsigned long long x = 0;
+	for (unsigned int i = 0; i < 5 && i < sz; ++i) {
+		x |= (unsigned long long)(in[i] & 0x7F) << 7 * i;
+		if (!(in[i] & 0x80)) {
+			if (x > INT_MAX) return 0;
+			*out = x;
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+static inline _Bool getlen(const unsigned char **pp, const unsigned char *end,
+		unsigned int *n) {
+	const unsigned char *p = *pp;
+	unsigned int b;
+	do {
+		if (p == end || *n > INT_MAX) return 0;
+		b = *p++;
+		*n += b;
+	} while (b == 255);
+	*pp = p;
+	return 1;
+}
+
+int lz_decompressedsz(const void *in, unsigned int sz) {
+	unsigned int ret;
+	return getsize(in, sz, &ret) ? (int)ret : -1;
+}
+
+int lz_decompress(void *out_, unsigned int outsz, const void *in_,
+		unsigned int sz) {
+	const unsigned char *p = in_, *end = p + sz;
+	unsigned char *out = out_, *o = out;
+	unsigned int total, hdrsz = getsize(p, sz, &total);
+	if (!hdrsz || total > outsz) return -1;
+	p += hdrsz;
+	unsigned char *oend = out + total;
+	for (;;) {
+		if (p == end) return -1;
+		unsigned int token = *p++, n = token >> 4;
+		if (n == 15 && !getlen(&p, end, &n)) return -1;
+		if (n > end - p || n > oend - o) return -1;
+		memcpy(o, p, n);
+		o += n;
+		p += n;
+		// only the last sequence can end right after its literals
+		if (p == end) return o == oend ? (int)total : -1;
+		if (end - p < 2) return -1;
+		unsigned int off = p[0] | p[1] << 8;
+		p += 2;
+		n = token & 15;
+		if (n == 15 && !getlen(&p, end, &n)) return -1;
+		n += MINMATCH;
+		if (!off || off > o - out || n > oend - o) return -1;
+		const unsigned char *ref = o - off;
+		if (off >= n) {
+			memcpy(o, ref, n);
+			o += n;
+		}
+		else {
+			// overlapping, i.e. a repeating pattern; has to go a byte at a time
+			while (n--) *o++ = *ref++;
+		}
+	}
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,55 @@
+/* This file is dedicated to the public domain. */
+
+#ifndef INC_CHUNKLETS_LZ_H
+#define INC_CHUNKLETS_LZ_H
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small, fast LZ77 compressor for small buffers, in the vein of LZ4. It goes
+ * for speed over ratio: there's no entropy coding, just literal runs and
+ * back-references into the previous 64KiB, so it only really wins on data that
+ * repeats itself, such as lots of similar records with the same keys. The
+ * compressed data starts with the uncompressed size, so it can be decompressed
+ * without any other information.
+ */
+
+/*
+ * The most space that compressing sz bytes can possibly take, for sizing the
+ * output buffer. Incompressible input grows by a little under 0.5%, plus a few
+ * bytes of overhead.
+ */
+#define LZ_MAXSZ(sz) ((sz) + (sz) / 255 + 16)
+
+/*
+ * Compresses sz bytes from in, writing the result to out, which must have room
+ * for at least LZ_MAXSZ(sz) bytes. sz must be less than 2^31. Returns the
+ * number of bytes written, which may be more than sz if the input doesn't
+ * compress.
+ */
+unsigned int lz_compress(void *out, const void *in, unsigned int sz);
+
+/*
+ * Returns the size that sz bytes of compressed data in will decompress to, or
+ * -1 if in isn't long enough to say.
+ */
+int lz_decompressedsz(const void *in, unsigned int sz);
+
+/*
+ * Decompresses sz bytes of compressed data from in, into out, which has room
+ * for outsz bytes. Returns the number of bytes written, or -1 if the data is
+ * malformed or doesn't fit. This never reads or writes outside of the given
+ * buffers, however bad the data, so it's safe to use on untrusted input.
+ */
+int lz_decompress(void *out, unsigned int outsz, const void *in,
+		unsigned int sz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -19,6 +19,8 @@
 behaviour which is undefined in C++.
 #endif
 
+#include "msg.h"
+
 // _Static_assert needs MSVC >= 2019, and this check is irrelevant on Windows
 #ifndef _MSC_VER
 _Static_assert(
@@ -43,8 +45,12 @@ _Static_assert(
 // GCC, somewhat surprisingly, seems to be much better at optimising the naïve
 // version of the code, so we don't try to do anything clever there. Also, for
 // unknown, untested compilers and/or platforms, we stick to the safe approach.
-#if defined(_MSC_VER) || defined(__clang__) && (defined(__x86_64__) || \
-		defined(__i386__) || defined(__aarch64__) || defined(__arm__))
+//
+// For the sake of measuring all this (see test/msg.bench.c), either approach
+// can be forced by defining USE_BSWAP_NONSENSE or MSG_NO_BSWAP_NONSENSE.
+#if !defined(USE_BSWAP_NONSENSE) && !defined(MSG_NO_BSWAP_NONSENSE) && ( \
+		defined(_MSC_VER) || defined(__clang__) && (defined(__x86_64__) || \
+		defined(__i386__) || defined(__aarch64__) || defined(__arm__)))
 #define USE_BSWAP_NONSENSE
 #endif
 
@@ -87,7 +93,7 @@ static inline void doput32(unsigned char *out, unsigned int val) {
 #endif
 }
 
-static inline void doput64(unsigned char *out, unsigned int val) {
+static inline void doput64(unsigned char *out, unsigned long long val) {
 #ifdef USE_BSWAP_NONSENSE
 	// Clang is smart enough to make this into two bswaps and a word swap in
 	// 32-bit builds. MSVC seems to be fine too when using the above intrinsics.
@@ -100,6 +106,43 @@ static inline void doput64(unsigned char *out, unsigned int val) {
 #endif
 }
 
+// SIMD is only used for the bulk array functions, where it's worth it. We stick
+// to baseline SSE2 and AArch64 NEON so there's no need for runtime detection.
+#if defined(__SSE2__) || defined(_M_X64) || \
+		defined(_M_IX86_FP) && _M_IX86_FP >= 2
+#include <emmintrin.h>
+#define USE_SSE2
+#elif defined(__ARM_NEON) && defined(__aarch64__) || defined(_M_ARM64)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+
+// reading is the same deal in reverse. note that the offset of 1 is built in
+// here too, since every multi-byte value is preceded by a type byte.
+static inline unsigned short doget16(const unsigned char *in) {
+#ifdef USE_BSWAP_NONSENSE
+	return swap32(*(const unsigned short *)(in + 1)) >> 16;
+#else
+	return in[1] << 8 | in[2];
+#endif
+}
+
+static inline unsigned int doget32(const unsigned char *in) {
+#ifdef USE_BSWAP_NONSENSE
+	return swap32(*(const unsigned int *)(in + 1));
+#else
+	return (unsigned int)in[1] << 24 | in[2] << 16 | in[3] << 8 | in[4];
+#endif
+}
+
+static inline unsigned long long doget64(const unsigned char *in) {
+#ifdef USE_BSWAP_NONSENSE
+	return swap64(*(const unsigned long long *)(in + 1));
+#else
+	return (unsigned long long)doget32(in) << 32 | doget32(in + 4);
+#endif
+}
+
 void msg_putnil(unsigned char *out) {
 	*out = 0xC0;
 }
@@ -185,7 +228,7 @@ int msg_putd(unsigned char *out, double val) {
 	// XXX: is this really the most efficient way to check this?
 	float f = val;
 	if ((double)f == val) { msg_putf(out, f); return 5; }
-	out[0] = 0xCA;
+	out[0] = 0xCB;
 	doput64(out, doublebits(val));
 	return 9;
 }
@@ -224,7 +267,7 @@ int msg_putbsz16(unsigned char *out, int sz) {
 	if (sz < 256) { msg_putbsz8(out, sz); return 2; }
 	out[0] = 0xC5;
 	doput16(out, sz);
-	return 2 + sz;
+	return 3;
 }
 
 int msg_putbsz(unsigned char *out, unsigned int sz) {
@@ -270,4 +313,533 @@ int msg_putmsz(unsigned char *out, unsigned int sz) {
 	return 5;
 }
 
+// For the array functions, each element is put into one of 4 classes by value
+// range, corresponding to 1, 2, 3 or 5 bytes. That way, the actual writing can
+// be done without any branching: always write a (possibly bogus) type byte and
+// 4 bytes of big-endian value shifted to the front, then just advance by the
+// length of the class, letting the next element overwrite any leftover junk.
+// The caller has to give us 5 bytes per element anyway, so this is fine.
+static const unsigned char arrlens[4] = {1, 2, 3, 5};
+static const unsigned char arrshifts[4] = {0, 24, 16, 0};
+static const unsigned char utags[4] = {0, 0xCC, 0xCD, 0xCE};
+static const unsigned char stags[4] = {0, 0xD0, 0xD1, 0xD2};
+// fixnums are their own type byte. note: this is a mask rather than a ternary
+// because GCC likes to turn the latter into a very unpredictable branch!
+static const unsigned char fixmasks[4] = {0xFF, 0, 0, 0};
+
+static inline unsigned char *putarrelem(unsigned char *p, unsigned int x,
+		int cls, const unsigned char *tags) {
+	p[0] = tags[cls] | (x & fixmasks[cls]);
+	doput32(p, x << arrshifts[cls]);
+	return p + arrlens[cls];
+}
+
+static inline int uclass(unsigned int x) {
+	return (x > 127) + (x > 255) + (x > 65535);
+}
+
+static inline int sclass(int x) {
+	return (x < -32 || x > 127) + (x < -128 || x > 127) +
+			(x < -32768 || x > 32767);
+}
+
+unsigned int msg_putarr_u32(unsigned char *out, const unsigned int *vals,
+		unsigned int n) {
+	unsigned char *p = out + msg_putasz(out, n);
+	unsigned int i = 0;
+	// blocks of 8 small values can just be narrowed into fixnums all at once.
+	// this is by far the most common case for things like input codes
+#if defined(USE_SSE2)
+	const __m128i hibits = _mm_set1_epi32(~0x7F);
+	for (; n - i >= 8; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(vals + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(vals + i + 4));
+		__m128i hi = _mm_and_si128(_mm_or_si128(a, b), hibits);
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(hi, _mm_setzero_si128())) ==
+				0xFFFF) {
+			// saturation can't kick in here since everything is in range
+			__m128i w = _mm_packs_epi32(a, b);
+			_mm_storel_epi64((__m128i *)p, _mm_packus_epi16(w, w));
+			p += 8;
+		}
+		else {
+			for (int j = 0; j < 8; ++j) {
+				unsigned int x = vals[i + j];
+				p = putarrelem(p, x, uclass(x), utags);
+			}
+		}
+	}
+#elif defined(USE_NEON)
+	for (; n - i >= 8; i += 8) {
+		uint32x4_t a = vld1q_u32(vals + i), b = vld1q_u32(vals + i + 4);
+		if (vmaxvq_u32(vorrq_u32(a, b)) <= 127) {
+			uint16x8_t w = vcombine_u16(vmovn_u32(a), vmovn_u32(b));
+			vst1_u8(p, vmovn_u16(w));
+			p += 8;
+		}
+		else {
+			for (int j = 0; j < 8; ++j) {
+				unsigned int x = vals[i + j];
+				p = putarrelem(p, x, uclass(x), utags);
+			}
+		}
+	}
+#endif
+	for (; i < n; ++i) p = putarrelem(p, vals[i], uclass(vals[i]), utags);
+	return p - out;
+}
+
+unsigned int msg_putarr_s32(unsigned char *out, const int *vals,
+		unsigned int n) {
+	unsigned char *p = out + msg_putasz(out, n);
+	unsigned int i = 0;
+#if defined(USE_SSE2)
+	const __m128i lo = _mm_set1_epi32(-32), hi = _mm_set1_epi32(127);
+	for (; n - i >= 8; i += 8) {
+		__m128i a = _mm_loadu_si128((const __m128i *)(vals + i));
+		__m128i b = _mm_loadu_si128((const __m128i *)(vals + i + 4));
+		__m128i oob = _mm_or_si128(
+				_mm_or_si128(_mm_cmplt_epi32(a, lo), _mm_cmpgt_epi32(a, hi)),
+				_mm_or_si128(_mm_cmplt_epi32(b, lo), _mm_cmpgt_epi32(b, hi)));
+		if (!_mm_movemask_epi8(oob)) {
+			// negative fixnums are just the low byte, which is what we get
+			__m128i w = _mm_packs_epi32(a, b);
+			_mm_storel_epi64((__m128i *)p, _mm_packs_epi16(w, w));
+			p += 8;
+		}
+		else {
+			for (int j = 0; j < 8; ++j) {
+				int x = vals[i + j];
+				p = putarrelem(p, x, sclass(x), stags);
+			}
+		}
+	}
+#elif defined(USE_NEON)
+	for (; n - i >= 8; i += 8) {
+		int32x4_t a = vld1q_s32(vals + i), b = vld1q_s32(vals + i + 4);
+		if (vminvq_s32(vminq_s32(a, b)) >= -32 &&
+				vmaxvq_s32(vmaxq_s32(a, b)) <= 127) {
+			int16x8_t w = vcombine_s16(vmovn_s32(a), vmovn_s32(b));
+			vst1_u8(p, vreinterpret_u8_s8(vmovn_s16(w)));
+			p += 8;
+		}
+		else {
+			for (int j = 0; j < 8; ++j) {
+				int x = vals[i + j];
+				p = putarrelem(p, x, sclass(x), stags);
+			}
+		}
+	}
+#endif
+	for (; i < n; ++i) p = putarrelem(p, vals[i], sclass(vals[i]), stags);
+	return p - out;
+}
+
+unsigned int msg_putarr_f32(unsigned char *out, const float *vals,
+		unsigned int n) {
+	// nothing to classify here since floats are always the same size, so just
+	// do the obvious thing. SIMD byte swaps don't help much because of the
+	// 5-byte stride, and in practice this already becomes a tight bswap loop.
+	unsigned char *p = out + msg_putasz(out, n);
+	for (unsigned int i = 0; i < n; ++i, p += 5) {
+		p[0] = 0xCA;
+		doput32(p, floatbits(vals[i]));
+	}
+	return p - out;
+}
+
+_Bool msg_reserve(struct msg_writer *w, unsigned int sz) {
+	if (w->cap - w->len >= sz) return 1;
+	if (!w->grow || sz > 4294967295u - w->len) return 0;
+	unsigned int need = w->len + sz, newcap = w->cap ? w->cap : 64;
+	// doubling, so that lots of small reservations stay amortised O(1)
+	while (newcap < need) {
+		if (newcap > 2147483647u) { newcap = need; break; }
+		newcap *= 2;
+	}
+	void *p = w->grow(w->buf, newcap);
+	if (!p) return 0;
+	w->buf = p; w->cap = newcap;
+	return 1;
+}
+
+unsigned int msg_checkpoint(const struct msg_writer *w) { return w->len; }
+void msg_rollback(struct msg_writer *w, unsigned int cp) { w->len = cp; }
+
+void msg_wnil(struct msg_writer *w) { msg_putnil(w->buf + w->len++); }
+
+void msg_wbool(struct msg_writer *w, _Bool val) {
+	msg_putbool(w->buf + w->len++, val);
+}
+
+void msg_ws32(struct msg_writer *w, int val) {
+	w->len += msg_puts32(w->buf + w->len, val);
+}
+
+void msg_wu32(struct msg_writer *w, unsigned int val) {
+	w->len += msg_putu32(w->buf + w->len, val);
+}
+
+void msg_ws(struct msg_writer *w, long long val) {
+	w->len += msg_puts(w->buf + w->len, val);
+}
+
+void msg_wu(struct msg_writer *w, unsigned long long val) {
+	w->len += msg_putu(w->buf + w->len, val);
+}
+
+void msg_wf(struct msg_writer *w, float val) {
+	msg_putf(w->buf + w->len, val);
+	w->len += 5;
+}
+
+void msg_wd(struct msg_writer *w, double val) {
+	w->len += msg_putd(w->buf + w->len, val);
+}
+
+void msg_wasz(struct msg_writer *w, unsigned int sz) {
+	w->len += msg_putasz(w->buf + w->len, sz);
+}
+
+void msg_wmsz(struct msg_writer *w, unsigned int sz) {
+	w->len += msg_putmsz(w->buf + w->len, sz);
+}
+
+void msg_wraw(struct msg_writer *w, const void *data, unsigned int len) {
+	// no libc, remember? compilers know what this is anyway
+	unsigned char *p = w->buf + w->len;
+	const unsigned char *q = data;
+	for (unsigned int i = 0; i < len; ++i) p[i] = q[i];
+	w->len += len;
+}
+
+void msg_wstr(struct msg_writer *w, const char *s, unsigned int len) {
+	w->len += msg_putssz(w->buf + w->len, len);
+	msg_wraw(w, s, len);
+}
+
+void msg_wbin(struct msg_writer *w, const void *data, unsigned int len) {
+	w->len += msg_putbsz(w->buf + w->len, len);
+	msg_wraw(w, data, len);
+}
+
+enum msg_type msg_peektype(const struct msg_cursor *c) {
+	if (c->p == c->end) return MSG_END;
+	unsigned char b = *c->p;
+	if (b <= 0x7F || b >= 0xE0) return MSG_INT;
+	if (b <= 0x8F) return MSG_MAP;
+	if (b <= 0x9F) return MSG_ARR;
+	if (b <= 0xBF) return MSG_STR;
+	switch (b) {
+		case 0xC0: return MSG_NIL;
+		case 0xC2: case 0xC3: return MSG_BOOL;
+		case 0xC4: case 0xC5: case 0xC6: return MSG_BIN;
+		case 0xCA: case 0xCB: return MSG_FLOAT;
+		case 0xD9: case 0xDA: case 0xDB: return MSG_STR;
+		case 0xDC: case 0xDD: return MSG_ARR;
+		case 0xDE: case 0xDF: return MSG_MAP;
+		case 0xC7: case 0xC8: case 0xC9:
+		case 0xD4: case 0xD5: case 0xD6: case 0xD7: case 0xD8: return MSG_EXT;
+		case 0xC1: return MSG_INVALID;
+		default: return MSG_INT; // 0xCC-0xD3
+	}
+}
+
+_Bool msg_getnil(struct msg_cursor *c) {
+	if (c->p == c->end || *c->p != 0xC0) return 0;
+	++c->p;
+	return 1;
+}
+
+_Bool msg_getbool(struct msg_cursor *c, _Bool *out) {
+	if (c->p == c->end || (*c->p & 0xFE) != 0xC2) return 0;
+	*out = *c->p++ & 1;
+	return 1;
+}
+
+// Decodes any integer into *out, returning its size in bytes, or 0 on failure.
+// The value is returned as its 64-bit two's complement bit pattern, and *neg is
+// set if that should be interpreted as negative.
+static inline int getint(const struct msg_cursor *c, unsigned long long *out,
+		_Bool *neg) {
+	const unsigned char *p = c->p;
+	long avail = c->end - p;
+	if (!avail) return 0;
+	unsigned char b = *p;
+	if (b <= 0x7F) { *out = b; *neg = 0; return 1; }
+	if (b >= 0xE0) { *out = (signed char)b; *neg = 1; return 1; }
+	switch (b) {
+		case 0xCC: if (avail < 2) return 0;
+			*out = p[1]; *neg = 0; return 2;
+		case 0xCD: if (avail < 3) return 0;
+			*out = doget16(p); *neg = 0; return 3;
+		case 0xCE: if (avail < 5) return 0;
+			*out = doget32(p); *neg = 0; return 5;
+		case 0xCF: if (avail < 9) return 0;
+			*out = doget64(p); *neg = 0; return 9;
+		case 0xD0: if (avail < 2) return 0;
+			*out = (signed char)p[1]; *neg = (signed char)p[1] < 0; return 2;
+		case 0xD1: if (avail < 3) return 0;
+			*out = (short)doget16(p); *neg = (short)*out < 0; return 3;
+		case 0xD2: if (avail < 5) return 0;
+			*out = (int)doget32(p); *neg = (int)*out < 0; return 5;
+		case 0xD3: if (avail < 9) return 0;
+			*out = doget64(p); *neg = (long long)*out < 0; return 9;
+	}
+	return 0;
+}
+
+_Bool msg_gets(struct msg_cursor *c, long long *out) {
+	unsigned long long x; _Bool neg;
+	int n = getint(c, &x, &neg);
+	if (!n || !neg && x > 9223372036854775807ull) return 0;
+	*out = x;
+	c->p += n;
+	return 1;
+}
+
+_Bool msg_getu(struct msg_cursor *c, unsigned long long *out) {
+	unsigned long long x; _Bool neg;
+	int n = getint(c, &x, &neg);
+	if (!n || neg) return 0;
+	*out = x;
+	c->p += n;
+	return 1;
+}
+
+_Bool msg_gets32(struct msg_cursor *c, int *out) {
+	unsigned long long x; _Bool neg;
+	int n = getint(c, &x, &neg);
+	// (as a signed value, anything in range sign-extends back to itself)
+	if (!n || (long long)x != (int)x || !neg && (long long)x < 0) return 0;
+	*out = x;
+	c->p += n;
+	return 1;
+}
+
+_Bool msg_getu32(struct msg_cursor *c, unsigned int *out) {
+	unsigned long long x; _Bool neg;
+	int n = getint(c, &x, &neg);
+	if (!n || neg || x > 4294967295u) return 0;
+	*out = x;
+	c->p += n;
+	return 1;
+}
+
+static inline float bitsfloat(unsigned int i) {
+	return (union { unsigned int i; float f; }){i}.f;
+}
+
+static inline double bitsdouble(unsigned long long i) {
+	return (union { unsigned long long i; double d; }){i}.d;
+}
+
+_Bool msg_getf(struct msg_cursor *c, float *out) {
+	if (c->end - c->p < 5 || *c->p != 0xCA) return 0;
+	*out = bitsfloat(doget32(c->p));
+	c->p += 5;
+	return 1;
+}
+
+_Bool msg_getd(struct msg_cursor *c, double *out) {
+	long avail = c->end - c->p;
+	if (avail >= 5 && *c->p == 0xCA) {
+		*out = bitsfloat(doget32(c->p));
+		c->p += 5;
+		return 1;
+	}
+	if (avail >= 9 && *c->p == 0xCB) {
+		*out = bitsdouble(doget64(c->p));
+		c->p += 9;
+		return 1;
+	}
+	return 0;
+}
+
+// Shared logic for strings and blobs. The size is checked against the remaining
+// buffer before anything is returned, so callers can use it without checking.
+static inline _Bool getsized(struct msg_cursor *c, const unsigned char **out,
+		unsigned int *sz, unsigned char tag8) {
+	const unsigned char *p = c->p;
+	unsigned long avail = c->end - p;
+	unsigned int hdr, n;
+	if (!avail) return 0;
+	unsigned char b = *p;
+	if (b == tag8) {
+		if (avail < 2) return 0;
+		hdr = 2; n = p[1];
+	}
+	else if (b == tag8 + 1) {
+		if (avail < 3) return 0;
+		hdr = 3; n = doget16(p);
+	}
+	else if (b == tag8 + 2) {
+		if (avail < 5) return 0;
+		hdr = 5; n = doget32(p);
+	}
+	else {
+		return 0;
+	}
+	if (avail - hdr < n) return 0;
+	*out = p + hdr; *sz = n;
+	c->p = p + hdr + n;
+	return 1;
+}
+
+_Bool msg_getstr(struct msg_cursor *c, const char **out, unsigned int *sz) {
+	const unsigned char *p = c->p;
+	if (p != c->end && (*p & 0xE0) == 0xA0) { // fixstr is the common case
+		unsigned int n = *p & 31;
+		if ((unsigned long)(c->end - p) - 1 < n) return 0;
+		*out = (const char *)p + 1; *sz = n;
+		c->p = p + 1 + n;
+		return 1;
+	}
+	return getsized(c, (const unsigned char **)out, sz, 0xD9);
+}
+
+_Bool msg_getbin(struct msg_cursor *c, const unsigned char **out,
+		unsigned int *sz) {
+	return getsized(c, out, sz, 0xC4);
+}
+
+// Shared logic for arrays and maps, which are encoded exactly the same way
+// aside from the actual tag values.
+static inline _Bool getcontainersz(struct msg_cursor *c, unsigned int *sz,
+		unsigned char fixtag, unsigned char tag16) {
+	const unsigned char *p = c->p;
+	long avail = c->end - p;
+	if (!avail) return 0;
+	unsigned char b = *p;
+	if ((b & 0xF0) == fixtag) {
+		*sz = b & 15;
+		c->p = p + 1;
+		return 1;
+	}
+	if (b == tag16) {
+		if (avail < 3) return 0;
+		*sz = doget16(p);
+		c->p = p + 3;
+		return 1;
+	}
+	if (b == tag16 + 1) {
+		if (avail < 5) return 0;
+		*sz = doget32(p);
+		c->p = p + 5;
+		return 1;
+	}
+	return 0;
+}
+
+_Bool msg_getasz(struct msg_cursor *c, unsigned int *sz) {
+	return getcontainersz(c, sz, 0x90, 0xDC);
+}
+
+_Bool msg_getmsz(struct msg_cursor *c, unsigned int *sz) {
+	return getcontainersz(c, sz, 0x80, 0xDE);
+}
+
+// Sizes of all the fixed-size types from 0xC0 to 0xDF; 0 means the size is
+// variable (or in the case of 0xC1, that the type byte is invalid).
+static const unsigned char fixedszs[32] = {
+	1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 5, 9, 2, 3, 5, 9, // C0-CF
+	2, 3, 5, 9, 3, 4, 6, 10, 18, 0, 0, 0, 0, 0, 0, 0 // D0-DF
+};
+
+// Walks over one complete value starting at p, keeping count of how many values
+// are still to go as containers are encountered, so there's no recursion and no
+// depth limit. If check is set, returns null on bad input; otherwise, end is
+// ignored and the input is trusted. check is always a constant, so each caller
+// gets its own specialised copy of the loop.
+static inline const unsigned char *skip(const unsigned char *p,
+		const unsigned char *end, _Bool check) {
+	unsigned long long left = 1;
+	do {
+		if (check && p == end) return 0;
+		unsigned char b = *p;
+		unsigned long avail = check ? end - p : 0;
+		unsigned long long sz;
+		if (b <= 0x7F || b >= 0xE0) {
+			sz = 1;
+		}
+		else if (b <= 0x8F) {
+			sz = 1; left += (b & 15) * 2;
+		}
+		else if (b <= 0x9F) {
+			sz = 1; left += b & 15;
+		}
+		else if (b <= 0xBF) {
+			sz = 1 + (b & 31);
+		}
+		else if (fixedszs[b - 0xC0]) {
+			sz = fixedszs[b - 0xC0];
+		}
+		else switch (b) {
+			case 0xC4: case 0xD9: // bin8/str8
+				if (check && avail < 2) return 0;
+				sz = 2 + p[1];
+				break;
+			case 0xC5: case 0xDA: // bin16/str16
+				if (check && avail < 3) return 0;
+				sz = 3 + doget16(p);
+				break;
+			case 0xC6: case 0xDB: // bin32/str32
+				if (check && avail < 5) return 0;
+				sz = 5 + (unsigned long long)doget32(p);
+				break;
+			// ext types have an extra type byte after the size
+			case 0xC7:
+				if (check && avail < 2) return 0;
+				sz = 3 + p[1];
+				break;
+			case 0xC8:
+				if (check && avail < 3) return 0;
+				sz = 4 + doget16(p);
+				break;
+			case 0xC9:
+				if (check && avail < 5) return 0;
+				sz = 6 + (unsigned long long)doget32(p);
+				break;
+			case 0xDC:
+				if (check && avail < 3) return 0;
+				sz = 3; left += doget16(p);
+				break;
+			case 0xDD:
+				if (check && avail < 5) return 0;
+				sz = 5; left += doget32(p);
+				break;
+			case 0xDE:
+				if (check && avail < 3) return 0;
+				sz = 3; left += doget16(p) * 2;
+				break;
+			case 0xDF:
+				if (check && avail < 5) return 0;
+				sz = 5; left += doget32(p) * 2ull;
+				break;
+			default: // 0xC1
+				if (check) return 0;
+				sz = 1; // garbage in, garbage out
+		}
+		if (check && sz > avail) return 0;
+		p += sz;
+		// every value takes at least one byte, so if there aren't enough bytes
+		// left for the remaining count, bail now rather than trudging through
+		// billions of phantom elements only to find the input was truncated
+		if (check && --left > (unsigned long)(end - p)) return 0;
+		if (!check) --left;
+	} while (left);
+	return p;
+}
+
+_Bool msg_skip(struct msg_cursor *c) {
+	const unsigned char *p = skip(c->p, c->end, 1);
+	if (!p) return 0;
+	c->p = p;
+	return 1;
+}
+
+unsigned int msg_extent(const unsigned char *in) {
+	return skip(in, 0, 0) - in;
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
@@ -340,6 +340,266 @@ int msg_putmsz16(unsigned char *out, int sz);
  */
 int msg_putmsz(unsigned char *out, unsigned int sz);
 
+/*
+ * Writes an array of n unsigned ints from vals to the buffer out, including the
+ * array size. Each element gets the smallest possible encoding, exactly as if
+ * written by msg_putu32(), but the whole array is encoded in one go, using SIMD
+ * to skip over runs of small values where the target platform supports it.
+ *
+ * out must point to at least 5 + n * 5 bytes.
+ *
+ * Returns the number of bytes written.
+ */
+unsigned int msg_putarr_u32(unsigned char *out, const unsigned int *vals,
+		unsigned int n);
+
+/*
+ * Writes an array of n signed ints from vals to the buffer out, including the
+ * array size. Each element gets the smallest possible encoding, exactly as if
+ * written by msg_puts32(), but the whole array is encoded in one go, using SIMD
+ * to skip over runs of small values where the target platform supports it.
+ *
+ * out must point to at least 5 + n * 5 bytes.
+ *
+ * Returns the number of bytes written.
+ */
+unsigned int msg_putarr_s32(unsigned char *out, const int *vals,
+		unsigned int n);
+
+/*
+ * Writes an array of n single-precision floats from vals to the buffer out,
+ * including the array size. Each element is written exactly as if by
+ * msg_putf().
+ *
+ * out must point to at least 5 + n * 5 bytes.
+ *
+ * Returns the number of bytes written.
+ */
+unsigned int msg_putarr_f32(unsigned char *out, const float *vals,
+		unsigned int n);
+
+/*
+ * Worst-case encoded sizes of each type of value, for use with msg_reserve().
+ * Sizes of strings and blobs include the contents.
+ */
+#define MSG_MAXSZ_NIL 1
+#define MSG_MAXSZ_BOOL 1
+#define MSG_MAXSZ_INT32 5
+#define MSG_MAXSZ_INT 9
+#define MSG_MAXSZ_FLOAT 5
+#define MSG_MAXSZ_DOUBLE 9
+#define MSG_MAXSZ_STR(len) (5 + (len))
+#define MSG_MAXSZ_BIN(len) (5 + (len))
+#define MSG_MAXSZ_ARR 5
+#define MSG_MAXSZ_MAP 5
+
+/*
+ * An output buffer which is written to sequentially. buf points to cap bytes of
+ * space, of which the first len are in use.
+ *
+ * grow, if not null, is called by msg_reserve() to enlarge the buffer to at
+ * least sz bytes. It must return a pointer to the new buffer with the existing
+ * contents preserved, or null on failure, much like realloc(). If grow is null,
+ * the buffer is fixed-size, which is useful for writing to stack memory.
+ *
+ * The intended use is to call msg_reserve() once with the worst-case size of an
+ * entire message and then write it all out with the unchecked msg_w*()
+ * functions below.
+ */
+struct msg_writer {
+	unsigned char *buf;
+	unsigned int len, cap;
+	void *(*grow)(void *buf, unsigned int sz);
+};
+
+/*
+ * Ensures that at least sz more bytes can be written to w, growing the buffer
+ * if needed. Returns false if the buffer couldn't be grown, in which case
+ * nothing is changed.
+ */
+_msg_Bool msg_reserve(struct msg_writer *w, unsigned int sz);
+
+/*
+ * Returns a checkpoint marking the current end of the data in w, which can be
+ * passed to msg_rollback() later. Checkpoints stay valid if the buffer grows.
+ */
+unsigned int msg_checkpoint(const struct msg_writer *w);
+
+/*
+ * Discards everything written to w since the checkpoint cp was taken. Nothing
+ * is copied or freed; the space is simply reused by subsequent writes.
+ */
+void msg_rollback(struct msg_writer *w, unsigned int cp);
+
+/*
+ * These each write a single value to the end of w, exactly like the
+ * corresponding msg_put*() functions.
+ *
+ * None of them do any bounds checking; the caller must first reserve enough
+ * space, using msg_reserve() and the MSG_MAXSZ_* constants.
+ */
+void msg_wnil(struct msg_writer *w);
+void msg_wbool(struct msg_writer *w, _msg_Bool val);
+void msg_ws32(struct msg_writer *w, int val);
+void msg_wu32(struct msg_writer *w, unsigned int val);
+void msg_ws(struct msg_writer *w, long long val);
+void msg_wu(struct msg_writer *w, unsigned long long val);
+void msg_wf(struct msg_writer *w, float val);
+void msg_wd(struct msg_writer *w, double val);
+void msg_wasz(struct msg_writer *w, unsigned int sz);
+void msg_wmsz(struct msg_writer *w, unsigned int sz);
+
+/*
+ * Writes a complete string or binary blob, including the size, to the end of w.
+ * Like the above, no bounds checking is done.
+ */
+void msg_wstr(struct msg_writer *w, const char *s, unsigned int len);
+void msg_wbin(struct msg_writer *w, const void *data, unsigned int len);
+
+/*
+ * Writes len bytes of arbitrary data from data to the end of w. This can be
+ * used to copy in pre-encoded parts of messages. No bounds checking is done.
+ */
+void msg_wraw(struct msg_writer *w, const void *data, unsigned int len);
+
+/*
+ * A read cursor over a buffer of messages. p points at the next byte to be
+ * decoded and end points one byte past the end of the buffer.
+ *
+ * Each msg_get*() function below reads one value and advances p past it on
+ * success. On failure, including when the value is truncated by the end of the
+ * buffer or has a different type than requested, p is left untouched, so that
+ * the caller can try again with a different function (or give up).
+ */
+struct msg_cursor {
+	const unsigned char *p, *end;
+};
+
+/*
+ * The basic type of a value, as returned by msg_peektype(). Integers are
+ * reported as MSG_INT regardless of signedness or width, and floats are
+ * reported as MSG_FLOAT regardless of precision.
+ */
+enum msg_type {
+	MSG_END, /* cursor is at the end of the buffer */
+	MSG_INVALID, /* reserved byte 0xC1, which never appears in valid data */
+	MSG_NIL,
+	MSG_BOOL,
+	MSG_INT,
+	MSG_FLOAT,
+	MSG_STR,
+	MSG_BIN,
+	MSG_ARR,
+	MSG_MAP,
+	MSG_EXT
+};
+
+/*
+ * Returns the type of the next value in the cursor c, without advancing it.
+ * This only looks at the first byte, so the value may still turn out to be
+ * truncated.
+ */
+enum msg_type msg_peektype(const struct msg_cursor *c);
+
+/*
+ * Reads a nil value from the cursor c. Returns true if successful.
+ */
+_msg_Bool msg_getnil(struct msg_cursor *c);
+
+/*
+ * Reads a boolean from the cursor c into *out. Returns true if successful.
+ */
+_msg_Bool msg_getbool(struct msg_cursor *c, _msg_Bool *out);
+
+/*
+ * Reads an integer of any encoded width from the cursor c into *out. Returns
+ * true if successful. Fails if the value is an unsigned integer too large to be
+ * represented as a long long.
+ */
+_msg_Bool msg_gets(struct msg_cursor *c, long long *out);
+
+/*
+ * Reads an integer of any encoded width from the cursor c into *out. Returns
+ * true if successful. Fails if the value is negative.
+ */
+_msg_Bool msg_getu(struct msg_cursor *c, unsigned long long *out);
+
+/*
+ * Reads an integer in the range [-2147483648, 2147483647] from the cursor c
+ * into *out. Returns true if successful. Fails if the value is out of range.
+ */
+_msg_Bool msg_gets32(struct msg_cursor *c, int *out);
+
+/*
+ * Reads an integer in the range [0, 4294967295] from the cursor c into *out.
+ * Returns true if successful. Fails if the value is out of range.
+ */
+_msg_Bool msg_getu32(struct msg_cursor *c, unsigned int *out);
+
+/*
+ * Reads a single-precision float from the cursor c into *out. Returns true if
+ * successful. Double-precision values are not accepted, even if they would fit.
+ */
+_msg_Bool msg_getf(struct msg_cursor *c, float *out);
+
+/*
+ * Reads a single- or double-precision float from the cursor c into *out.
+ * Returns true if successful.
+ */
+_msg_Bool msg_getd(struct msg_cursor *c, double *out);
+
+/*
+ * Reads a string from the cursor c. On success, *out is set to point at the
+ * string contents directly inside the buffer and *sz is set to its size in
+ * bytes, and true is returned. Nothing is copied, and the string is NOT null-
+ * terminated.
+ *
+ * The string is guaranteed to be within the bounds of the buffer, but its
+ * contents are not checked to be valid UTF-8.
+ */
+_msg_Bool msg_getstr(struct msg_cursor *c, const char **out, unsigned int *sz);
+
+/*
+ * Reads a binary blob from the cursor c. On success, *out is set to point at
+ * the data directly inside the buffer and *sz is set to its size in bytes, and
+ * true is returned. Nothing is copied.
+ */
+_msg_Bool msg_getbin(struct msg_cursor *c, const unsigned char **out,
+		unsigned int *sz);
+
+/*
+ * Reads an array size from the cursor c into *sz. Returns true if successful.
+ * The cursor is left pointing at the first element of the array, if any.
+ */
+_msg_Bool msg_getasz(struct msg_cursor *c, unsigned int *sz);
+
+/*
+ * Reads a map size from the cursor c into *sz. Returns true if successful. The
+ * cursor is left pointing at the first key of the map, if any.
+ */
+_msg_Bool msg_getmsz(struct msg_cursor *c, unsigned int *sz);
+
+/*
+ * Skips over the next complete value at the cursor c, including all elements of
+ * arrays and maps, however deeply nested. Returns true if successful. String,
+ * binary and extension payloads are jumped over without being looked at.
+ *
+ * The entire value is validated before the cursor is moved; if it is truncated
+ * or contains an invalid type byte, false is returned and the cursor is left
+ * untouched. This makes it suitable for scanning untrusted input.
+ */
+_msg_Bool msg_skip(struct msg_cursor *c);
+
+/*
+ * Returns the total size in bytes of the complete value in the buffer in,
+ * including all elements of arrays and maps, however deeply nested.
+ *
+ * No bounds or validity checks are done, so this should only be used on input
+ * which is already known to be well-formed, such as something this process
+ * wrote itself or something which has already been through msg_skip().
+ */
+unsigned int msg_extent(const unsigned char *in);
+
 #ifdef __cplusplus
 }
 #endif
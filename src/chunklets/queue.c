@@ -0,0 +1,158 @@
+/* This file is dedicated to the public domain. */
+
+#ifdef __cplusplus
+#error This file should not be compiled as C++. It relies on C-specific \
+keywords and APIs which have syntactically different equivalents for C++.
+#endif
+
+#include <stdatomic.h>
+#include <string.h>
+
+#include "fastspin.h"
+#include "queue.h"
+
+// Head and tail are free-running counters, masked to get an index. They wrap
+// around at UINT_MAX, which is fine because capacities are powers of two.
+
+// Parking works the same way for both queue types. q->event is positive while
+// the consumer is busy, so producers can skip the raise. A consumer about to
+// sleep sets it to 0, then issues a full fence and checks the queue again.
+// Pushes do a full fence after publishing and then check the event. Thanks to
+// the fences, either the consumer sees the new element or the producer sees the
+// 0 and raises the event. This is the classic Dekker pattern.
+static inline void notify(volatile int *ev) {
+	atomic_thread_fence(memory_order_seq_cst);
+	if (atomic_load_explicit((_Atomic int *)ev, memory_order_relaxed) <= 0) {
+		fastspin_raise(ev, 1);
+	}
+}
+
+#define PARK(q, ready) do { \
+	_Atomic int *_ev = (_Atomic int *)&(q)->event; \
+	while (!(ready)) { \
+		atomic_store_explicit(_ev, 0, memory_order_relaxed); \
+		atomic_thread_fence(memory_order_seq_cst); \
+		if (ready) break; \
+		fastspin_wait(&(q)->event); \
+	} \
+	atomic_store_explicit(_ev, 1, memory_order_relaxed); \
+} while (0)
+
+void queue_spsc_init(struct queue_spsc *q, void *buf, unsigned int elemsz,
+		unsigned int cap) {
+	q->buf = buf;
+	q->mask = cap - 1;
+	q->elemsz = elemsz;
+	q->head = 0; q->cachedtail = 0;
+	q->tail = 0; q->cachedhead = 0;
+	q->event = 1;
+}
+
+_Bool queue_spsc_push(struct queue_spsc *q, const void *elem) {
+	unsigned int head = q->head; // only we write this, so no atomics needed
+	if (head - q->cachedtail > q->mask) {
+		// looks full, but only going by a stale copy of the consumer's index.
+		// refresh it; doing this only when needed avoids bouncing the cache
+		// line over to the producer every single time
+		q->cachedtail = atomic_load_explicit((_Atomic unsigned int *)&q->tail,
+				memory_order_acquire);
+		if (head - q->cachedtail > q->mask) return 0;
+	}
+	memcpy(q->buf + (head & q->mask) * q->elemsz, elem, q->elemsz);
+	atomic_store_explicit((_Atomic unsigned int *)&q->head, head + 1,
+			memory_order_release);
+	notify(&q->event);
+	return 1;
+}
+
+_Bool queue_spsc_pop(struct queue_spsc *q, void *elem) {
+	unsigned int tail = q->tail;
+	if (tail == q->cachedhead) {
+		q->cachedhead = atomic_load_explicit((_Atomic unsigned int *)&q->head,
+				memory_order_acquire);
+		if (tail == q->cachedhead) return 0;
+	}
+	memcpy(elem, q->buf + (tail & q->mask) * q->elemsz, q->elemsz);
+	atomic_store_explicit((_Atomic unsigned int *)&q->tail, tail + 1,
+			memory_order_release);
+	return 1;
+}
+
+void queue_spsc_wait(struct queue_spsc *q) {
+	PARK(q, atomic_load_explicit((_Atomic unsigned int *)&q->head,
+			memory_order_relaxed) != q->tail);
+}
+
+// The MPSC queue is Dmitry Vyukov's bounded queue. Each slot has a sequence
+// number: when it equals the position a producer wants to write, the slot is
+// free; once it's one more than that, the element is there to be read. After
+// reading, the consumer bumps it by a full lap so that the slot is free for the
+// next time around.
+
+static inline _Atomic unsigned int *slotseq(struct queue_mpsc *q,
+		unsigned int pos) {
+	return (_Atomic unsigned int *)(q->buf + (pos & q->mask) * q->stride);
+}
+
+void queue_mpsc_init(struct queue_mpsc *q, void *buf, unsigned int elemsz,
+		unsigned int cap) {
+	q->buf = buf;
+	q->mask = cap - 1;
+	q->stride = (elemsz + 7) & ~3u; // i.e. QUEUE_MPSC_BUFSZ(elemsz, 1)
+	q->elemsz = elemsz;
+	for (unsigned int i = 0; i < cap; ++i) {
+		atomic_init(slotseq(q, i), i);
+	}
+	q->head = 0;
+	q->tail = 0;
+	q->event = 1;
+}
+
+_Bool queue_mpsc_push(struct queue_mpsc *q, const void *elem) {
+	_Atomic unsigned int *head = (_Atomic unsigned int *)&q->head;
+	unsigned int pos = atomic_load_explicit(head, memory_order_relaxed);
+	_Atomic unsigned int *seq;
+	for (;;) {
+		seq = slotseq(q, pos);
+		int diff = (int)(atomic_load_explicit(seq, memory_order_acquire) -
+				pos);
+		if (!diff) {
+			// slot's free; claim it. on failure, pos gets reloaded
+			if (atomic_compare_exchange_weak_explicit(head, &pos, pos + 1,
+					memory_order_relaxed, memory_order_relaxed)) {
+				break;
+			}
+		}
+		else if (diff < 0) {
+			return 0; // consumer hasn't got round to this slot yet; full
+		}
+		else {
+			// someone else claimed it since we looked; try again further on
+			pos = atomic_load_explicit(head, memory_order_relaxed);
+		}
+	}
+	memcpy(seq + 1, elem, q->elemsz);
+	atomic_store_explicit(seq, pos + 1, memory_order_release);
+	notify(&q->event);
+	return 1;
+}
+
+static inline _Bool mpsc_ready(struct queue_mpsc *q, memory_order mo) {
+	return atomic_load_explicit(slotseq(q, q->tail), mo) == q->tail + 1;
+}
+
+_Bool queue_mpsc_pop(struct queue_mpsc *q, void *elem) {
+	unsigned int tail = q->tail;
+	_Atomic unsigned int *seq = slotseq(q, tail);
+	if (!mpsc_ready(q, memory_order_acquire)) return 0;
+	memcpy(elem, seq + 1, q->elemsz);
+	atomic_store_explicit(seq, tail + q->mask + 1, memory_order_release);
+	q->tail = tail + 1; // only we touch this
+	return 1;
+}
+
+void queue_mpsc_wait(struct queue_mpsc *q) {
+	PARK(q, mpsc_ready(q, memory_order_relaxed));
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
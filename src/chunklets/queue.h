@@ -0,0 +1,123 @@
+/* This file is dedicated to the public domain. */
+
+#ifndef INC_CHUNKLETS_QUEUE_H
+#define INC_CHUNKLETS_QUEUE_H
+
+#include "cacheline.h"
+
+#ifdef __cplusplus
+#define _queue_Bool bool
+#define _queue_Align alignas(CACHELINE_FALSESHARE_SIZE)
+extern "C" {
+#else
+#define _queue_Bool _Bool
+#define _queue_Align _Alignas(CACHELINE_FALSESHARE_SIZE)
+#endif
+
+/*
+ * A bounded, wait-free, single-producer single-consumer ring queue of
+ * fixed-size elements. Exactly one thread may push and exactly one (possibly
+ * different) thread may pop/wait at any given time.
+ *
+ * The fields are grouped so that the producer and consumer each write to their
+ * own cache lines and don't slow each other down. Treat them as private.
+ */
+struct queue_spsc {
+	_queue_Align unsigned char *buf;
+	unsigned int mask, elemsz; /* read-only after init */
+	_queue_Align unsigned int head; /* producer's */
+	unsigned int cachedtail;
+	_queue_Align unsigned int tail; /* consumer's */
+	unsigned int cachedhead;
+	_queue_Align volatile int event; /* for queue_spsc_wait() */
+};
+
+/*
+ * A bounded, lock-free, multi-producer single-consumer ring queue of fixed-size
+ * elements. Any number of threads may push at once; exactly one may pop/wait.
+ *
+ * Each slot carries a sequence number alongside the element, so the buffer has
+ * to be a bit bigger than for the SPSC queue; use QUEUE_MPSC_BUFSZ() for that.
+ */
+struct queue_mpsc {
+	_queue_Align unsigned char *buf;
+	unsigned int mask, stride, elemsz; /* read-only after init */
+	_queue_Align unsigned int head; /* contended by producers */
+	_queue_Align unsigned int tail; /* consumer's */
+	_queue_Align volatile int event; /* for queue_mpsc_wait() */
+};
+
+/*
+ * The number of bytes of buffer needed for an MPSC queue of cap elements of
+ * elemsz bytes each. An SPSC queue simply needs elemsz * cap bytes.
+ */
+#define QUEUE_MPSC_BUFSZ(elemsz, cap) ((((elemsz) + 7) & ~3u) * (cap))
+
+/*
+ * Initialises an SPSC queue to hold up to cap elements of elemsz bytes each,
+ * stored in buf. cap must be a power of two, and buf must be at least
+ * elemsz * cap bytes and must not be used for anything else while the queue
+ * is in use.
+ */
+void queue_spsc_init(struct queue_spsc *q, void *buf, unsigned int elemsz,
+		unsigned int cap);
+
+/*
+ * Copies an element into the queue. Returns false if the queue is full, in
+ * which case the element is dropped. Never blocks or spins, so it's safe to
+ * call from latency-sensitive places, such as an input hook; the worst it will
+ * do is make one system call to wake up a consumer in queue_spsc_wait().
+ */
+_queue_Bool queue_spsc_push(struct queue_spsc *q, const void *elem);
+
+/*
+ * Copies the oldest element out of the queue into elem and removes it. Returns
+ * false if the queue is empty, leaving elem untouched. Never blocks.
+ */
+_queue_Bool queue_spsc_pop(struct queue_spsc *q, void *elem);
+
+/*
+ * Blocks until the queue is non-empty. Spins briefly and then goes to sleep on
+ * a fastspin event, which the next push will raise. Only the consumer thread
+ * may call this.
+ */
+void queue_spsc_wait(struct queue_spsc *q);
+
+/*
+ * Initialises an MPSC queue to hold up to cap elements of elemsz bytes each,
+ * stored in buf. cap must be a power of two, and buf must be at least
+ * QUEUE_MPSC_BUFSZ(elemsz, cap) bytes, aligned to at least 4 bytes.
+ */
+void queue_mpsc_init(struct queue_mpsc *q, void *buf, unsigned int elemsz,
+		unsigned int cap);
+
+/*
+ * Copies an element into the queue. Returns false if the queue is full.
+ * Lock-free: producers never block each other, although one may have to retry
+ * if another pushes at the same instant. Elements pushed by a single thread
+ * come out in the same order; ordering between threads is first come, first
+ * served.
+ */
+_queue_Bool queue_mpsc_push(struct queue_mpsc *q, const void *elem);
+
+/*
+ * Copies the oldest element out of the queue into elem and removes it. Returns
+ * false if the queue is empty (or if the oldest element is still mid-push).
+ */
+_queue_Bool queue_mpsc_pop(struct queue_mpsc *q, void *elem);
+
+/*
+ * Blocks until the queue is non-empty, as with queue_spsc_wait().
+ */
+void queue_mpsc_wait(struct queue_mpsc *q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef _queue_Align
+#undef _queue_Bool
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,108 @@
+/* This file is dedicated to the public domain. */
+
+#ifdef __cplusplus
+#error This file should not be compiled as C++. It relies on C-specific \
+keywords and APIs which have syntactically different equivalents for C++.
+#endif
+
+#include <stdatomic.h>
+
+#include "seqlock.h"
+
+#if defined(__GNUC__) || defined(__clang__) || defined(__TINYC__)
+#if defined(__i386__) || defined(__x86_64__) || defined(_WIN32) || \
+		defined(__mips__) // same asm syntax for pause
+#define RELAX() __asm__ volatile ("pause" ::: "memory")
+#elif defined(__arm__) || defined(__aarch64__)
+#define RELAX() __asm__ volatile ("yield" ::: "memory")
+#elif defined(__powerpc__) || defined(__ppc64__)
+#define RELAX() __asm__ volatile ("or 27, 27, 27" ::: "memory")
+#endif
+#elif defined(_MSC_VER)
+#if defined(_M_ARM) || defined(_M_ARM64)
+#define RELAX() __yield()
+#else
+void _mm_pause(); // don't pull in emmintrin.h for this
+#define RELAX() _mm_pause()
+#endif
+#endif
+#ifndef RELAX
+#define RELAX() do; while (0)
+#endif
+
+// This follows Hans Boehm's "Can Seqlocks Get Along With Programming Language
+// Memory Models?" (2012). Data is copied with relaxed atomics, so that racing
+// with the writer is merely a retry rather than undefined behaviour. Fences
+// then order the data accesses against the counter:
+//
+// - The writer bumps the counter to odd and then issues a release fence, so
+//   that the data stores can't become visible before the counter does.
+// - The reader issues an acquire fence after reading the data and before
+//   rereading the counter. If it read anything the writer stored, the fence
+//   pair guarantees that it will also see the odd (or newer) counter value.
+//
+// On x86 all of these fences are free, besides stopping the compiler reordering
+// things. On ARM they become dmb instructions (or ldar/stlr for the counter).
+// Relaxed loads and stores of aligned ints are just regular loads and stores
+// everywhere that matters.
+
+void seqlock_write_begin(volatile unsigned int *seq_) {
+	_Atomic unsigned int *seq = (_Atomic unsigned int *)seq_;
+	unsigned int s = atomic_load_explicit(seq, memory_order_relaxed);
+	atomic_store_explicit(seq, s + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+}
+
+void seqlock_write_end(volatile unsigned int *seq_) {
+	_Atomic unsigned int *seq = (_Atomic unsigned int *)seq_;
+	unsigned int s = atomic_load_explicit(seq, memory_order_relaxed);
+	atomic_store_explicit(seq, s + 1, memory_order_release);
+}
+
+unsigned int seqlock_read_begin(const volatile unsigned int *seq_) {
+	_Atomic unsigned int *seq = (_Atomic unsigned int *)seq_;
+	unsigned int s;
+	// odd means a write is in progress; no point reading until it's done
+	while ((s = atomic_load_explicit(seq, memory_order_acquire)) & 1) RELAX();
+	return s;
+}
+
+_Bool seqlock_read_retry(const volatile unsigned int *seq_,
+		unsigned int start) {
+	_Atomic unsigned int *seq = (_Atomic unsigned int *)seq_;
+	atomic_thread_fence(memory_order_acquire);
+	return atomic_load_explicit(seq, memory_order_relaxed) != start;
+}
+
+void seqlock_write(volatile unsigned int *seq, void *dst_, const void *src_,
+		unsigned int sz) {
+	_Atomic unsigned int *dst = dst_;
+	const unsigned int *src = src_;
+	seqlock_write_begin(seq);
+	for (; sz >= sizeof(int); sz -= sizeof(int)) {
+		atomic_store_explicit(dst++, *src++, memory_order_relaxed);
+	}
+	_Atomic unsigned char *d = (_Atomic unsigned char *)dst;
+	const unsigned char *s = (const unsigned char *)src;
+	while (sz--) atomic_store_explicit(d++, *s++, memory_order_relaxed);
+	seqlock_write_end(seq);
+}
+
+unsigned int seqlock_read(const volatile unsigned int *seq, void *dst_,
+		const void *src_, unsigned int sz) {
+	unsigned int start;
+	do {
+		start = seqlock_read_begin(seq);
+		_Atomic unsigned int *src = (_Atomic unsigned int *)src_;
+		unsigned int *dst = dst_, n = sz;
+		for (; n >= sizeof(int); n -= sizeof(int)) {
+			*dst++ = atomic_load_explicit(src++, memory_order_relaxed);
+		}
+		_Atomic unsigned char *s = (_Atomic unsigned char *)src;
+		unsigned char *d = (unsigned char *)dst;
+		while (n--) *d++ = atomic_load_explicit(s++, memory_order_relaxed);
+	} while (seqlock_read_retry(seq, start));
+	return start;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
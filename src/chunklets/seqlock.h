@@ -0,0 +1,83 @@
+/* This file is dedicated to the public domain. */
+
+#ifndef INC_CHUNKLETS_SEQLOCK_H
+#define INC_CHUNKLETS_SEQLOCK_H
+
+#ifdef __cplusplus
+#define _seqlock_Bool bool
+extern "C" {
+#else
+#define _seqlock_Bool _Bool
+#endif
+
+/*
+ * A seqlock is a single unsigned int sequence counter which guards some data
+ * that is written by one thread and read by any number of others. Readers never
+ * write to shared memory, so they don't slow each other or the writer down;
+ * instead, they retry if the writer got in the way. The writer never waits for
+ * readers at all. This suits small pieces of data which are read far more often
+ * than they're written, such as per-tick state.
+ *
+ * The counter must be initialised to 0. Only one thread may write at a time; if
+ * there's more than one writer, serialise them some other way (e.g. with a
+ * fastspin lock).
+ *
+ * The simplest way to use this is with seqlock_write() and seqlock_read(),
+ * which copy a whole blob of data. For doing something more interesting, the
+ * lower level begin/end/retry functions are also available; in that case, be
+ * aware that a reader can see any old garbage before it calls
+ * seqlock_read_retry(), so it mustn't trust what it reads until then (e.g. by
+ * following pointers). Strictly speaking, the data should also be accessed
+ * with relaxed atomics, as seqlock_read() and seqlock_write() do, to avoid
+ * undefined behaviour in C11 terms.
+ */
+
+/*
+ * Marks the start of a write. Any readers in progress will have to retry.
+ */
+void seqlock_write_begin(volatile unsigned int *seq);
+
+/*
+ * Marks the end of a write, making the new data available to readers.
+ */
+void seqlock_write_end(volatile unsigned int *seq);
+
+/*
+ * Marks the start of a read, returning a value to pass to seqlock_read_retry()
+ * afterwards. Spins while a write is in progress.
+ */
+unsigned int seqlock_read_begin(const volatile unsigned int *seq);
+
+/*
+ * Returns true if the data read since the corresponding seqlock_read_begin()
+ * may have been modified, meaning the read must be done again.
+ */
+_seqlock_Bool seqlock_read_retry(const volatile unsigned int *seq,
+		unsigned int start);
+
+/*
+ * Copies sz bytes from src to dst, as a single write guarded by seq. Both must
+ * be aligned to at least the size of an int.
+ */
+void seqlock_write(volatile unsigned int *seq, void *dst, const void *src,
+		unsigned int sz);
+
+/*
+ * Copies sz bytes from src to dst, retrying until it gets a consistent snapshot
+ * of src, as guarded by seq. Both must be aligned to at least the size of an
+ * int. Returns the sequence number of the snapshot, which changes with each
+ * write; comparing it against a previous call's result is a cheap way to see if
+ * anything's changed.
+ */
+unsigned int seqlock_read(const volatile unsigned int *seq, void *dst,
+		const void *src, unsigned int sz);
+
+#ifdef __cplusplus
+}
+#endif
+
+#undef _seqlock_Bool
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
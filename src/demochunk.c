@@ -0,0 +1,145 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#include "bitbuf.h"
+#include "chunklets/lz.h"
+#include "demochunk.h"
+#include "democustom.h"
+#include "intdefs.h"
+#include "langext.h"
+
+#define CHUNKSZ DEMOCUSTOM_CHUNKSZ
+
+// room for up to 6 bytes of header, plus a spare cell since bitbuf appends
+// write one cell ahead. that comes to 16 bytes even on a 64-bit build
+static union {
+	char x[CHUNKSZ + 16]; // needs to be multiple of of 4!
+	bitbuf_cell _align; // just in case...
+} bb_buf;
+static struct bitbuf bb = {
+	{bb_buf.x}, ssizeof(bb_buf), ssizeof(bb_buf) * 8, 0, false, false, "SST"
+};
+
+static void createhdr(const struct demochunk_writer *w, struct bitbuf *msg,
+		int len, int marker) {
+	// We pack custom data into user message packets of type "HudText," with a
+	// leading null byte which the engine treats as an empty string. On demo
+	// playback, the client does a text lookup which fails silently on invalid
+	// keys, giving us the rest of the packet to stick in whatever data we want.
+	//
+	// Big thanks to our resident demo expert, Uncrafted, for explaining what to
+	// do here way back when this was first being figured out!
+	bitbuf_appendbits(msg, 23, w->nbits_msgtype); // type: 23 is user message
+	bitbuf_appendbyte(msg, 2); // user message type: 2 is HudText
+	bitbuf_appendbits(msg, len * 8, w->nbits_datalen); // data length in bits
+	bitbuf_appendbyte(msg, 0); // aforementionied null byte
+	bitbuf_appendbyte(msg, marker); // arbitrary marker byte to aid parsing
+	// store the data itself byte-aligned so there's no need to bitshift the
+	// universe (which would be both slower and more annoying to do)
+	bitbuf_roundup(msg);
+}
+
+void demochunk_writechunk(struct demochunk_writer *w, const void *buf, int len,
+		int marker) {
+	// header fields, byte 0, marker byte, and rounding up to a whole byte
+	int hdrbits = (w->nbits_msgtype + 8 + w->nbits_datalen + 16 + 7) & ~7;
+	// check once for the whole packet, so the appends needn't check anything.
+	// this can't actually fail unless the buffer size above is wrong, or len
+	// is more than a chunk
+	if_cold (!bitbuf_reserve(&bb, hdrbits + (len << 3))) {
+		bitbuf_reset(&bb);
+		return;
+	}
+	createhdr(w, &bb, len, marker);
+	bitbuf_appendbuf(&bb, buf, len); // byte aligned, so it's just a memcpy
+	w->write(&bb);
+	bitbuf_reset(&bb);
+}
+
+// Payloads (or packed chunks) are compressed first, if that makes them smaller.
+// Very small ones never do, and bigger ones are rare enough not to be worth
+// the extra buffer space.
+#define LZ_MINSZ 32
+#define LZ_MAXIN 4096
+static char lzbuf[LZ_MAXSZ(LZ_MAXIN)];
+
+// Anything from demochunk_write_raw() is known not to compress, and trying
+// anyway would mean setting up a 16 KiB table on the game thread for nothing.
+// So, ncompressible is how much of the payload might actually shrink; packed
+// chunks get a go only if enough of them came from demochunk_write().
+static void writepayload(struct demochunk_writer *w, const char *buf, int len,
+		int ncompressible, int flags) {
+	if (w->compress && ncompressible >= LZ_MINSZ && len <= LZ_MAXIN) {
+		int n = lz_compress(lzbuf, buf, len);
+		if (n < len) {
+			buf = lzbuf;
+			len = n;
+			flags |= DEMOCUSTOM_COMPRESSED;
+		}
+	}
+	for (; len > CHUNKSZ; len -= CHUNKSZ, buf += CHUNKSZ) {
+		demochunk_writechunk(w, buf, CHUNKSZ, DEMOCUSTOM_MARKER | flags);
+	}
+	demochunk_writechunk(w, buf, len,
+			DEMOCUSTOM_MARKER | DEMOCUSTOM_LAST | flags);
+}
+
+// Small writes are held back and then packed into as few chunks as possible,
+// each prefixed by a length byte, so that lots of little events don't each pay
+// for their own message header and WriteMessages call. Anything that wouldn't
+// fit in a chunk on its own goes straight out.
+void demochunk_flush(struct demochunk_writer *w) {
+	if (!w->_pendingcount) return;
+	// a lone payload might as well be written the normal way, sans length byte
+	if (w->_pendingcount == 1) {
+		int len = w->_npending - 1;
+		writepayload(w, w->_pending + 1, len, w->_npendingraw ? 0 : len, 0);
+	}
+	else {
+		writepayload(w, w->_pending, w->_npending,
+				w->_npending - w->_npendingraw, DEMOCUSTOM_PACKED);
+	}
+	w->_npending = 0;
+	w->_pendingcount = 0;
+	w->_npendingraw = 0;
+}
+
+static void dowrite(struct demochunk_writer *w, const char *buf, int len,
+		bool raw) {
+	if_hot (len < CHUNKSZ) {
+		if (w->_npending + 1 + len > CHUNKSZ) demochunk_flush(w);
+		w->_pending[w->_npending] = len;
+		memcpy(w->_pending + w->_npending + 1, buf, len);
+		w->_npending += 1 + len;
+		if (raw) w->_npendingraw += 1 + len;
+		++w->_pendingcount;
+		return;
+	}
+	demochunk_flush(w); // keep everything in order
+	writepayload(w, buf, len, raw ? 0 : len, 0);
+}
+
+void demochunk_write(struct demochunk_writer *w, const void *buf, int len) {
+	dowrite(w, buf, len, false);
+}
+
+void demochunk_write_raw(struct demochunk_writer *w, const void *buf, int len) {
+	dowrite(w, buf, len, true);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
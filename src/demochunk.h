@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOCHUNK_H
+#define INC_DEMOCHUNK_H
+
+#include "bitbuf.h"
+#include "democustom.h"
+#include "intdefs.h"
+
+/*
+ * The engine-independent half of democustom.c: packing small payloads
+ * together, compressing them and splitting them up into chunks, each in a user
+ * message of its own, in the format described in democustom.h. The messages
+ * are handed to a callback, which in the plugin writes them into the demo
+ * being recorded. Keeping all this separate means the tests (and any offline
+ * tools) produce exactly what the game would.
+ */
+
+struct demochunk_writer {
+	/* called with each complete message, which goes in a packet of its own */
+	void (*write)(struct bitbuf *msg);
+	int nbits_msgtype, nbits_datalen; /* header field sizes; see democustom.c */
+	bool compress; /* use chunklets/lz.h where that makes things smaller */
+	char _pending[DEMOCUSTOM_CHUNKSZ]; /* small payloads waiting to be packed */
+	int _npending, _pendingcount;
+	int _npendingraw; /* how much of that came from demochunk_write_raw() */
+};
+
+/*
+ * Writes a single chunk, of at most DEMOCUSTOM_CHUNKSZ bytes, in a message of
+ * its own, with the given marker byte. This bypasses all the packing, splitting
+ * and compression. It's mainly useful for testing; democustom_write() and
+ * demochunk_write() should be used for everything else.
+ */
+void demochunk_writechunk(struct demochunk_writer *w, const void *buf, int len,
+		int marker);
+
+/*
+ * Writes a payload. Payloads shorter than DEMOCUSTOM_CHUNKSZ are held back to
+ * be packed together, until one doesn't fit or demochunk_flush() is called;
+ * anything bigger is split up and written right away, after whatever was
+ * pending, so that everything stays in order.
+ */
+void demochunk_write(struct demochunk_writer *w, const void *buf, int len);
+
+/*
+ * Same as demochunk_write(), but for data that won't compress, such as anything
+ * encrypted, so that no time is wasted trying.
+ */
+void demochunk_write_raw(struct demochunk_writer *w, const void *buf, int len);
+
+/*
+ * Writes out any payloads held back by demochunk_write(). A lone payload is
+ * written just as it would be without packing, saving its length byte.
+ */
+void demochunk_flush(struct demochunk_writer *w);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -14,19 +14,21 @@
  * PERFORMANCE OF THIS SOFTWARE.
  */
 
-#include <string.h>
-
 #include "bitbuf.h"
 #include "con_.h"
+#include "demochunk.h"
+#include "democustom.h"
 #include "demorec.h"
 #include "engineapi.h"
 #include "errmsg.h"
 #include "feature.h"
 #include "gamedata.h"
+#include "hook.h"
 #include "intdefs.h"
 #include "langext.h"
 #include "mem.h"
 #include "ppmagic.h"
+#include "sst.h"
 #include "vcall.h"
 #include "x86.h"
 #include "x86util.h"
@@ -36,57 +38,44 @@ REQUIRE(demorec)
 REQUIRE_GAMEDATA(vtidx_GetEngineBuildNumber)
 REQUIRE_GAMEDATA(vtidx_RecordPacket)
 
-static int nbits_msgtype, nbits_datalen;
-
-// engine limit is 255, we use 2 bytes for header + round the bitstream to the
-// next whole byte, which gives 3 bytes overhead hence 252 here.
-#define CHUNKSZ 252
-
-static union {
-	char x[CHUNKSZ + /*7*/ 8]; // needs to be multiple of of 4!
-	bitbuf_cell _align; // just in case...
-} bb_buf;
-static struct bitbuf bb = {
-	{bb_buf.x}, ssizeof(bb_buf), ssizeof(bb_buf) * 8, 0, false, false, "SST"
-};
-
-static const void *createhdr(struct bitbuf *msg, int len, bool last) {
-	// We pack custom data into user message packets of type "HudText," with a
-	// leading null byte which the engine treats as an empty string. On demo
-	// playback, the client does a text lookup which fails silently on invalid
-	// keys, giving us the rest of the packet to stick in whatever data we want.
-	//
-	// Big thanks to our resident demo expert, Uncrafted, for explaining what to
-	// do here way back when this was first being figured out!
-	bitbuf_appendbits(msg, 23, nbits_msgtype); // type: 23 is user message
-	bitbuf_appendbyte(msg, 2); // user message type: 2 is HudText
-	bitbuf_appendbits(msg, len * 8, nbits_datalen); // our data length in bits
-	bitbuf_appendbyte(msg, 0); // aforementionied null byte
-	bitbuf_appendbyte(msg, 0xAC + last); // arbitrary marker byte to aid parsing
-	// store the data itself byte-aligned so there's no need to bitshift the
-	// universe (which would be both slower and more annoying to do)
-	bitbuf_roundup(msg);
-	return msg->buf + (msg->nbits >> 3);
-}
+DEF_CVAR(sst_democustom_compress, "Compress custom data in demos if it helps",
+		1, CON_HIDDEN)
 
 typedef void (*VCALLCONV WriteMessages_func)(void *this, struct bitbuf *msg);
 static WriteMessages_func WriteMessages = 0;
 
+static void writemsg(struct bitbuf *msg) { WriteMessages(demorecorder, msg); }
+
+// small writes are held back until the end of the frame; see demochunk.c
+static struct demochunk_writer writer = {.write = &writemsg};
+
+static void flush(void) {
+	writer.compress = con_getvari(sst_democustom_compress);
+	demochunk_flush(&writer);
+}
+
 void democustom_write(const void *buf, int len) {
-	for (; len > CHUNKSZ; len -= CHUNKSZ) {
-		createhdr(&bb, CHUNKSZ, false);
-		memcpy(bb.buf + (bb.nbits >> 3), buf, CHUNKSZ);
-		bb.nbits += CHUNKSZ << 3;
-		WriteMessages(demorecorder, &bb);
-		bitbuf_reset(&bb);
-	}
-	createhdr(&bb, len, true);
-	memcpy(bb.buf + (bb.nbits >> 3), buf, len);
-	bb.nbits += len << 3;
-	WriteMessages(demorecorder, &bb);
-	bitbuf_reset(&bb);
+	writer.compress = con_getvari(sst_democustom_compress);
+	demochunk_write(&writer, buf, len);
 }
 
+void democustom_write_raw(const void *buf, int len) {
+	writer.compress = con_getvari(sst_democustom_compress);
+	demochunk_write_raw(&writer, buf, len);
+}
+
+// RecordPacket writes out everything the game sent and received during the
+// frame, so that's as good a time as any to write out our stuff as well
+typedef void (*VCALLCONV RecordPacket_func)(void *this);
+static RecordPacket_func orig_RecordPacket;
+static void VCALLCONV hook_RecordPacket(void *this) {
+	flush();
+	orig_RecordPacket(this);
+}
+
+// don't lose anything from the last frame when the demo gets closed
+HANDLE_EVENT(DemoFileClosing, void) { flush(); }
+
 static bool find_WriteMessages(void) {
 	const uchar *insns = (*(uchar ***)demorecorder)[vtidx_RecordPacket];
 	// RecordPacket calls WriteMessages right away, so just look for a call
@@ -111,16 +100,29 @@ INIT {
 	// NOTE: assuming engclient != null as GEBN index relies on client version
 	int buildnum = GetEngineBuildNumber(engclient);
 	//if (GAMETYPE_MATCHES(L4D2)) { // redundant until we add more GEBN offsets!
-		nbits_msgtype = 6;
+		writer.nbits_msgtype = 6;
 		// based on Some Code I Read, buildnum *should* be the protocol version,
 		// however L4D2 returns the actual game version instead, because sure
 		// why not. The only practical difference though is that the network
 		// protocol froze after 2042, so we just have to do a >=. Fair enough!
 		// TODO(compat): how does TLS affect this? no idea yet
-		if (buildnum >= 2042) nbits_datalen = 11; else nbits_datalen = 12;
+		writer.nbits_datalen = buildnum >= 2042 ? 11 : 12;
 	//}
 
-	return find_WriteMessages();
+	if_cold (!find_WriteMessages()) return false;
+	// note: demorec has already made the vtable writable
+	orig_RecordPacket = (RecordPacket_func)hook_vtable(
+			*(void ***)demorecorder, vtidx_RecordPacket,
+			(void *)&hook_RecordPacket);
+	return true;
+}
+
+END {
+	if_hot (!sst_userunloaded) return;
+	// whatever's pending now would be from this very frame. don't lose it!
+	if (demorec_demonum() > 0) flush();
+	unhook_vtable(*(void ***)demorecorder, vtidx_RecordPacket,
+			(void *)orig_RecordPacket);
 }
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
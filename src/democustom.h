@@ -17,12 +17,44 @@
 #ifndef INC_DEMOCUSTOM_H
 #define INC_DEMOCUSTOM_H
 
+/*
+ * Custom data is stored as HudText user messages in their own demo packets, one
+ * chunk of up to DEMOCUSTOM_CHUNKSZ bytes per message. Each message's data is a
+ * null byte (an empty string, as far as the game is concerned), a marker byte,
+ * padding to the next whole byte in the packet, and then the chunk. The marker
+ * is DEMOCUSTOM_MARKER, plus DEMOCUSTOM_LAST on the final chunk of a payload.
+ * The header fields before that are sized according to the network protocol;
+ * see democustom.c. The encoding itself is done by src/demochunk.c, which
+ * doesn't depend on the engine. src/demoextract.c gets payloads back out of
+ * demo files.
+ *
+ * Small payloads written in the same frame are packed together into a single
+ * chunk, each preceded by a length byte. Such chunks have DEMOCUSTOM_PACKED set
+ * in their marker, along with DEMOCUSTOM_LAST.
+ *
+ * A payload (or packed chunk) may also be compressed with chunklets/lz.h before
+ * being split up, in which case all of its chunks have DEMOCUSTOM_COMPRESSED
+ * set. Packed chunks are split up after decompressing.
+ */
+#define DEMOCUSTOM_CHUNKSZ 252
+#define DEMOCUSTOM_MARKER 0xAC
+#define DEMOCUSTOM_LAST 1
+#define DEMOCUSTOM_PACKED 2
+#define DEMOCUSTOM_COMPRESSED 0x10
+
 /*
  * Writes a custom demo message, automatically splitting into multiple demo
- * packets if too long. Assumes a demo is currently being recorded.
+ * packets if too long. Assumes a demo is currently being recorded. Messages
+ * shorter than DEMOCUSTOM_CHUNKSZ are buffered until the end of the frame.
  */
 void democustom_write(const void *buf, int len);
 
+/*
+ * Same as democustom_write(), but for data that won't compress, such as
+ * anything encrypted, so that no time is wasted trying.
+ */
+void democustom_write_raw(const void *buf, int len);
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
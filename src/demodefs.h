@@ -89,6 +89,17 @@ enum {
 	DEMO_PROTO_UNKNOWN
 };
 
+/*
+ * Packet and signon commands start with view info for each splitscreen player
+ * slot: flags, then view origin/angles/local angles, each twice (the second
+ * set being the "resampled" ones), as floats. Protocol 3 demos only have one
+ * slot; protocol 4 has as many as the game supports, i.e. 2 in Portal 2 and 4
+ * in L4D. Protocol 4 also adds a player slot byte after each command's tick.
+ */
+#define DEMO_CMDINFO_SZ 76
+#define DEMO_MAXSPLITSCREEN_PORTAL2 2
+#define DEMO_MAXSPLITSCREEN_L4D 4
+
 #endif
 
 // vi: sw=4 ts=4 noet tw=80 cc=80
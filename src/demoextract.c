@@ -0,0 +1,213 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "bitbuf.h"
+#include "chunklets/lz.h"
+#include "demodefs.h"
+#include "democustom.h"
+#include "demoextract.h"
+#include "demofile.h"
+#include "intdefs.h"
+#include "langext.h"
+
+// these all mirror createhdr() in democustom.c
+#define NBITS_MSGTYPE 6
+#define SVC_USERMESSAGE 23
+#define UMSG_HUDTEXT 2
+
+void demoextract_init(struct demoextract *x, struct demofile *df) {
+	x->df = df;
+	// 11 or 12 bits, depending on the engine build (see democustom.c), which
+	// the header doesn't tell us. getchunk() switches over if it's the other
+	x->nbits_datalen = 12;
+	x->err = 0;
+	x->_buf = 0;
+	x->_bufsz = 0;
+	x->_buflen = 0;
+	x->_lzbuf = 0;
+	x->_lzbufsz = 0;
+	x->_packed = 0;
+	x->_packedend = 0;
+}
+
+void demoextract_free(struct demoextract *x) {
+	free(x->_buf);
+	free(x->_lzbuf);
+	x->_buf = 0;
+	x->_bufsz = 0;
+	x->_buflen = 0;
+	x->_lzbuf = 0;
+	x->_lzbufsz = 0;
+}
+
+// Checks whether a packet is one of our chunks, given the size of the user
+// message length field. If so, returns the marker byte and points data/len at
+// the chunk. Otherwise, returns -1.
+static int parsechunk(const struct demofile_cmd *cmd, int nbits_datalen,
+		const uchar **data, uint *len) {
+	struct bitbuf_reader r;
+	bitbuf_initreader(&r, cmd->data, cmd->len);
+	bitbuf_skip(&r, NBITS_MSGTYPE);
+	if (bitbuf_readbyte(&r) != UMSG_HUDTEXT) return -1;
+	uint nbits = bitbuf_readbits(&r, nbits_datalen);
+	if (bitbuf_readbyte(&r) != 0) return -1;
+	int marker = bitbuf_readbyte(&r);
+	if_cold (r.overflow) return -1;
+	if ((marker & ~(DEMOCUSTOM_LAST | DEMOCUSTOM_PACKED |
+			DEMOCUSTOM_COMPRESSED)) != DEMOCUSTOM_MARKER) {
+		return -1;
+	}
+	uint off = (r.curbit + 7) >> 3;
+	// a real HudText message could conceivably get this far by coincidence,
+	// but the length will only line up exactly with the packet if it's ours
+	if (nbits != (cmd->len - off) << 3 || cmd->len - off > DEMOCUSTOM_CHUNKSZ) {
+		return -1;
+	}
+	*data = cmd->data + off;
+	*len = cmd->len - off;
+	return marker;
+}
+
+// Does the above for whichever length field size worked last, and then for the
+// other one, since the demo header doesn't tell us which the writer used. Real
+// game packets start with all sorts of other messages, so almost everything
+// gets rejected by looking at the first byte alone, before trying either.
+static int getchunk(struct demoextract *x, const struct demofile_cmd *cmd,
+		const uchar **data, uint *len) {
+	if (cmd->len < 2 || (cmd->data[0] & ((1 << NBITS_MSGTYPE) - 1)) !=
+			SVC_USERMESSAGE) {
+		return -1;
+	}
+	int marker = parsechunk(cmd, x->nbits_datalen, data, len);
+	if_hot (marker != -1) return marker;
+	int other = x->nbits_datalen == 11 ? 12 : 11;
+	marker = parsechunk(cmd, other, data, len);
+	if (marker != -1) x->nbits_datalen = other;
+	return marker;
+}
+
+// makes sure a buffer has room for at least sz bytes
+static bool grow(uchar **buf, uint *bufsz, uint sz) {
+	if (*bufsz >= sz) return true;
+	uint newsz = *bufsz ? *bufsz : 4096;
+	while (newsz < sz) {
+		if_cold (newsz > (uint)-1 / 2) return false;
+		newsz <<= 1;
+	}
+	uchar *p = realloc(*buf, newsz);
+	if_cold (!p) return false;
+	*buf = p;
+	*bufsz = newsz;
+	return true;
+}
+
+// gets the next payload from a packed chunk, which is always done in place
+static bool nextpacked(struct demoextract *x, struct demoextract_payload *out) {
+	uint len = *x->_packed++;
+	if_cold (len > x->_packedend - x->_packed) {
+		x->err = "packed custom data chunk is malformed";
+		x->_packed = x->_packedend;
+		return false;
+	}
+	out->data = x->_packed;
+	out->len = len;
+	out->tick = x->_tick;
+	out->off = x->_off;
+	x->_packed += len;
+	return true;
+}
+
+// hands back a whole payload (or packed chunk), as flagged by the marker byte
+// of its last chunk, decompressing and/or unpacking it first if need be
+static bool finish(struct demoextract *x, const uchar *data, uint len,
+		int marker, struct demoextract_payload *out) {
+	if (marker & DEMOCUSTOM_COMPRESSED) {
+		int n = lz_decompressedsz(data, len);
+		// nothing real compresses this well, so don't allocate loads for junk
+		if_cold (n < 0 || (uvlong)n > (uvlong)len * 255) goto corrupt;
+		if_cold (!grow(&x->_lzbuf, &x->_lzbufsz, n)) {
+			x->err = "couldn't allocate memory for custom data";
+			return false;
+		}
+		if_cold (lz_decompress(x->_lzbuf, n, data, len) != n) goto corrupt;
+		data = x->_lzbuf;
+		len = n;
+	}
+	if (marker & DEMOCUSTOM_PACKED) {
+		if_cold (!len) {
+			x->err = "packed custom data chunk is malformed";
+			return false;
+		}
+		x->_packed = data;
+		x->_packedend = data + len;
+		return nextpacked(x, out);
+	}
+	out->data = data;
+	out->len = len;
+	out->tick = x->_tick;
+	out->off = x->_off;
+	return true;
+
+corrupt:
+	x->err = "compressed custom data is corrupt";
+	return false;
+}
+
+bool demoextract_next(struct demoextract *x, struct demoextract_payload *out) {
+	if (x->_packed != x->_packedend) return nextpacked(x, out);
+	struct demofile_cmd cmd;
+	while (demofile_next(x->df, &cmd)) {
+		// WriteMessages() writes signon packets instead while signing on
+		if (cmd.cmd != DEMO_CMD_PACKET && cmd.cmd != DEMO_CMD_SIGNON) continue;
+		const uchar *data;
+		uint len;
+		int marker = getchunk(x, &cmd, &data, &len);
+		if_hot (marker == -1) continue;
+		bool last = marker & DEMOCUSTOM_LAST;
+		if (!x->_buflen) {
+			x->_tick = cmd.tick;
+			x->_off = cmd.off;
+			// the common case: the whole thing is right here
+			if_hot (last) return finish(x, data, len, marker, out);
+		}
+		if_cold (!last && len != DEMOCUSTOM_CHUNKSZ) {
+			x->err = "custom data chunk has the wrong size";
+			x->_buflen = 0;
+			return false;
+		}
+		if_cold (!grow(&x->_buf, &x->_bufsz, x->_buflen + len)) {
+			x->err = "couldn't allocate memory for custom data";
+			x->_buflen = 0;
+			return false;
+		}
+		memcpy(x->_buf + x->_buflen, data, len);
+		x->_buflen += len;
+		if (last) {
+			len = x->_buflen;
+			x->_buflen = 0; // keeps the data around until the next call
+			return finish(x, x->_buf, len, marker, out);
+		}
+	}
+	if (x->df->err) x->err = x->df->err;
+	else if (x->_buflen) x->err = "demo ends partway through custom data";
+	x->_buflen = 0;
+	return false;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
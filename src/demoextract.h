@@ -0,0 +1,74 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOEXTRACT_H
+#define INC_DEMOEXTRACT_H
+
+#include "demofile.h"
+#include "intdefs.h"
+
+/*
+ * Gets custom data payloads, as written by democustom_write(), back out of a
+ * demo file, for offline tools. This sits on top of demofile.h, picking out
+ * the packets that hold custom data chunks and putting the chunks back
+ * together, or splitting them up again if they were packed together. Payloads
+ * that fit in a single chunk are returned in place, without any copying; only
+ * larger ones have to be reassembled in a separate buffer. Compressed payloads
+ * are decompressed into another buffer.
+ */
+
+struct demoextract {
+	struct demofile *df;
+	int nbits_datalen; /* user message length field size, as last seen */
+	const char *err; /* set if demoextract_next() stopped due to a problem */
+	uchar *_buf; /* for reassembly; grows as needed */
+	uint _bufsz, _buflen;
+	uchar *_lzbuf; /* for decompression; likewise */
+	uint _lzbufsz;
+	const uchar *_packed, *_packedend; /* rest of the current packed chunk */
+	s32 _tick; /* tick of the first chunk of the payload being reassembled */
+	usize _off; /* ...and its offset */
+};
+
+struct demoextract_payload {
+	const uchar *data; /* valid until the next call (or demofile_close()) */
+	uint len;
+	s32 tick; /* tick of the (first) packet the payload was found in */
+	usize off; /* offset of that packet in the file */
+};
+
+/*
+ * Sets up an extractor over a demo file that has been opened with demofile.h.
+ * Commands are read from wherever the file's cursor currently is.
+ */
+void demoextract_init(struct demoextract *x, struct demofile *df);
+
+/*
+ * Finds the next custom data payload and puts it in out. Returns false at the
+ * end of the demo. If there's a problem with either the custom data or the
+ * demo itself, err is set to describe it (the latter is copied from the
+ * demofile's err).
+ */
+bool demoextract_next(struct demoextract *x, struct demoextract_payload *out);
+
+/*
+ * Frees the reassembly buffer, if any. Doesn't close the demo file.
+ */
+void demoextract_free(struct demoextract *x);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
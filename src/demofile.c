@@ -0,0 +1,258 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <string.h>
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "demodefs.h"
+#include "demofile.h"
+#include "intdefs.h"
+#include "langext.h"
+#include "mem.h"
+
+// Works out the protocol from the header. The demo protocol version decides
+// the framing; the network protocol narrows it down to a specific game/branch,
+// which matters for the number of splitscreen slots in protocol 4.
+static bool setproto(struct demofile *df) {
+	const struct demo_hdr *h = df->hdr;
+	df->proto = DEMO_PROTO_UNKNOWN;
+	switch (h->demover) {
+		case 3:
+			switch (h->netver) {
+				case 7: df->proto = DEMO_PROTO_HL2OE; break;
+				case 14: df->proto = DEMO_PROTO_PORTAL_3420; break;
+				case 15: df->proto = DEMO_PROTO_PORTAL_5135; break;
+				case 24: df->proto = DEMO_PROTO_PORTAL_STEAM;
+			}
+			df->cmdinfosz = DEMO_CMDINFO_SZ;
+			df->playerslot = false;
+			df->customdata = false;
+			return true;
+		case 4:
+			switch (h->netver) {
+				case 2000: df->proto = DEMO_PROTO_L4D2000; break;
+				case 2001: df->proto = DEMO_PROTO_PORTAL2; break;
+				default: if (h->netver >= 2042) df->proto = DEMO_PROTO_L4D2042;
+			}
+			// anything else using protocol 4 is probably L4D-like
+			df->cmdinfosz = DEMO_CMDINFO_SZ * (df->proto == DEMO_PROTO_PORTAL2 ?
+					DEMO_MAXSPLITSCREEN_PORTAL2 : DEMO_MAXSPLITSCREEN_L4D);
+			df->playerslot = true;
+			df->customdata = true;
+			return true;
+	}
+	return false;
+}
+
+bool demofile_init(struct demofile *df, const void *buf, usize sz) {
+	df->hdr = buf;
+	df->cur = (const uchar *)buf + sizeof(struct demo_hdr);
+	df->end = (const uchar *)buf + sz;
+	df->err = 0;
+	df->_map = 0;
+	df->_mapsz = 0;
+	if (sz < sizeof(struct demo_hdr) || memcmp(buf, "HL2DEMO", 8)) {
+		df->err = "not a demo file";
+		return false;
+	}
+	if (!setproto(df)) {
+		df->err = "unsupported demo protocol version";
+		return false;
+	}
+	return true;
+}
+
+bool demofile_open(struct demofile *df, const char *path) {
+	df->_map = 0;
+#ifdef _WIN32
+	HANDLE f = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, 0,
+			OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, 0);
+	if (f == INVALID_HANDLE_VALUE) {
+		df->err = "couldn't open file";
+		return false;
+	}
+	LARGE_INTEGER fsz;
+	if (!GetFileSizeEx(f, &fsz)) {
+		CloseHandle(f);
+		df->err = "couldn't get file size";
+		return false;
+	}
+	if ((u64)fsz.QuadPart > (usize)-1) {
+		CloseHandle(f);
+		df->err = "file is too big to map";
+		return false;
+	}
+	usize sz = fsz.QuadPart;
+	if (sz < sizeof(struct demo_hdr)) {
+		CloseHandle(f);
+		df->err = "not a demo file";
+		return false;
+	}
+	HANDLE m = CreateFileMappingA(f, 0, PAGE_READONLY, 0, 0, 0);
+	CloseHandle(f); // the mapping keeps its own reference
+	if (!m) { df->err = "couldn't map file"; return false; }
+	void *p = MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(m); // likewise for the view
+	if (!p) { df->err = "couldn't map file"; return false; }
+#else
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) { df->err = strerror(errno); return false; }
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		df->err = strerror(errno);
+		close(fd);
+		return false;
+	}
+	if ((uvlong)st.st_size > (usize)-1) {
+		close(fd);
+		df->err = "file is too big to map";
+		return false;
+	}
+	usize sz = st.st_size;
+	if (sz < sizeof(struct demo_hdr)) {
+		close(fd);
+		df->err = "not a demo file";
+		return false;
+	}
+	void *p = mmap(0, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd); // the mapping keeps its own reference
+	if (p == MAP_FAILED) { df->err = strerror(errno); return false; }
+	// we only ever go forwards, so read ahead aggressively and drop pages
+	// behind us, which makes a big difference to multi-GB files
+	madvise(p, sz, MADV_SEQUENTIAL);
+#endif
+	bool ret = demofile_init(df, p, sz);
+	df->_map = p;
+	df->_mapsz = sz;
+	if (!ret) demofile_close(df);
+	return ret;
+}
+
+void demofile_close(struct demofile *df) {
+	if (!df->_map) return;
+#ifdef _WIN32
+	UnmapViewOfFile(df->_map);
+#else
+	munmap(df->_map, df->_mapsz);
+#endif
+	df->_map = 0;
+}
+
+bool demofile_next(struct demofile *df, struct demofile_cmd *cmd) {
+	const uchar *p = df->cur, *end = df->end;
+	// running out without a stop command is normal for demos that weren't
+	// stopped cleanly (e.g. if the game crashed), so it's not an error
+	if_cold (p == end) return false;
+	int hdrsz = 5 + df->playerslot;
+	if_cold (end - p < hdrsz) goto trunc;
+	cmd->cmd = p[0];
+	cmd->tick = mem_loads32(p + 1);
+	cmd->playerslot = df->playerslot ? p[5] : 0;
+	cmd->off = p - (const uchar *)df->hdr;
+	cmd->cmdinfo = 0;
+	cmd->seqin = 0; cmd->seqout = 0;
+	cmd->arg = 0;
+	cmd->data = 0;
+	cmd->len = 0;
+	p += hdrsz;
+	switch (cmd->cmd) {
+		case DEMO_CMD_SIGNON: case DEMO_CMD_PACKET:
+			if_cold (end - p < df->cmdinfosz + 8) goto trunc;
+			cmd->cmdinfo = p;
+			p += df->cmdinfosz;
+			cmd->seqin = mem_loads32(p);
+			cmd->seqout = mem_loads32(p + 4);
+			p += 8;
+			goto sized;
+		case DEMO_CMD_SYNC:
+			break;
+		case DEMO_CMD_STOP:
+			// some games write junk after this; it's not part of the demo
+			df->cur = end;
+			return true;
+		case DEMO_CMD_USERCMD:
+			if_cold (end - p < 4) goto trunc;
+			cmd->arg = mem_loads32(p);
+			p += 4;
+			goto sized;
+		case DEMO_CMD_CONCMD: case DEMO_CMD_DATATABLES:
+			goto sized;
+		case DEMO_CMD_CUSTOMDATA: // aka DEMO_CMD_STRINGTABLES14
+			if (!df->customdata) goto sized;
+			if_cold (end - p < 4) goto trunc;
+			cmd->arg = mem_loads32(p);
+			p += 4;
+			goto sized;
+		case DEMO_CMD_STRINGTABLES36:
+			if (df->customdata) goto sized;
+			// else, fall through
+		default:
+			df->err = "unknown command type (corrupt demo?)";
+			df->cur = end;
+			return false;
+	}
+	df->cur = p;
+	return true;
+
+sized:
+	if_cold (end - p < 4) goto trunc;
+	// size is signed in the engine, but negative would be an error anyway
+	cmd->len = mem_loadu32(p);
+	p += 4;
+	if_cold ((usize)(end - p) < cmd->len) goto trunc;
+	cmd->data = p;
+	df->cur = p + cmd->len;
+	return true;
+
+trunc:
+	df->err = "demo is truncated";
+	df->cur = end;
+	return false;
+}
+
+bool demofile_seek(struct demofile *df, usize off) {
+	const uchar *base = (const uchar *)df->hdr;
+	if (off < sizeof(struct demo_hdr) || off > (usize)(df->end - base)) {
+		return false;
+	}
+	df->cur = base + off;
+	df->err = 0;
+	return true;
+}
+
+const char *demofile_cmdname(const struct demofile *df, int cmd) {
+	static const char *const names[] = {
+		0, "signon", "packet", "sync", "concmd", "usercmd", "datatables",
+		"stop", "customdata", "stringtables"
+	};
+	if (cmd == DEMO_CMD_STRINGTABLES14 && !df->customdata) {
+		return "stringtables";
+	}
+	if (cmd == DEMO_CMD_STRINGTABLES36 && !df->customdata) return "unknown";
+	if (cmd <= 0 || cmd >= countof(names)) return "unknown";
+	return names[cmd];
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
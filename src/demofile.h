@@ -0,0 +1,99 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOFILE_H
+#define INC_DEMOFILE_H
+
+#include "demodefs.h"
+#include "intdefs.h"
+
+/*
+ * A standalone demo file parser, for offline tools. It doesn't depend on the
+ * engine or anything else in the plugin. The whole file is mapped into memory
+ * (or handed over as a buffer), and commands are read with a cursor that just
+ * points into it; nothing is copied, so parsing runs about as fast as the disk
+ * can supply the data.
+ *
+ * Commands are framed differently depending on the demo protocol; this is all
+ * handled here, so callers just see a sequence of struct demofile_cmd.
+ */
+
+struct demofile {
+	const struct demo_hdr *hdr; /* points at the start of the file */
+	const uchar *cur, *end; /* the cursor; cur is the next command */
+	int proto; /* DEMO_PROTO_*; UNKNOWN if guessed from demover alone */
+	int cmdinfosz; /* size of the view info in each packet/signon command */
+	bool playerslot; /* whether each command has a player slot byte */
+	bool customdata; /* whether command 8 is custom data (not string tables) */
+	const char *err; /* set if demofile_next() stopped because of a problem */
+	void *_map; /* for demofile_close(); null if not opened from a file */
+	usize _mapsz;
+};
+
+struct demofile_cmd {
+	uchar cmd; /* enum demo_cmd */
+	uchar playerslot; /* always 0 if the protocol doesn't have them */
+	s32 tick;
+	usize off; /* offset of the command in the file */
+	const uchar *cmdinfo; /* view info for packet/signon; null otherwise */
+	s32 seqin, seqout; /* packet/signon sequence numbers */
+	s32 arg; /* usercmd sequence number, or customdata callback index */
+	const uchar *data; /* the payload (if any), pointing into the file */
+	u32 len;
+};
+
+/*
+ * Sets up a parser over an in-memory copy of a demo file, which must stay
+ * around while the parser is in use, and must be at least 4-byte aligned.
+ * Returns false and sets err if it doesn't look like a valid demo.
+ */
+bool demofile_init(struct demofile *df, const void *buf, usize sz);
+
+/*
+ * Maps a demo file into memory and sets up a parser over it. Returns false and
+ * sets err on failure. demofile_close() must be called afterwards to unmap it.
+ */
+bool demofile_open(struct demofile *df, const char *path);
+
+/*
+ * Unmaps a file opened by demofile_open(). Does nothing for demofile_init().
+ */
+void demofile_close(struct demofile *df);
+
+/*
+ * Reads the next command into cmd and advances the cursor. Returns false at the
+ * end of the demo, which is either after the stop command (which is itself
+ * returned as normal), or at the end of the file for demos that weren't stopped
+ * cleanly. If the end was reached because of corrupt or truncated data, err is
+ * also set. The data pointer in cmd stays valid until demofile_close().
+ */
+bool demofile_next(struct demofile *df, struct demofile_cmd *cmd);
+
+/*
+ * Moves the cursor to off, which must be the offset of a command, as given in
+ * struct demofile_cmd (or a demo index; see demoindex.h). Returns false if off
+ * is out of bounds, leaving the cursor where it was. Also clears err.
+ */
+bool demofile_seek(struct demofile *df, usize off);
+
+/*
+ * Returns a readable name for a command number under the protocol of df.
+ */
+const char *demofile_cmdname(const struct demofile *df, int cmd);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
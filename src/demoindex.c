@@ -0,0 +1,167 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "demodefs.h"
+#include "demofile.h"
+#include "demoindex.h"
+#include "intdefs.h"
+#include "langext.h"
+
+void demoindex_initbuilder(struct demoindex_builder *b, s32 interval) {
+	b->entries = 0;
+	b->nentries = 0;
+	b->_cap = 0;
+	b->interval = interval > 0 ? interval : 1;
+	b->_nexttick = INT_MIN; // always add the very first command
+	b->oom = false;
+}
+
+void demoindex_add(struct demoindex_builder *b,
+		const struct demofile_cmd *cmd) {
+	if_hot (cmd->tick < b->_nexttick || b->oom) return;
+	if_cold (b->nentries == b->_cap) {
+		uint newcap = b->_cap ? b->_cap * 2 : 1024;
+		struct demoindex_entry *p;
+		if_cold (newcap > (uint)-1 / sizeof(*p) ||
+				!(p = realloc(b->entries, newcap * sizeof(*p)))) {
+			b->oom = true;
+			return;
+		}
+		b->entries = p;
+		b->_cap = newcap;
+	}
+	b->entries[b->nentries++] = (struct demoindex_entry){
+		.tick = cmd->tick, .cmd = cmd->cmd, .off = cmd->off
+	};
+	// this also keeps the ticks strictly increasing, even if the demo's ticks
+	// jump around, which the binary search relies on
+	b->_nexttick = cmd->tick > INT_MAX - b->interval ?
+			INT_MAX : cmd->tick + b->interval;
+}
+
+bool demoindex_build(struct demoindex_builder *b, struct demofile *df) {
+	struct demofile_cmd cmd;
+	while (demofile_next(df, &cmd)) demoindex_add(b, &cmd);
+	return !df->err && !b->oom;
+}
+
+bool demoindex_save(const struct demoindex_builder *b, const char *path,
+		u64 demosz) {
+	FILE *f = fopen(path, "wb");
+	if (!f) return false;
+	struct demoindex_hdr hdr = {
+		.demosz = demosz, .nentries = b->nentries, .interval = b->interval
+	};
+	memcpy(hdr.magic, DEMOINDEX_MAGIC, sizeof(hdr.magic));
+	bool ok = fwrite(&hdr, sizeof(hdr), 1, f) == 1 && fwrite(b->entries,
+			sizeof(*b->entries), b->nentries, f) == b->nentries;
+	int e = errno;
+	if (fclose(f) == EOF) ok = false; else errno = e;
+	if (!ok) remove(path); // don't leave a partial index lying around
+	return ok;
+}
+
+void demoindex_freebuilder(struct demoindex_builder *b) {
+	free(b->entries);
+	b->entries = 0;
+	b->nentries = 0;
+	b->_cap = 0;
+}
+
+bool demoindex_init(struct demoindex *idx, const void *buf, usize sz) {
+	idx->hdr = buf;
+	idx->entries = (const struct demoindex_entry *)(idx->hdr + 1);
+	idx->err = 0;
+	idx->_buf = 0;
+	if (sz < sizeof(*idx->hdr) || memcmp(idx->hdr->magic, DEMOINDEX_MAGIC,
+			sizeof(idx->hdr->magic))) {
+		idx->err = "not a demo index file";
+		return false;
+	}
+	if ((sz - sizeof(*idx->hdr)) / sizeof(*idx->entries) !=
+			idx->hdr->nentries) {
+		idx->err = "demo index is the wrong size";
+		return false;
+	}
+	return true;
+}
+
+bool demoindex_load(struct demoindex *idx, const char *path) {
+	idx->_buf = 0;
+	FILE *f = fopen(path, "rb");
+	if (!f) { idx->err = strerror(errno); return false; }
+	struct demoindex_hdr hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1) {
+		fclose(f);
+		idx->err = "not a demo index file";
+		return false;
+	}
+	if (hdr.nentries > ((usize)-1 - sizeof(hdr)) / sizeof(*idx->entries)) {
+		fclose(f);
+		idx->err = "demo index is the wrong size";
+		return false;
+	}
+	// entries are 8-byte aligned, which malloc gives us anyway
+	usize sz = sizeof(hdr) + (usize)hdr.nentries * sizeof(*idx->entries);
+	void *buf = malloc(sz);
+	if (!buf) {
+		fclose(f);
+		idx->err = "couldn't allocate memory for demo index";
+		return false;
+	}
+	memcpy(buf, &hdr, sizeof(hdr));
+	usize n = fread((char *)buf + sizeof(hdr), 1, sz - sizeof(hdr), f);
+	fclose(f);
+	if (!demoindex_init(idx, buf, sizeof(hdr) + n)) {
+		free(buf);
+		return false;
+	}
+	idx->_buf = buf;
+	return true;
+}
+
+void demoindex_free(struct demoindex *idx) {
+	free(idx->_buf);
+	idx->_buf = 0;
+}
+
+const struct demoindex_entry *demoindex_find(const struct demoindex *idx,
+		s32 tick) {
+	// find the first entry past tick, then step back one
+	uint lo = 0, hi = idx->hdr->nentries;
+	while (lo < hi) {
+		uint mid = lo + (hi - lo) / 2;
+		if (idx->entries[mid].tick <= tick) lo = mid + 1; else hi = mid;
+	}
+	return lo ? idx->entries + lo - 1 : 0;
+}
+
+bool demoindex_seek(const struct demoindex *idx, struct demofile *df,
+		s32 tick) {
+	if (idx->hdr->demosz != (u64)(df->end - (const uchar *)df->hdr)) {
+		return false;
+	}
+	const struct demoindex_entry *e = demoindex_find(idx, tick);
+	return demofile_seek(df, e ? e->off : sizeof(struct demo_hdr));
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
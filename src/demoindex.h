@@ -0,0 +1,133 @@
+/*
+ * Copyright © 2024 Michael Smith <mikesmiffy128@gmail.com>
+ *
+ * Permission to use, copy, modify, and/or distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED “AS IS” AND THE AUTHOR DISCLAIMS ALL WARRANTIES WITH
+ * REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF MERCHANTABILITY
+ * AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR ANY SPECIAL, DIRECT,
+ * INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES WHATSOEVER RESULTING FROM
+ * LOSS OF USE, DATA OR PROFITS, WHETHER IN AN ACTION OF CONTRACT, NEGLIGENCE OR
+ * OTHER TORTIOUS ACTION, ARISING OUT OF OR IN CONNECTION WITH THE USE OR
+ * PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef INC_DEMOINDEX_H
+#define INC_DEMOINDEX_H
+
+#include "demofile.h"
+#include "intdefs.h"
+
+/*
+ * A seek index for demo files, kept in a sidecar file alongside the demo. It's
+ * a sorted list of checkpoints, each being the tick, file offset and type of
+ * the first command at or after some tick, so that an offline tool can jump
+ * into the middle of a long demo with a binary search instead of parsing
+ * everything before the part it wants.
+ *
+ * The file is a struct demoindex_hdr followed by the entries, as they are in
+ * memory (little endian, like the demo itself).
+ */
+
+#define DEMOINDEX_MAGIC "SSTDIDX1"
+
+struct demoindex_hdr {
+	char magic[8]; /* DEMOINDEX_MAGIC, not null-terminated */
+	u64 demosz; /* size of the demo file, for catching stale indices */
+	u32 nentries;
+	s32 interval; /* minimum number of ticks between entries */
+};
+
+struct demoindex_entry {
+	s32 tick;
+	uchar cmd; /* enum demo_cmd */
+	uchar _pad[3];
+	u64 off;
+};
+
+/*
+ * Collects index entries in memory while a demo is parsed, to then be saved.
+ */
+struct demoindex_builder {
+	struct demoindex_entry *entries;
+	uint nentries, _cap;
+	s32 interval;
+	s32 _nexttick;
+	bool oom; /* set if demoindex_add() ran out of memory; sticky */
+};
+
+/*
+ * Sets up a builder which makes a checkpoint every interval ticks (or at the
+ * next command after, if there's none on that exact tick).
+ */
+void demoindex_initbuilder(struct demoindex_builder *b, s32 interval);
+
+/*
+ * Considers a command as a checkpoint, adding an entry if it's far enough past
+ * the last one. Must be called for every command in order, or at least every
+ * command that should be considered. Does nothing after running out of memory.
+ */
+void demoindex_add(struct demoindex_builder *b,
+		const struct demofile_cmd *cmd);
+
+/*
+ * Parses the rest of a demo from wherever its cursor is, adding every command.
+ * Returns false if the demo couldn't be parsed to the end (with the demofile's
+ * err set) or if memory ran out (with oom set).
+ */
+bool demoindex_build(struct demoindex_builder *b, struct demofile *df);
+
+/*
+ * Writes out an index file for a demo of size demosz. Returns false on failure,
+ * with errno set.
+ */
+bool demoindex_save(const struct demoindex_builder *b, const char *path,
+		u64 demosz);
+
+void demoindex_freebuilder(struct demoindex_builder *b);
+
+/*
+ * A loaded index, to be searched.
+ */
+struct demoindex {
+	const struct demoindex_hdr *hdr;
+	const struct demoindex_entry *entries;
+	const char *err; /* set if loading failed */
+	void *_buf; /* for demoindex_free() */
+};
+
+/*
+ * Sets up an index over a copy of an index file held in memory. buf must be at
+ * least 8-byte aligned and stay around while the index is in use. Returns
+ * false and sets err if it isn't a valid index.
+ */
+bool demoindex_init(struct demoindex *idx, const void *buf, usize sz);
+
+/*
+ * Reads an index file into memory. Returns false and sets err if it couldn't
+ * be read or isn't a valid index. demoindex_free() must be called afterwards.
+ */
+bool demoindex_load(struct demoindex *idx, const char *path);
+
+void demoindex_free(struct demoindex *idx);
+
+/*
+ * Finds the latest checkpoint at or before tick, using a binary search. Returns
+ * null if there isn't one, meaning parsing has to start from the beginning.
+ */
+const struct demoindex_entry *demoindex_find(const struct demoindex *idx,
+		s32 tick);
+
+/*
+ * Moves a demofile's cursor to the latest checkpoint at or before tick, or to
+ * the first command if there isn't one. Reading onwards from there will then
+ * reach tick with as little parsing as the index allows. Returns false if the
+ * index doesn't match the demo.
+ */
+bool demoindex_seek(const struct demoindex *idx, struct demofile *df, s32 tick);
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -54,6 +54,7 @@ bool demorec_forceauto = false;
 
 DEF_PREDICATE(DemoControlAllowed, void)
 DEF_EVENT(DemoRecordStarting, void)
+DEF_EVENT(DemoFileClosing, void)
 DEF_EVENT(DemoRecordStopped, int)
 
 typedef void (*VCALLCONV SetSignonState_func)(void *, int);
@@ -81,6 +82,7 @@ static StopRecording_func orig_StopRecording;
 static void VCALLCONV hook_StopRecording(void *this) {
 	bool wasrecording = *recording;
 	int lastnum = *demonum;
+	if (wasrecording) EMIT_DemoFileClosing();
 	orig_StopRecording(this);
 	// If the user didn't specifically request the stop, tell the engine to
 	// start recording again as soon as it can.
@@ -245,6 +247,7 @@ int demorec_stop(void) {
 	// note: our set-to-0-and-back hack actually has the nice side effect of
 	// making this correct when recording and stopping in the menu lol
 	int ret = *demonum;
+	if (*recording) EMIT_DemoFileClosing();
 	orig_StopRecording(demorecorder);
 	EMIT_DemoRecordStopped(ret);
 	return ret;
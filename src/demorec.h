@@ -79,6 +79,13 @@ DECL_PREDICATE(DemoControlAllowed, void)
  */
 DECL_EVENT(DemoRecordStarting, void)
 
+/*
+ * Emitted just before a demo file is closed, whether or not recording is going
+ * to carry on into another file afterwards. Anything that still needs to be
+ * written to the current file must be written at this point.
+ */
+DECL_EVENT(DemoFileClosing, void)
+
 /*
  * Emitted when the current demo or series of demos has finished recording.
  * Receives the number of recorded demo files (which could be 0) as an argument.
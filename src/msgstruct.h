@@ -0,0 +1,37 @@
+/* This file is dedicated to the public domain. */
+
+#ifndef INC_MSGSTRUCT_H
+#define INC_MSGSTRUCT_H
+
+/*
+ * Defines a struct which can be serialised to msgpack. The build system picks
+ * these up and generates, for each one:
+ *
+ * - MSG_MAXSZ_<name>: the worst-case encoded size, as a constant expression.
+ * - unsigned int msg_encode_<name>(unsigned char *out, const struct name *s):
+ *   writes the struct to out, which must have MSG_MAXSZ_<name> bytes of space,
+ *   returning the number of bytes written.
+ * - bool msg_decode_<name>(struct msg_cursor *c, struct name *s): reads the
+ *   struct from c, returning false and leaving c untouched on failure. Fields
+ *   missing from the input are zeroed and unknown ones are skipped.
+ *
+ * The encoding is a 2-element array of the struct name followed by a map of
+ * field names to values, i.e. ["name", {"field1": value1, ...}]. All the fixed
+ * parts are pre-encoded into constants at build time.
+ *
+ * Each field must be declared separately, with one of the plain number types
+ * from intdefs.h (or the equivalent C types), bool, float or double. Strings
+ * are declared as fixed-size char arrays, e.g. char name[16], holding at most
+ * one less than that many chars plus a null terminator; a string with no
+ * terminator is cut short when encoding, and one that's too long to fit is
+ * rejected when decoding. Pointers, other arrays and nested structs are not
+ * supported.
+ *
+ * Generated code goes in <msgstruct_MODULE.gen.h>, which must be included by
+ * the module after all its definitions, and after chunklets/msg.h.
+ */
+#define DEF_MSGSTRUCT(name) struct name /* { fields... }; */
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,185 @@
+/* This file is dedicated to the public domain. */
+
+/*
+ * A tiny benchmark harness in the spirit of test.h. A bench file starts with a
+ * description, just like a test file, followed by any number of benchmarks:
+ *
+ *   {.desc = "thing encoding"};
+ *
+ *   BENCH("encode small things", .ops = 4096) {
+ *       ...do one batch of work...
+ *       return bytes_written; // or 0 if throughput in bytes is meaningless
+ *   }
+ *
+ * Each benchmark body is called repeatedly, with the batch count doubling until
+ * a run takes long enough to time reliably. The fastest of several such runs is
+ * then reported. .ops gives the number of operations per call, so that results
+ * come out per operation rather than per batch.
+ *
+ * Benchmarks that care about latency as well as throughput can also time
+ * individual operations into a struct bench_hist (one per thread, if threads
+ * are involved) and hand it over with bench_hist_merge(). Percentiles of all
+ * the merged samples are then reported too.
+ *
+ * Results are written to stdout as CSV, one line per benchmark, with a header
+ * line first. tools/bench.sh builds and runs these under different compilers
+ * and flags and collects the results into one CSV.
+ */
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <time.h>
+#endif
+
+static struct _bench_desc {
+	char *desc;
+} _bench_desc;
+
+static struct _bench {
+	char *desc;
+	unsigned long long ops; /* operations per call; defaults to 1 */
+	unsigned long long (*_f)(void);
+	struct _bench *_next;
+} *_benches = 0, **_benches_tail = &_benches;
+
+#define _BENCH_MIN_NS 50000000ull // 50ms per timed run seems reasonable
+#define _BENCH_RUNS 5
+
+#define _BENCHCAT1(a, b) a##b
+#define _BENCHCAT(a, b) _BENCHCAT1(a, b)
+#define BENCH(desc_, ...) \
+	static unsigned long long _BENCHCAT(_bench_f_, __LINE__)(void); \
+	static struct _bench _BENCHCAT(_bench_, __LINE__) = { \
+		.desc = desc_ __VA_OPT__(,) __VA_ARGS__, \
+		._f = &_BENCHCAT(_bench_f_, __LINE__) \
+	}; \
+	__attribute__((constructor(100 + __LINE__))) \
+	static void _BENCHCAT(_bench_init_, __LINE__)(void) { \
+		*_benches_tail = &_BENCHCAT(_bench_, __LINE__); \
+		_benches_tail = &_BENCHCAT(_bench_, __LINE__)._next; \
+	} \
+	static unsigned long long _BENCHCAT(_bench_f_, __LINE__)(void)
+
+/*
+ * Tells the compiler that the memory pointed to by p is used, so that it
+ * doesn't optimise away the work being measured.
+ */
+#if defined(__GNUC__) || defined(__clang__)
+#define BENCH_USE(p) __asm__ volatile ("" : : "r"(p) : "memory")
+#else
+#define BENCH_USE(p) _ReadWriteBarrier()
+#endif
+
+static unsigned long long bench_now(void) {
+#ifdef _WIN32
+	static long long freq = 0;
+	long long t;
+	if (!freq) QueryPerformanceFrequency((LARGE_INTEGER *)&freq);
+	QueryPerformanceCounter((LARGE_INTEGER *)&t);
+	return (unsigned long long)(t / freq) * 1000000000ull +
+			(unsigned long long)(t % freq) * 1000000000ull / freq;
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+#endif
+}
+
+/*
+ * A latency histogram. Buckets are exact below 16ns, then there are 16 per
+ * power of two, so a reported value is always within about 6% of the real one.
+ */
+#define _BENCH_NBUCKETS (61 * 16)
+struct bench_hist {
+	unsigned long long n, b[_BENCH_NBUCKETS];
+};
+
+static inline void bench_hist_add(struct bench_hist *h, unsigned long long ns) {
+	unsigned int i = ns;
+	if (ns >= 16) {
+#if defined(__GNUC__) || defined(__clang__)
+		int e = 63 - __builtin_clzll(ns);
+#else
+		int e = 4;
+		while (ns >> (e + 1)) ++e;
+#endif
+		i = (e - 3) * 16 + (ns >> (e - 4) & 15);
+	}
+	++h->b[i]; ++h->n;
+}
+
+static struct bench_hist _bench_hist;
+
+/*
+ * Adds the samples from h to the ones being reported for the current benchmark,
+ * and clears h so that it can be reused.
+ */
+static void bench_hist_merge(struct bench_hist *h) {
+	for (int i = 0; i < _BENCH_NBUCKETS; ++i) _bench_hist.b[i] += h->b[i];
+	_bench_hist.n += h->n;
+	memset(h, 0, sizeof(*h));
+}
+
+static unsigned long long _bench_percentile(double pct) {
+	unsigned long long want = (unsigned long long)(_bench_hist.n * pct), n = 0;
+	for (int i = 0; i < _BENCH_NBUCKETS; ++i) {
+		n += _bench_hist.b[i];
+		if (n > want) {
+			// report the bottom of the bucket
+			return i < 16 ? i : (16ull + i % 16) << (i / 16 - 1);
+		}
+	}
+	return 0;
+}
+
+static volatile unsigned long long _bench_sink;
+
+/*
+ * Main bench driver. Does the numbers.
+ */
+int main(void) {
+	printf("bench,ns_per_op,mb_per_s,p50_ns,p99_ns,p999_ns\n");
+	for (struct _bench *b = _benches; b; b = b->_next) {
+		unsigned long long ops = b->ops ? b->ops : 1, n = 1, t, bytes;
+		// ramp up until a run is long enough, warming caches along the way
+		for (;;) {
+			t = bench_now();
+			bytes = 0;
+			for (unsigned long long i = 0; i < n; ++i) bytes += b->_f();
+			t = bench_now() - t;
+			if (t >= _BENCH_MIN_NS) break;
+			n *= 2;
+		}
+		unsigned long long best = t;
+		memset(&_bench_hist, 0, sizeof(_bench_hist)); // only count timed runs
+		for (int run = 1; run < _BENCH_RUNS; ++run) {
+			t = bench_now();
+			for (unsigned long long i = 0; i < n; ++i) _bench_sink += b->_f();
+			t = bench_now() - t;
+			if (t < best) best = t;
+		}
+		_bench_sink += bytes;
+		// descriptions are ours, so just don't put quotes in them, okay?
+		printf("\"%s: %s\",%.3f,%.1f", _bench_desc.desc, b->desc,
+				(double)best / (double)(n * ops),
+				(double)bytes / ((double)best / 1e9) / (1024.0 * 1024.0));
+		if (_bench_hist.n) {
+			printf(",%llu,%llu,%llu\n", _bench_percentile(0.5),
+					_bench_percentile(0.99), _bench_percentile(0.999));
+		}
+		else {
+			printf(",,,\n");
+		}
+	}
+	return 0;
+}
+
+#define main _main
+
+static struct _bench_desc _bench_desc = // user input follows this header
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,122 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "bitbuf"};
+
+#include "../src/bitbuf.h"
+
+// variant: scalar -DBITBUF_NO_SIMD
+// variant: avx2 -mavx2
+
+#define BIG 4096
+#define CHUNK 252 // the size of a democustom chunk
+#define N 64 // appends per batch
+
+static union {
+	char buf[N * BIG + 64];
+	bitbuf_cell _align;
+} out;
+static struct bitbuf bb = {{out.buf}, sizeof(out), sizeof(out) * 8, 0, false,
+		false, "bench"};
+
+static char src[BIG + 1]; // + 1 so it can be misaligned
+
+__attribute__((constructor(101)))
+static void init(void) {
+	for (int i = 0; i < sizeof(src); ++i) src[i] = i * 37 + 11;
+}
+
+// appends N buffers of size sz, starting off bits into the output buffer. the
+// source is deliberately misaligned, since callers can't be expected to care.
+// the size is hidden from the compiler, since it's never constant in real use
+#define APPENDBUF(desc, sz, off) \
+	BENCH(desc, .ops = N) { \
+		uint len = sz; \
+		BENCH_USE(&len); \
+		bitbuf_reset(&bb); \
+		bitbuf_appendbits(&bb, 0, off); \
+		for (int i = 0; i < N; ++i) bitbuf_appendbuf(&bb, src + 1, len); \
+		BENCH_USE(out.buf); \
+		return N * sz; \
+	}
+
+// every bit offset for democustom-sized chunks, since the paths differ
+APPENDBUF("appendbuf, 252 bytes, byte aligned", CHUNK, 0)
+APPENDBUF("appendbuf, 252 bytes, 1 bit off", CHUNK, 1)
+APPENDBUF("appendbuf, 252 bytes, 2 bits off", CHUNK, 2)
+APPENDBUF("appendbuf, 252 bytes, 3 bits off", CHUNK, 3)
+APPENDBUF("appendbuf, 252 bytes, 4 bits off", CHUNK, 4)
+APPENDBUF("appendbuf, 252 bytes, 5 bits off", CHUNK, 5)
+APPENDBUF("appendbuf, 252 bytes, 6 bits off", CHUNK, 6)
+APPENDBUF("appendbuf, 252 bytes, 7 bits off", CHUNK, 7)
+APPENDBUF("appendbuf, 4096 bytes, byte aligned", BIG, 0)
+APPENDBUF("appendbuf, 4096 bytes, 1 bit off", BIG, 1)
+APPENDBUF("appendbuf, 23 bytes, 3 bits off", 23, 3) // just under the SIMD path
+
+static char str[] = "sv_cheats 1; sar_speedrun_start"; // 31 chars, + null
+
+#define APPENDSTR(desc, off) \
+	BENCH(desc, .ops = N) { \
+		bitbuf_reset(&bb); \
+		bitbuf_appendbits(&bb, 0, off); \
+		for (int i = 0; i < N; ++i) bitbuf_appendstr(&bb, str); \
+		BENCH_USE(out.buf); \
+		return N * sizeof(str); \
+	}
+
+APPENDSTR("appendstr, 32 bytes, byte aligned", 0)
+APPENDSTR("appendstr, 32 bytes, 1 bit off", 1)
+APPENDSTR("appendstr, 32 bytes, 2 bits off", 2)
+APPENDSTR("appendstr, 32 bytes, 3 bits off", 3)
+APPENDSTR("appendstr, 32 bytes, 4 bits off", 4)
+APPENDSTR("appendstr, 32 bytes, 5 bits off", 5)
+APPENDSTR("appendstr, 32 bytes, 6 bits off", 6)
+APPENDSTR("appendstr, 32 bytes, 7 bits off", 7)
+
+// small fields are what bit streams are mostly made of. widths and values are
+// hidden from the compiler, as with sizes above
+#define NBITS 4096
+static uint vals[NBITS];
+static int widths[NBITS];
+
+__attribute__((constructor(102)))
+static void initbits(void) {
+	unsigned long long rng = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < NBITS; ++i) {
+		rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+		widths[i] = 1 + rng % 32;
+		vals[i] = (uint)(rng >> 32) >> (32 - widths[i]);
+	}
+}
+
+// fixed width, so that the alignment within a cell repeats with a short period
+#define APPENDBITS(desc, width, off) \
+	BENCH(desc, .ops = NBITS) { \
+		int w = width; \
+		BENCH_USE(&w); \
+		bitbuf_reset(&bb); \
+		bitbuf_appendbits(&bb, 0, off); \
+		for (int i = 0; i < NBITS; ++i) { \
+			bitbuf_appendbits(&bb, vals[i] & ((1u << w) - 1), w); \
+		} \
+		BENCH_USE(out.buf); \
+		return NBITS * w / 8; \
+	}
+
+APPENDBITS("appendbits, 1 bit", 1, 0)
+APPENDBITS("appendbits, 8 bits, byte aligned", 8, 0)
+APPENDBITS("appendbits, 8 bits, 3 bits off", 8, 3)
+APPENDBITS("appendbits, 13 bits", 13, 0)
+APPENDBITS("appendbits, 31 bits", 31, 0)
+
+BENCH("appendbits, random widths", .ops = NBITS) {
+	bitbuf_reset(&bb);
+	uint total = 0;
+	for (int i = 0; i < NBITS; ++i) {
+		bitbuf_appendbits(&bb, vals[i], widths[i]);
+		total += widths[i];
+	}
+	BENCH_USE(out.buf);
+	return total / 8;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
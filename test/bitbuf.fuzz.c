@@ -0,0 +1,295 @@
+/* This file is dedicated to the public domain. */
+
+// Differential fuzzing of bitbuf.h against a trivially correct bit-by-bit
+// reference writer. The input is interpreted as a buffer size followed by a
+// sequence of append operations, whose parameters (and data) also come from
+// the input. Each operation is done both ways, and the results are compared
+// bit for bit. Everything is then read back with the bitbuf reader.
+//
+// This is a libFuzzer entry point, so for actual fuzzing, build with e.g.:
+//   clang -g -O1 -fsanitize=fuzzer,address,undefined -include stdbool.h
+//           -o .build/bitbuf.fuzz test/bitbuf.fuzz.c
+// test/bitbuf.test.c also includes this file and feeds it random inputs, so
+// that the same checks get run as part of the regular tests.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/bitbuf.h"
+#include "../src/intdefs.h"
+
+#define FUZZ_CHECK(x) do { \
+	if (!(x)) { \
+		fprintf(stderr, "bitbuf.fuzz: %s:%d: check failed: %s\n", \
+				__FILE__, __LINE__, #x); \
+		abort(); \
+	} \
+} while (0)
+
+// the obvious, slow, correct way of doing it
+struct fuzz_ref {
+	uchar *buf;
+	uint nbits;
+};
+
+static void ref_put(struct fuzz_ref *r, uvlong x, int nbits) {
+	for (int i = 0; i < nbits; ++i, ++r->nbits) {
+		uchar mask = 1 << (r->nbits & 7);
+		if (x >> i & 1) r->buf[r->nbits >> 3] |= mask;
+		else r->buf[r->nbits >> 3] &= ~mask;
+	}
+}
+
+static void ref_putubitvar(struct fuzz_ref *r, uint x) {
+	if (x < 0x10) { ref_put(r, 0, 2); ref_put(r, x, 4); }
+	else if (x < 0x100) { ref_put(r, 1, 2); ref_put(r, x, 8); }
+	else if (x < 0x1000) { ref_put(r, 2, 2); ref_put(r, x, 12); }
+	else { ref_put(r, 3, 2); ref_put(r, x, 32); }
+}
+
+static void ref_putvarint32(struct fuzz_ref *r, uint x) {
+	while (x > 0x7F) { ref_put(r, (x & 0x7F) | 0x80, 8); x >>= 7; }
+	ref_put(r, x, 8);
+}
+
+enum {
+	OP_BITS, OP_BYTE, OP_BUF, OP_STR, OP_UBITVAR, OP_VARINT32, OP_SVARINT32,
+	OP_ROUNDUP,
+	OP_COUNT
+};
+
+// everything needed to read an append back afterwards
+struct fuzz_op {
+	uchar op;
+	int nbits; // for OP_BITS
+	uint x; // or len, for OP_BUF and OP_STR
+	uchar *data; // for OP_BUF and OP_STR
+};
+
+#define FUZZ_MAXOPS 256
+
+struct fuzz_input {
+	const uchar *p, *end;
+};
+
+static uint take(struct fuzz_input *in, int nbytes) {
+	uint x = 0;
+	for (int i = 0; i < nbytes && in->p < in->end; ++i) {
+		x |= (uint)*in->p++ << (i << 3);
+	}
+	return x;
+}
+
+// makes an exact-sized copy of some input, optionally misaligned, so that ASan
+// can catch any reads outside of it. returns the pointer to free() as well
+static const uchar *copydata(struct fuzz_input *in, uint len, int misalign,
+		uchar **tofree) {
+	uchar *p = malloc(len + misalign + 1);
+	FUZZ_CHECK(p);
+	*tofree = p;
+	p += misalign;
+	for (uint i = 0; i < len; ++i) p[i] = take(in, 1);
+	return p;
+}
+
+int LLVMFuzzerTestOneInput(const uchar *data, usize size) {
+	struct fuzz_input in = {data, data + size};
+	// buffer sizes are a whole number of cells, as bitbuf needs them aligned
+	uint sz = (1 + take(&in, 1) % 128) * sizeof(bitbuf_cell);
+	bitbuf_cell *cells = malloc(sz);
+	uchar *refbuf = malloc(sz);
+	FUZZ_CHECK(cells && refbuf);
+	// start with garbage, to make sure none of it leaks into the output
+	memset(cells, 0xA5, sz);
+	struct bitbuf bb = {{(char *)cells}, sz, sz * 8, 0, false, false, "fuzz"};
+	bitbuf_reset(&bb);
+	struct fuzz_ref ref = {refbuf, 0};
+	// the capacity rule documented for bitbuf_reserve()
+	uint usable = sz / sizeof(bitbuf_cell) * bitbuf_cell_bits -
+			bitbuf_cell_bits;
+	bool refoverflow = false;
+
+	struct fuzz_op ops[FUZZ_MAXOPS];
+	int nops = 0;
+	while (in.p < in.end && nops < FUZZ_MAXOPS) {
+		uint opbyte = take(&in, 1);
+		// the top bit chooses between reserve-then-append and _checked
+		bool checked = opbyte & 0x80;
+		struct fuzz_op *o = ops + nops;
+		o->op = (opbyte & 0x7F) % OP_COUNT;
+		o->data = 0;
+		uchar *tofree = 0;
+		const uchar *src = 0;
+		uint need;
+		switch (o->op) {
+			case OP_BITS:
+				o->nbits = 1 + take(&in, 1) % 32;
+				o->x = take(&in, 4) & ((uint)-1 >> (32 - o->nbits));
+				need = o->nbits;
+				break;
+			case OP_BYTE:
+				o->x = take(&in, 1);
+				need = 8;
+				break;
+			case OP_BUF: {
+				uint lenbyte = take(&in, 1);
+				// mostly short, sometimes long enough for the SIMD path
+				o->x = lenbyte & 0x80 ? (lenbyte & 0x7F) * 3 : lenbyte & 0x1F;
+				src = copydata(&in, o->x, take(&in, 1) & 7, &tofree);
+				need = o->x * 8;
+				break;
+			}
+			case OP_STR: {
+				o->x = take(&in, 1) % 48;
+				uchar *s = (uchar *)copydata(&in, o->x, take(&in, 1) & 7,
+						&tofree);
+				// no nulls in the middle, and one at the end
+				for (uint i = 0; i < o->x; ++i) s[i] |= !s[i];
+				s[o->x] = 0;
+				src = s;
+				need = (o->x + 1) * 8;
+				break;
+			}
+			case OP_UBITVAR:
+				o->x = take(&in, 4) >> take(&in, 1) % 32;
+				need = o->x < 0x10 ? 6 : o->x < 0x100 ? 10 :
+						o->x < 0x1000 ? 14 : 34;
+				break;
+			case OP_VARINT32: case OP_SVARINT32: {
+				o->x = take(&in, 4) >> take(&in, 1) % 32;
+				uint zz = o->op == OP_SVARINT32 ?
+						o->x << 1 ^ (uint)((int)o->x >> 31) : o->x;
+				need = 8;
+				for (uint y = zz; y > 0x7F; y >>= 7) need += 8;
+				break;
+			}
+			default: /* OP_ROUNDUP */
+				need = -ref.nbits & 7;
+		}
+
+		bool fits = !refoverflow && ref.nbits + need <= usable;
+		bool ok;
+		if (checked) {
+			switch (o->op) {
+				case OP_BITS:
+					ok = bitbuf_appendbits_checked(&bb, o->x, o->nbits);
+					break;
+				case OP_BYTE: ok = bitbuf_appendbyte_checked(&bb, o->x); break;
+				case OP_BUF:
+					ok = bitbuf_appendbuf_checked(&bb, (const char *)src, o->x);
+					break;
+				case OP_STR:
+					ok = bitbuf_appendstr_checked(&bb, (const char *)src);
+					break;
+				case OP_UBITVAR:
+					ok = bitbuf_appendubitvar_checked(&bb, o->x);
+					break;
+				case OP_VARINT32:
+					ok = bitbuf_appendvarint32_checked(&bb, o->x);
+					break;
+				case OP_SVARINT32:
+					ok = bitbuf_appendsvarint32_checked(&bb, o->x);
+					break;
+				default: ok = bitbuf_roundup_checked(&bb);
+			}
+		}
+		else if ((ok = bitbuf_reserve(&bb, need))) {
+			switch (o->op) {
+				case OP_BITS: bitbuf_appendbits(&bb, o->x, o->nbits); break;
+				case OP_BYTE: bitbuf_appendbyte(&bb, o->x); break;
+				case OP_BUF:
+					bitbuf_appendbuf(&bb, (const char *)src, o->x);
+					break;
+				case OP_STR: bitbuf_appendstr(&bb, (const char *)src); break;
+				case OP_UBITVAR: bitbuf_appendubitvar(&bb, o->x); break;
+				case OP_VARINT32: bitbuf_appendvarint32(&bb, o->x); break;
+				case OP_SVARINT32: bitbuf_appendsvarint32(&bb, o->x); break;
+				default: bitbuf_roundup(&bb);
+			}
+		}
+		FUZZ_CHECK(ok == fits);
+		FUZZ_CHECK(bb.overflow == !fits);
+		if (!fits) {
+			refoverflow = true;
+			free(tofree);
+			continue;
+		}
+		switch (o->op) {
+			case OP_BITS: ref_put(&ref, o->x, o->nbits); break;
+			case OP_BYTE: ref_put(&ref, o->x, 8); break;
+			case OP_BUF: case OP_STR:
+				for (uint i = 0; i < need / 8; ++i) ref_put(&ref, src[i], 8);
+				// keep a copy to compare against when reading back
+				o->data = malloc(need / 8 + 1);
+				FUZZ_CHECK(o->data);
+				memcpy(o->data, src, need / 8);
+				break;
+			case OP_UBITVAR: ref_putubitvar(&ref, o->x); break;
+			case OP_VARINT32: ref_putvarint32(&ref, o->x); break;
+			case OP_SVARINT32:
+				ref_putvarint32(&ref, o->x << 1 ^ (uint)((int)o->x >> 31));
+				break;
+			default: ref_put(&ref, 0, need);
+		}
+		free(tofree);
+		FUZZ_CHECK(bb.curbit == ref.nbits);
+		++nops;
+	}
+
+	// compare every bit written so far (ignoring whatever's past the end)
+	const uchar *out = (const uchar *)cells;
+	for (uint i = 0; i < ref.nbits >> 3; ++i) FUZZ_CHECK(out[i] == refbuf[i]);
+	if (ref.nbits & 7) {
+		uchar mask = (1 << (ref.nbits & 7)) - 1;
+		FUZZ_CHECK((out[ref.nbits >> 3] & mask) ==
+				(refbuf[ref.nbits >> 3] & mask));
+	}
+
+	// then read it all back
+	struct bitbuf_reader r;
+	bitbuf_initreader(&r, cells, (ref.nbits + 7) >> 3);
+	r.nbits = ref.nbits;
+	for (int i = 0; i < nops; ++i) {
+		struct fuzz_op *o = ops + i;
+		switch (o->op) {
+			case OP_BITS:
+				FUZZ_CHECK(bitbuf_readbits(&r, o->nbits) == o->x);
+				break;
+			case OP_BYTE: FUZZ_CHECK(bitbuf_readbyte(&r) == o->x); break;
+			case OP_BUF: {
+				uchar *tmp = malloc(o->x + 1);
+				FUZZ_CHECK(tmp);
+				bitbuf_readbuf(&r, tmp, o->x);
+				FUZZ_CHECK(!memcmp(tmp, o->data, o->x));
+				free(tmp);
+				break;
+			}
+			case OP_STR: {
+				char tmp[48];
+				FUZZ_CHECK(bitbuf_readstring(&r, tmp, sizeof(tmp)));
+				FUZZ_CHECK(!strcmp(tmp, (const char *)o->data));
+				break;
+			}
+			case OP_UBITVAR: FUZZ_CHECK(bitbuf_readubitvar(&r) == o->x); break;
+			case OP_VARINT32:
+				FUZZ_CHECK(bitbuf_readvarint32(&r) == o->x);
+				break;
+			case OP_SVARINT32:
+				FUZZ_CHECK(bitbuf_readsvarint32(&r) == (int)o->x);
+				break;
+			default: bitbuf_seek(&r, (r.curbit + 7) & ~7u);
+		}
+		FUZZ_CHECK(!r.overflow);
+		free(o->data);
+	}
+	FUZZ_CHECK(r.curbit == ref.nbits);
+	bitbuf_readbool(&r);
+	FUZZ_CHECK(r.overflow);
+
+	free(refbuf);
+	free(cells);
+	return 0;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
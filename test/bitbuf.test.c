@@ -4,6 +4,8 @@
 
 #include "../src/bitbuf.h"
 #include "../src/intdefs.h"
+#include "../src/langext.h"
+#include "bitbuf.fuzz.c"
 
 #include <stdio.h>
 #include <string.h>
@@ -14,21 +16,44 @@ static union {
 } bb_buf;
 static struct bitbuf bb = {bb_buf.buf, 512, 512 * 8, 0, false, false, "test"};
 
-TEST("The possible UB in bitbuf_appendbuf shouldn't trigger horrible bugs") {
-	if (bitbuf_align <= 1) { // *shouldn't* happen
-		fputs("what's going on with the alignment???\n", stderr);
-		return false;
-	}
-	char _buf[32 + _Alignof(bitbuf_cell)], *buf = _buf;
-	while (!((usize)buf % bitbuf_align)) ++buf;
+static inline int getbit(const void *buf, uint i) {
+	return ((const uchar *)buf)[i >> 3] >> (i & 7) & 1;
+}
 
-	memcpy(buf, "Misaligned test buffer contents!", 32);
-	bitbuf_appendbuf(&bb, buf, 32);
-	return !memcmp(bb.buf, buf, 32);
+TEST("Appending a buffer should work at any alignment") {
+	uchar src[160 + 8];
+	for (int i = 0; i < countof(src); ++i) src[i] = i * 37 + 11;
+	// bit offsets in the destination, alignments of the source and lengths
+	// that cover the unshifted, scalar and vector paths and their tails
+	for (uint off = 0; off < 17; ++off) {
+		for (int misalign = 0; misalign < 8; misalign += 3) {
+			for (uint len = 0; len < 160; ++len) {
+				const uchar *p = src + misalign;
+				bitbuf_reset(&bb);
+				bitbuf_appendbits(&bb, 0x1FFFF >> (17 - off), off);
+				bitbuf_appendbuf(&bb, (const char *)p, len);
+				bitbuf_appendbits(&bb, 0x15, 5); // shouldn't get clobbered
+				if (bb.curbit != off + len * 8 + 5) return false;
+				for (uint i = 0; i < off; ++i) {
+					if (!getbit(bb.buf, i)) return false;
+				}
+				for (uint i = 0; i < len * 8; ++i) {
+					if (getbit(bb.buf, off + i) != getbit(p, i)) return false;
+				}
+				for (uint i = 0; i < 5; ++i) {
+					if (getbit(bb.buf, off + len * 8 + i) != (0x15 >> i & 1)) {
+						return false;
+					}
+				}
+			}
+		}
+	}
+	return true;
 }
 
 TEST("Aligning to the next byte should work as intended") {
-	for (int i = 0; i < 65535; i += 8) {
+	// (stay a cell short of the end, since rounding up writes to the buffer)
+	for (int i = 0; i < 512 * 8 - bitbuf_cell_bits; i += 8) {
 		bb.curbit = i;
 		bitbuf_roundup(&bb);
 		if (bb.curbit != i) return false; // don't round if already rounded
@@ -41,4 +66,241 @@ TEST("Aligning to the next byte should work as intended") {
 	return true;
 }
 
+static struct bitbuf_reader rd;
+
+static void startread(void) {
+	bitbuf_initreader(&rd, bb.buf, (bb.curbit + 7) >> 3);
+	rd.nbits = bb.curbit;
+}
+
+TEST("Reading back appended bits should give the same values") {
+	bitbuf_reset(&bb);
+	uint seed = 1;
+	// every width, at every alignment within a cell (and then some)
+	for (int i = 0; i < 200; ++i) {
+		int nbits = i % 32 + 1;
+		seed = seed * 1103515245 + 12345;
+		bitbuf_appendbits(&bb, seed >> (32 - nbits), nbits);
+	}
+	startread();
+	seed = 1;
+	for (int i = 0; i < 200; ++i) {
+		int nbits = i % 32 + 1;
+		seed = seed * 1103515245 + 12345;
+		if (bitbuf_readbits(&rd, nbits) != seed >> (32 - nbits)) return false;
+	}
+	return rd.curbit == bb.curbit && !rd.overflow;
+}
+
+TEST("Reading back bytes, buffers and strings should work at any alignment") {
+	static const char str[] = "The quick brown fox jumps over the lazy dog";
+	for (int off = 0; off < 8; ++off) {
+		bitbuf_reset(&bb);
+		bitbuf_appendbits(&bb, 0, off);
+		bitbuf_appendbyte(&bb, 0xA5);
+		bitbuf_appendbuf(&bb, str + off, sizeof(str) - 1 - off);
+		bitbuf_appendstr(&bb, str);
+		bitbuf_appendbits(&bb, 1, 1);
+		startread();
+		bitbuf_skip(&rd, off);
+		if (bitbuf_readbyte(&rd) != 0xA5) return false;
+		char out[sizeof(str)];
+		bitbuf_readbuf(&rd, out, sizeof(str) - 1 - off);
+		if (memcmp(out, str + off, sizeof(str) - 1 - off)) return false;
+		if (!bitbuf_readstring(&rd, out, sizeof(out))) return false;
+		if (strcmp(out, str)) return false;
+		if (!bitbuf_readbool(&rd) || rd.overflow) return false;
+	}
+	return true;
+}
+
+TEST("Reading a string too long for the output should truncate it") {
+	bitbuf_reset(&bb);
+	bitbuf_appendbits(&bb, 0, 3);
+	bitbuf_appendstr(&bb, "truncated");
+	bitbuf_appendbyte(&bb, 'x');
+	startread();
+	bitbuf_seek(&rd, 3);
+	char out[6];
+	if (bitbuf_readstring(&rd, out, sizeof(out))) return false;
+	// the rest of the string should still have been consumed
+	return !strcmp(out, "trunc") && bitbuf_readbyte(&rd) == 'x';
+}
+
+TEST("Reading past the end should set overflow and not read out of bounds") {
+	static const uchar buf[3] = {0xFF, 0xFF, 0xFF};
+	bitbuf_initreader(&rd, buf, sizeof(buf));
+	if (bitbuf_readbits(&rd, 20) != 0xFFFFF || rd.overflow) return false;
+	if (bitbuf_readbits(&rd, 5) != 0 || !rd.overflow) return false;
+	if (rd.curbit != 24) return false;
+	char out[4];
+	rd.overflow = false; bitbuf_seek(&rd, 0);
+	if (bitbuf_readstring(&rd, out, sizeof(out)) || !rd.overflow) return false;
+	rd.overflow = false;
+	bitbuf_seek(&rd, 25);
+	return rd.overflow && rd.curbit == 24;
+}
+
+TEST("Reserving space should fail once the buffer is full, and stay failed") {
+	bitbuf_reset(&bb);
+	uint usable = 512 * 8 - bitbuf_cell_bits;
+	if (!bitbuf_reserve(&bb, usable) || bb.overflow) return false;
+	if (bitbuf_reserve(&bb, usable + 1) || !bb.overflow) return false;
+	// even a tiny reservation should now fail, until the buffer's reset
+	if (bitbuf_reserve(&bb, 1)) return false;
+	bitbuf_reset(&bb);
+	return bitbuf_reserve(&bb, 1) && !bb.overflow;
+}
+
+TEST("Checked appends should stop cleanly at the end of the buffer") {
+	bitbuf_reset(&bb);
+	uint usable = 512 * 8 - bitbuf_cell_bits, n = 0;
+	while (bitbuf_appendbits_checked(&bb, 0x5A5, 11)) ++n;
+	if (n != usable / 11 || bb.curbit != n * 11 || !bb.overflow) return false;
+	// nothing else should get appended, even if it'd fit
+	if (bitbuf_appendbits_checked(&bb, 1, 1) || bb.curbit != n * 11) {
+		return false;
+	}
+	bitbuf_reset(&bb);
+	n = 0;
+	while (bitbuf_appendstr_checked(&bb, "0123456")) ++n;
+	if (n != usable / 64 || bb.curbit != n * 64) return false;
+	bitbuf_reset(&bb);
+	bb.curbit = usable - 14;
+	// 0xFFF needs exactly 14 bits as a UBitVar; 0x1000 needs 34
+	if (bitbuf_appendubitvar_checked(&bb, 0x1000)) return false;
+	bb.overflow = false;
+	if (!bitbuf_appendubitvar_checked(&bb, 0xFFF)) return false;
+	bitbuf_reset(&bb);
+	bb.curbit = usable - 16;
+	// 0x3FFF is 2 bytes as a varint32; 0x4000 is 3
+	if (bitbuf_appendvarint32_checked(&bb, 0x4000)) return false;
+	bb.overflow = false;
+	return bitbuf_appendvarint32_checked(&bb, 0x3FFF) && bb.curbit == usable;
+}
+
+// Expected bytes for the following tests come from a straightforward bit-by-bit
+// transcription of the engine's bf_write code. Each starts 3 bits in, so as not
+// to only test the byte-aligned case.
+
+static bool checkbytes(const uchar *expect, uint nbits) {
+	if (bb.curbit != nbits) return false;
+	for (uint i = 0; i < (nbits + 7) >> 3; ++i) {
+		if ((uchar)bb.buf[i] != expect[i]) {
+			fprintf(stderr, "byte %u: got 0x%02X, expected 0x%02X\n", i,
+					(uchar)bb.buf[i], expect[i]);
+			return false;
+		}
+	}
+	startread();
+	bitbuf_skip(&rd, 3);
+	return true;
+}
+
+TEST("UBitVar encoding should match the engine") {
+	static const uchar expect[] = {
+		0xA0, 0x5A, 0x95, 0x57, 0xC7, 0xB3, 0xA2, 0x91, 0x00, 0x00
+	};
+	static const uint vals[] = {5, 0xAB, 0xABC, 0x12345678, 0};
+	bitbuf_reset(&bb);
+	bitbuf_appendbits(&bb, 0, 3);
+	for (int i = 0; i < countof(vals); ++i) bitbuf_appendubitvar(&bb, vals[i]);
+	if (!checkbytes(expect, 73)) return false;
+	for (int i = 0; i < countof(vals); ++i) {
+		if (bitbuf_readubitvar(&rd) != vals[i]) return false;
+	}
+	return rd.curbit == 73 && !rd.overflow;
+}
+
+TEST("varint32 encoding should match the engine") {
+	static const uchar expect[] = {
+		0x00, 0x08, 0xF8, 0x03, 0x0C, 0x60, 0x15, 0xF8, 0xFF, 0xFF, 0xFF, 0x7F,
+		0x08, 0x10, 0xF8, 0xFB, 0xFF, 0xFF, 0xFF, 0x7F, 0x00
+	};
+	static const uint uvals[] = {0, 1, 127, 128, 300, 0xFFFFFFFF};
+	static const int svals[] = {-1, 1, -64, -2147483647 - 1};
+	bitbuf_reset(&bb);
+	bitbuf_appendbits(&bb, 0, 3);
+	for (int i = 0; i < countof(uvals); ++i) {
+		bitbuf_appendvarint32(&bb, uvals[i]);
+	}
+	for (int i = 0; i < countof(svals); ++i) {
+		bitbuf_appendsvarint32(&bb, svals[i]);
+	}
+	if (!checkbytes(expect, 163)) return false;
+	for (int i = 0; i < countof(uvals); ++i) {
+		if (bitbuf_readvarint32(&rd) != uvals[i]) return false;
+	}
+	for (int i = 0; i < countof(svals); ++i) {
+		if (bitbuf_readsvarint32(&rd) != svals[i]) return false;
+	}
+	return rd.curbit == 163 && !rd.overflow;
+}
+
+TEST("BitCoord encoding should match the engine") {
+	static const uchar expect[] = {
+		0x60, 0x00, 0x00, 0x7C, 0x00, 0x80, 0x36, 0x06, 0x04, 0xC3, 0xF9, 0xFF,
+		0x1F
+	};
+	// all exactly representable, so they should come back out unchanged
+	static const float vals[] = {0, 1.5, -2.25, 100.03125, -0.5, 16383.96875};
+	bitbuf_reset(&bb);
+	bitbuf_appendbits(&bb, 0, 3);
+	for (int i = 0; i < countof(vals); ++i) bitbuf_appendcoord(&bb, vals[i]);
+	if (!checkbytes(expect, 101)) return false;
+	for (int i = 0; i < countof(vals); ++i) {
+		if (bitbuf_readcoord(&rd) != vals[i]) return false;
+	}
+	return rd.curbit == 101 && !rd.overflow;
+}
+
+TEST("BitNormal and BitAngle encoding should match the engine") {
+	static const uchar expect[] = {
+		0x00, 0x00, 0xFF, 0xFF, 0x7F, 0xFF, 0xFB, 0x1F, 0x20, 0xD2, 0x7F, 0x80,
+		0x01
+	};
+	static const float normals[] = {0, 1, -1, 0.5, -0.25};
+	static const struct { float deg; int nbits; } angles[] = {
+		{90, 8}, {359.5, 16}, {-90, 10}
+	};
+	bitbuf_reset(&bb);
+	bitbuf_appendbits(&bb, 0, 3);
+	for (int i = 0; i < countof(normals); ++i) {
+		bitbuf_appendnormal(&bb, normals[i]);
+	}
+	for (int i = 0; i < countof(angles); ++i) {
+		bitbuf_appendangle(&bb, angles[i].deg, angles[i].nbits);
+	}
+	if (!checkbytes(expect, 97)) return false;
+	for (int i = 0; i < countof(normals); ++i) {
+		// lossy, but should be within one step
+		float diff = bitbuf_readnormal(&rd) - normals[i];
+		if (diff > 1.0f / 2047 || diff < -1.0f / 2047) return false;
+	}
+	for (int i = 0; i < countof(angles); ++i) {
+		float deg = angles[i].deg < 0 ? angles[i].deg + 360 : angles[i].deg;
+		float diff = bitbuf_readangle(&rd, angles[i].nbits) - deg;
+		float step = 360.0f / (1 << angles[i].nbits);
+		if (diff > step || diff < -step) return false;
+	}
+	return rd.curbit == 97 && !rd.overflow;
+}
+
+TEST("Random appends should match a bit-by-bit reference implementation",
+		.timeout = 10000) {
+	// run the fuzzer entry point on random inputs of all sorts of sizes, which
+	// covers lots of random widths, alignments, buffer sizes and overflows
+	static uchar input[2048];
+	uvlong rng = 0x9E3779B97F4A7C15ull;
+	for (int i = 0; i < 2000; ++i) {
+		uint sz = 1 + i % sizeof(input);
+		for (uint j = 0; j < sz; ++j) {
+			rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+			input[j] = rng >> 24;
+		}
+		LLVMFuzzerTestOneInput(input, sz); // aborts on failure
+	}
+	return true;
+}
+
 // vi: sw=4 ts=4 noet tw=80 cc=80
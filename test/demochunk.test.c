@@ -0,0 +1,173 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "custom demo data chunking"};
+
+#include "../src/chunklets/lz.c"
+#include "../src/demochunk.c"
+
+#include <string.h>
+
+// each message the writer hands back, split into its header fields
+static struct msg {
+	int marker, len;
+	uchar data[DEMOCUSTOM_CHUNKSZ];
+} msgs[32];
+static int nmsgs;
+static bool badmsg;
+
+static void writemsg(struct bitbuf *msg) {
+	struct bitbuf_reader r;
+	bitbuf_initreader(&r, msg->buf, msg->curbit >> 3);
+	if (nmsgs == countof(msgs)) { badmsg = true; return; }
+	struct msg *m = msgs + nmsgs++;
+	if (bitbuf_readbits(&r, 6) != 23 || bitbuf_readbyte(&r) != 2) {
+		badmsg = true;
+	}
+	uint nbits = bitbuf_readbits(&r, 11);
+	if (bitbuf_readbyte(&r) != 0) badmsg = true;
+	m->marker = bitbuf_readbyte(&r);
+	uint off = (r.curbit + 7) >> 3;
+	m->len = (msg->curbit >> 3) - off;
+	if (r.overflow || nbits != m->len * 8 || m->len > DEMOCUSTOM_CHUNKSZ) {
+		badmsg = true;
+		return;
+	}
+	memcpy(m->data, msg->buf + off, m->len);
+}
+
+static struct demochunk_writer w = {
+	.write = &writemsg, .nbits_msgtype = 6, .nbits_datalen = 11
+};
+
+static uchar payload[1000];
+
+static unsigned long long rng = 0x9E3779B97F4A7C15ull;
+
+__attribute__((constructor(101)))
+static void init(void) {
+	// random, so it never compresses
+	for (int i = 0; i < sizeof(payload); ++i) {
+		rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+		payload[i] = rng >> 56;
+	}
+}
+
+static bool checkmsg(int i, int marker, const void *data, int len) {
+	return !badmsg && i < nmsgs && msgs[i].marker == marker &&
+			msgs[i].len == len && !memcmp(msgs[i].data, data, len);
+}
+
+#define M DEMOCUSTOM_MARKER
+#define LAST DEMOCUSTOM_LAST
+#define PACKED DEMOCUSTOM_PACKED
+#define COMPRESSED DEMOCUSTOM_COMPRESSED
+
+TEST("Small payloads should be packed together until a chunk is full") {
+	// 22 of these with their length bytes, plus 10 more bytes, is exactly full
+	for (int i = 0; i < 22; ++i) demochunk_write(&w, payload + i, 10);
+	demochunk_write(&w, payload, 9);
+	if (nmsgs) return false;
+	// one more byte doesn't fit, so out goes everything before it
+	demochunk_write(&w, payload, 0);
+	if (nmsgs != 1) return false;
+	uchar want[DEMOCUSTOM_CHUNKSZ], *p = want;
+	for (int i = 0; i < 22; ++i) {
+		*p++ = 10;
+		memcpy(p, payload + i, 10);
+		p += 10;
+	}
+	*p++ = 9;
+	memcpy(p, payload, 9);
+	return checkmsg(0, M | LAST | PACKED, want, sizeof(want));
+}
+
+TEST("A lone payload should be written without a length byte") {
+	demochunk_write(&w, payload, 5);
+	demochunk_flush(&w);
+	// the biggest payload that can still be held back, for that matter
+	demochunk_write(&w, payload, DEMOCUSTOM_CHUNKSZ - 1);
+	if (nmsgs != 1) return false;
+	demochunk_flush(&w);
+	return nmsgs == 2 && checkmsg(0, M | LAST, payload, 5) &&
+			checkmsg(1, M | LAST, payload, DEMOCUSTOM_CHUNKSZ - 1);
+}
+
+TEST("Big payloads should go straight out, after anything pending") {
+	demochunk_write(&w, payload, 3);
+	demochunk_write(&w, payload + 3, 4);
+	demochunk_write(&w, payload, 600);
+	// 600 = 252 + 252 + 96
+	if (nmsgs != 4) return false;
+	static const uchar packed[] = {3, 0, 0, 0, 4, 0, 0, 0, 0};
+	uchar want[sizeof(packed)];
+	memcpy(want, packed, sizeof(packed));
+	memcpy(want + 1, payload, 3);
+	memcpy(want + 5, payload + 3, 4);
+	if (!checkmsg(0, M | LAST | PACKED, want, sizeof(want))) return false;
+	if (!checkmsg(1, M, payload, DEMOCUSTOM_CHUNKSZ)) return false;
+	if (!checkmsg(2, M, payload + DEMOCUSTOM_CHUNKSZ, DEMOCUSTOM_CHUNKSZ)) {
+		return false;
+	}
+	if (!checkmsg(3, M | LAST, payload + 2 * DEMOCUSTOM_CHUNKSZ, 96)) {
+		return false;
+	}
+	// exactly a chunk is too big to be held back, but fits in one message
+	demochunk_write(&w, payload, DEMOCUSTOM_CHUNKSZ);
+	return nmsgs == 5 && checkmsg(4, M | LAST, payload, DEMOCUSTOM_CHUNKSZ);
+}
+
+TEST("Flushing should write out everything pending, just once") {
+	// democustom.c does this at the end of each frame and when a demo closes
+	demochunk_flush(&w);
+	if (nmsgs) return false;
+	demochunk_write(&w, payload, 1);
+	demochunk_write(&w, payload, 2);
+	demochunk_flush(&w);
+	demochunk_flush(&w);
+	static const uchar packed[] = {1, 0, 2, 0, 0};
+	uchar want[sizeof(packed)];
+	memcpy(want, packed, sizeof(packed));
+	want[1] = payload[0];
+	memcpy(want + 3, payload, 2);
+	return nmsgs == 1 && checkmsg(0, M | LAST | PACKED, want, sizeof(want));
+}
+
+TEST("Payloads should only be compressed when that makes them smaller") {
+	static uchar zeros[500];
+	uchar lz[LZ_MAXSZ(sizeof(zeros))];
+	w.compress = true;
+	demochunk_write(&w, payload, 100); // random: doesn't help
+	demochunk_flush(&w);
+	demochunk_write(&w, zeros, 20); // too small to bother with
+	demochunk_flush(&w);
+	demochunk_write(&w, zeros, sizeof(zeros));
+	int n = lz_compress(lz, zeros, sizeof(zeros));
+	if (!checkmsg(0, M | LAST, payload, 100)) return false;
+	if (!checkmsg(1, M | LAST, zeros, 20)) return false;
+	if (!checkmsg(2, M | LAST | COMPRESSED, lz, n)) return false;
+	// and nothing gets compressed if it's been turned off
+	w.compress = false;
+	demochunk_write(&w, zeros, sizeof(zeros));
+	return nmsgs == 5 && checkmsg(3, M, zeros, DEMOCUSTOM_CHUNKSZ);
+}
+
+TEST("Raw payloads should never be compressed") {
+	static uchar zeros[500];
+	w.compress = true;
+	// zeros would compress fine, but we've been told not to bother
+	demochunk_write_raw(&w, zeros, sizeof(zeros));
+	if (nmsgs != 2 || !checkmsg(0, M, zeros, DEMOCUSTOM_CHUNKSZ)) return false;
+	for (int i = 0; i < 5; ++i) demochunk_write_raw(&w, zeros, 30);
+	demochunk_flush(&w);
+	if (nmsgs != 3 || msgs[2].marker != (M | LAST | PACKED)) return false;
+	demochunk_write_raw(&w, zeros, 100);
+	demochunk_flush(&w);
+	if (nmsgs != 4 || !checkmsg(3, M | LAST, zeros, 100)) return false;
+	// packed in with something that isn't raw, it's still worth a try
+	demochunk_write_raw(&w, zeros, 10);
+	demochunk_write(&w, zeros, 100);
+	demochunk_flush(&w);
+	return nmsgs == 5 && msgs[4].marker == (M | LAST | PACKED | COMPRESSED);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,250 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "custom data extraction from demos"};
+
+#include "../src/chunklets/lz.c"
+#include "../src/demochunk.c"
+#include "../src/democustom.h"
+#include "../src/demoextract.c"
+#include "../src/demofile.c"
+
+#include <string.h>
+
+#include "fakedemo.h"
+
+static uchar payload[1000];
+
+__attribute__((constructor(101)))
+static void init(void) {
+	for (int i = 0; i < sizeof(payload); ++i) payload[i] = i * 13 + 5;
+}
+
+// custom data is written by the same code democustom.c uses, into the packets
+// of our fake demo, all at whatever tick is current
+static int curtick;
+
+static void writemsg(struct bitbuf *msg) {
+	putpacket(DEMO_CMD_PACKET, curtick, 0, msg->buf, msg->curbit >> 3);
+}
+
+static struct demochunk_writer writer = {
+	.write = &writemsg, .nbits_msgtype = 6
+};
+
+// the length field size depends on the engine build, not the protocol, so it's
+// given separately
+static void startdemo(int demover, int netver, int nbits) {
+	puthdr(demover, netver);
+	writer.nbits_datalen = nbits;
+}
+
+static void putchunk(int tick, const uchar *p, int len, int marker) {
+	curtick = tick;
+	demochunk_writechunk(&writer, p, len, marker);
+}
+
+// a frame's worth of custom data, written all at once
+static void putframe(int tick, const int *lens, int n) {
+	curtick = tick;
+	for (int i = 0; i < n; ++i) demochunk_write(&writer, payload + i, lens[i]);
+	demochunk_flush(&writer);
+}
+
+static void putcustom(int tick, const uchar *p, int len) {
+	curtick = tick;
+	demochunk_write(&writer, p, len);
+	demochunk_flush(&writer);
+}
+
+static bool checkdemo(void) {
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload pl;
+	bool ret = false;
+	if (!demoextract_next(&x, &pl)) goto e;
+	// small payloads should be returned in place
+	if (pl.data < demo.buf || pl.data >= demo.buf + demosz) goto e;
+	if (pl.len != 10 || memcmp(pl.data, payload, 10) || pl.tick != 1) goto e;
+	if (!demoextract_next(&x, &pl)) goto e;
+	if (pl.len != 0 || pl.tick != 2) goto e;
+	// an exact multiple of the chunk size, and then something bigger
+	if (!demoextract_next(&x, &pl)) goto e;
+	if (pl.len != DEMOCUSTOM_CHUNKSZ * 2 || pl.tick != 3) goto e;
+	if (memcmp(pl.data, payload, pl.len)) goto e;
+	if (!demoextract_next(&x, &pl)) goto e;
+	if (pl.len != sizeof(payload) || pl.tick != 4) goto e;
+	if (memcmp(pl.data, payload, pl.len)) goto e;
+	ret = !demoextract_next(&x, &pl) && !x.err;
+e:	demoextract_free(&x);
+	return ret;
+}
+
+static void putdemo(int demover, int netver, int nbits) {
+	startdemo(demover, netver, nbits);
+	// some packets that aren't ours, including one that gets quite close
+	uchar junk[64] = {0};
+	putpacket(DEMO_CMD_PACKET, 0, 0, junk, sizeof(junk));
+	junk[0] = 23;
+	putpacket(DEMO_CMD_PACKET, 0, 0, junk, sizeof(junk));
+	putcustom(1, payload, 10);
+	putcustom(2, payload, 0);
+	putcustom(3, payload, DEMOCUSTOM_CHUNKSZ * 2);
+	putcustom(4, payload, sizeof(payload));
+}
+
+TEST("Payloads should be extracted from Portal demos") {
+	putdemo(3, 15, 12);
+	return checkdemo();
+}
+
+TEST("Payloads should be extracted from 2013-branch demos") {
+	// netver 24 is used by builds on either side of the length field change
+	putdemo(3, 24, 12);
+	if (!checkdemo()) return false;
+	putdemo(3, 24, 11);
+	return checkdemo();
+}
+
+TEST("Payloads should be extracted from Portal 2 demos") {
+	putdemo(4, 2001, 11);
+	return checkdemo();
+}
+
+TEST("Payloads should be extracted from L4D2 demos") {
+	putdemo(4, 2042, 11);
+	return checkdemo();
+}
+
+TEST("Packed payloads should be split back up") {
+	static const int lens[] = {3, 0, 100, 1};
+	startdemo(4, 2001, 11);
+	putcustom(1, payload, 10);
+	putframe(2, lens, countof(lens));
+	putcustom(3, payload, 600);
+	putframe(4, lens, 2);
+
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload pl;
+	bool ret = false;
+	if (!demoextract_next(&x, &pl) || pl.len != 10 || pl.tick != 1) goto e;
+	for (int i = 0; i < countof(lens); ++i) {
+		if (!demoextract_next(&x, &pl) || pl.tick != 2) goto e;
+		if (pl.len != lens[i] || memcmp(pl.data, payload + i, lens[i])) {
+			goto e;
+		}
+		// these should all be in place as well
+		if (pl.data < demo.buf || pl.data >= demo.buf + demosz) goto e;
+	}
+	if (!demoextract_next(&x, &pl) || pl.len != 600 || pl.tick != 3) goto e;
+	if (memcmp(pl.data, payload, 600)) goto e;
+	for (int i = 0; i < 2; ++i) {
+		if (!demoextract_next(&x, &pl) || pl.tick != 4) goto e;
+		if (pl.len != lens[i] || memcmp(pl.data, payload + i, lens[i])) {
+			goto e;
+		}
+	}
+	ret = !demoextract_next(&x, &pl) && !x.err;
+e:	demoextract_free(&x);
+	return ret;
+}
+
+TEST("Compressed payloads should be decompressed") {
+	// something compressible, big enough to need a few chunks when compressed
+	static uchar big[4000];
+	for (int i = 0; i < sizeof(big); ++i) big[i] = i % 7 * i % 23 + i % 5;
+	startdemo(4, 2042, 11);
+	writer.compress = true;
+	putcustom(1, big, sizeof(big));
+	// should have shrunk, but still needed a few chunks
+	if (demosz >= sizeof(big) ||
+			demosz <= sizeof(struct demo_hdr) + 2 * DEMOCUSTOM_CHUNKSZ) {
+		return false;
+	}
+	// and a compressed packed chunk
+	curtick = 2;
+	for (int i = 0; i < 10; ++i) demochunk_write(&writer, payload, 19);
+	demochunk_flush(&writer);
+	putcustom(3, payload, 10);
+
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload pl;
+	bool ret = false;
+	if (!demoextract_next(&x, &pl) || pl.len != sizeof(big)) goto e;
+	if (pl.tick != 1 || memcmp(pl.data, big, sizeof(big))) goto e;
+	for (int i = 0; i < 10; ++i) {
+		if (!demoextract_next(&x, &pl) || pl.tick != 2) goto e;
+		if (pl.len != 19 || memcmp(pl.data, payload, 19)) goto e;
+		// coming from the decompression buffer, so they were compressed
+		if (pl.data >= demo.buf && pl.data < demo.buf + demosz) goto e;
+	}
+	if (!demoextract_next(&x, &pl) || pl.tick != 3 || pl.len != 10) goto e;
+	ret = !demoextract_next(&x, &pl) && !x.err;
+e:	demoextract_free(&x);
+	return ret;
+}
+
+TEST("Corrupt compressed payloads should be caught") {
+	uchar lz[LZ_MAXSZ(sizeof(payload))];
+	int n = lz_compress(lz, payload, 100);
+	--n; // chop off the end
+	startdemo(4, 2001, 11);
+	putchunk(1, lz, n, DEMOCUSTOM_MARKER | DEMOCUSTOM_LAST |
+			DEMOCUSTOM_COMPRESSED);
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload pl;
+	bool ok = !demoextract_next(&x, &pl) && x.err;
+	demoextract_free(&x);
+	return ok;
+}
+
+TEST("Malformed packed chunks should be caught") {
+	static const int lens[] = {3, 4};
+	startdemo(4, 2001, 11);
+	putframe(1, lens, 2);
+	// make the last length run off the end of the chunk
+	demo.buf[demosz - 5] = 5;
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload pl;
+	bool ok = demoextract_next(&x, &pl) && pl.len == 3 &&
+			!demoextract_next(&x, &pl) && x.err;
+	demoextract_free(&x);
+	return ok;
+}
+
+TEST("Incomplete payloads should be caught") {
+	startdemo(4, 2001, 11);
+	putchunk(1, payload, DEMOCUSTOM_CHUNKSZ, DEMOCUSTOM_MARKER);
+	struct demofile df;
+	struct demoextract x;
+	struct demoextract_payload pl;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	demoextract_init(&x, &df);
+	bool ok = !demoextract_next(&x, &pl) && x.err;
+	demoextract_free(&x);
+	if (!ok) return false;
+
+	// a short chunk that isn't the last one
+	putchunk(1, payload, 10, DEMOCUSTOM_MARKER);
+	putchunk(1, payload, 10, DEMOCUSTOM_MARKER + DEMOCUSTOM_LAST);
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	demoextract_init(&x, &df);
+	ok = !demoextract_next(&x, &pl) && x.err;
+	demoextract_free(&x);
+	return ok;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,148 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "the demo file parser"};
+
+#include "../src/demofile.c"
+
+#include "fakedemo.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static bool checkdata(const struct demofile_cmd *cmd, const char *data) {
+	return cmd->len == strlen(data) && !memcmp(cmd->data, data, cmd->len);
+}
+
+TEST("Protocol 3 demos should be parsed") {
+	puthdr(3, 15);
+	putpacket(DEMO_CMD_SIGNON, 0, 0, "sign", 4);
+	putcmd(DEMO_CMD_SYNC, 0, 0);
+	putpacket(DEMO_CMD_PACKET, 1, 0, "pkt", 3);
+	putsized(DEMO_CMD_CONCMD, 2, 0, "jump", 4);
+	putcmd(DEMO_CMD_USERCMD, 3, 0); put32(77); put32(0);
+	putsized(DEMO_CMD_STRINGTABLES14, 4, 0, "tables", 6);
+	putstop(5);
+	put8(0xFF); // junk after the stop command should be ignored
+
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	if (df.proto != DEMO_PROTO_PORTAL_5135) return false;
+	if (df.playerslot || df.customdata) return false;
+	if (df.cmdinfosz != DEMO_CMDINFO_SZ) return false;
+	struct demofile_cmd cmd;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_SIGNON) return false;
+	if (cmd.off != sizeof(struct demo_hdr)) return false;
+	if (!cmd.cmdinfo || cmd.cmdinfo[75] != 75) return false;
+	if (cmd.seqin != 100 || cmd.seqout != 200) return false;
+	if (!checkdata(&cmd, "sign")) return false;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_SYNC) return false;
+	if (cmd.data || cmd.len) return false;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_PACKET) return false;
+	if (cmd.tick != 1 || !checkdata(&cmd, "pkt")) return false;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_CONCMD) return false;
+	if (!checkdata(&cmd, "jump")) return false;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_USERCMD) return false;
+	if (cmd.arg != 77 || cmd.len != 0) return false;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != 8) return false;
+	if (strcmp(demofile_cmdname(&df, cmd.cmd), "stringtables")) return false;
+	if (!checkdata(&cmd, "tables")) return false;
+
+	if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_STOP) return false;
+	if (cmd.tick != 5) return false;
+	return !demofile_next(&df, &cmd) && !df.err;
+}
+
+TEST("Protocol 4 demos should be parsed") {
+	// Portal 2 has 2 splitscreen slots and L4D has 4
+	static const struct { int netver, proto, slots; } games[] = {
+		{2001, DEMO_PROTO_PORTAL2, 2},
+		{2000, DEMO_PROTO_L4D2000, 4},
+		{2042, DEMO_PROTO_L4D2042, 4}
+	};
+	for (int i = 0; i < countof(games); ++i) {
+		int cmdinfosz = DEMO_CMDINFO_SZ * games[i].slots;
+		puthdr(4, games[i].netver);
+		putpacket(DEMO_CMD_PACKET, 10, 1, "pkt", 3);
+		putcmd(DEMO_CMD_CUSTOMDATA, 11, 0); put32(3);
+		put32(5); put("hello", 5);
+		putsized(DEMO_CMD_STRINGTABLES36, 12, 0, "tables", 6);
+		// no stop command, as if the game crashed
+
+		struct demofile df;
+		if (!demofile_init(&df, demo.buf, demosz)) return false;
+		if (df.proto != games[i].proto) return false;
+		if (!df.playerslot || !df.customdata) return false;
+		if (df.cmdinfosz != cmdinfosz) return false;
+		struct demofile_cmd cmd;
+
+		if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_PACKET) {
+			return false;
+		}
+		if (cmd.tick != 10 || cmd.playerslot != 1) return false;
+		if (cmd.cmdinfo[cmdinfosz - 1] != (uchar)(cmdinfosz - 1)) return false;
+		if (cmd.seqin != 110 || !checkdata(&cmd, "pkt")) return false;
+
+		if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_CUSTOMDATA) {
+			return false;
+		}
+		if (cmd.arg != 3 || !checkdata(&cmd, "hello")) return false;
+
+		if (!demofile_next(&df, &cmd) || cmd.cmd != DEMO_CMD_STRINGTABLES36) {
+			return false;
+		}
+		if (!checkdata(&cmd, "tables")) return false;
+		if (demofile_next(&df, &cmd) || df.err) return false;
+	}
+	return true;
+}
+
+TEST("Truncated and corrupt demos should be caught") {
+	puthdr(4, 2001);
+	putpacket(DEMO_CMD_PACKET, 0, 0, "pkt", 3);
+	uint full = demosz;
+	struct demofile df;
+	struct demofile_cmd cmd;
+	// every possible cut-off point within the command should be caught
+	for (uint sz = sizeof(struct demo_hdr) + 1; sz < full; ++sz) {
+		// copy to an exact-sized buffer, so ASan can catch any over-reads
+		uchar *p = malloc(sz);
+		if (!p) return false;
+		memcpy(p, demo.buf, sz);
+		bool ok = demofile_init(&df, p, sz) && !demofile_next(&df, &cmd) &&
+				df.err;
+		free(p);
+		if (!ok) return false;
+	}
+	if (!demofile_init(&df, demo.buf, full)) return false;
+	if (!demofile_next(&df, &cmd) || demofile_next(&df, &cmd)) return false;
+	if (df.err) return false;
+
+	// a size that runs off the end, or is negative
+	putsized(DEMO_CMD_CONCMD, 0, 0, "x", 1);
+	demosz -= 5; put32(-1); put8('x');
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	if (!demofile_next(&df, &cmd)) return false;
+	if (demofile_next(&df, &cmd) || !df.err) return false;
+
+	// an unknown command type
+	demosz = full;
+	putcmd(42, 0, 0);
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	if (!demofile_next(&df, &cmd)) return false;
+	if (demofile_next(&df, &cmd) || !df.err) return false;
+
+	// and some things that aren't demos at all
+	if (demofile_init(&df, demo.buf, sizeof(struct demo_hdr) - 1)) return false;
+	demo.hdr.sig[0] = 'X';
+	if (demofile_init(&df, demo.buf, demosz)) return false;
+	puthdr(2, 7);
+	return !demofile_init(&df, demo.buf, demosz);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
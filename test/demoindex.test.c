@@ -0,0 +1,198 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "demo seek indices"};
+
+#include "../src/demofile.c"
+#include "../src/demoindex.c"
+
+#include <stdio.h>
+#include <string.h>
+
+#define FAKEDEMO_SZ 131072 // enough for putlongdemo()
+#include "fakedemo.h"
+
+static void putpkt(int tick) {
+	putpacket(DEMO_CMD_PACKET, tick, 0, "pkt", 3);
+}
+
+static void putconcmd(int tick) {
+	putsized(DEMO_CMD_CONCMD, tick, 0, "jump", 4);
+}
+
+// two commands on every tick from 0 to 999
+static void putlongdemo(void) {
+	puthdr(3, 15);
+	for (int tick = 0; tick < 1000; ++tick) {
+		putpkt(tick);
+		putconcmd(tick);
+	}
+	putstop(999);
+}
+
+static bool build(struct demoindex_builder *b, s32 interval) {
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) return false;
+	demoindex_initbuilder(b, interval);
+	return demoindex_build(b, &df);
+}
+
+// demoindex_init() wants the whole file in one aligned buffer, so put it back
+// together from the builder
+static union {
+	uchar buf[32768];
+	u64 _align;
+} idxfile;
+static uint idxsz;
+
+static bool flatten(const struct demoindex_builder *b) {
+	struct demoindex_hdr hdr = {
+		.demosz = demosz, .nentries = b->nentries, .interval = b->interval
+	};
+	memcpy(hdr.magic, DEMOINDEX_MAGIC, sizeof(hdr.magic));
+	idxsz = sizeof(hdr) + b->nentries * sizeof(*b->entries);
+	if (idxsz > sizeof(idxfile.buf)) return false;
+	memcpy(idxfile.buf, &hdr, sizeof(hdr));
+	memcpy(idxfile.buf + sizeof(hdr), b->entries,
+			b->nentries * sizeof(*b->entries));
+	return true;
+}
+
+TEST("Checkpoints should be made at each interval") {
+	putlongdemo();
+	struct demoindex_builder b;
+	if (!build(&b, 10)) return false;
+	bool ret = false;
+	if (b.nentries != 100) goto e;
+	for (uint i = 0; i < b.nentries; ++i) {
+		// always the first command of the tick, i.e. the packet
+		if (b.entries[i].tick != (s32)i * 10) goto e;
+		if (b.entries[i].cmd != DEMO_CMD_PACKET) goto e;
+		if (i && b.entries[i].off <= b.entries[i - 1].off) goto e;
+	}
+	if (b.entries[0].off != sizeof(struct demo_hdr)) goto e;
+	ret = true;
+e:	demoindex_freebuilder(&b);
+	return ret;
+}
+
+TEST("Gaps and backwards jumps in ticks should be handled") {
+	puthdr(3, 15);
+	putpkt(0);
+	putpkt(1);
+	putpkt(500); // gap: next checkpoint is the first command after
+	putpkt(3); // backwards: ignored so entries stay sorted
+	putpkt(505);
+	putpkt(510);
+	putstop(511);
+	struct demoindex_builder b;
+	if (!build(&b, 10)) return false;
+	bool ret = b.nentries == 3 && b.entries[0].tick == 0 &&
+			b.entries[1].tick == 500 && b.entries[2].tick == 510;
+	demoindex_freebuilder(&b);
+	return ret;
+}
+
+TEST("Lookups should find the latest checkpoint before a tick") {
+	putlongdemo();
+	struct demoindex_builder b;
+	if (!build(&b, 10)) return false;
+	bool ret = false;
+	if (!flatten(&b)) goto e;
+	struct demoindex idx;
+	if (!demoindex_init(&idx, idxfile.buf, idxsz)) goto e;
+	if (demoindex_find(&idx, -1)) goto e;
+	const struct demoindex_entry *ent = demoindex_find(&idx, 0);
+	if (!ent || ent->tick != 0) goto e;
+	if (!(ent = demoindex_find(&idx, 15)) || ent->tick != 10) goto e;
+	if (!(ent = demoindex_find(&idx, 20)) || ent->tick != 20) goto e;
+	if (!(ent = demoindex_find(&idx, 99999)) || ent->tick != 990) goto e;
+	ret = true;
+e:	demoindex_freebuilder(&b);
+	return ret;
+}
+
+TEST("Seeking should land close to the wanted tick") {
+	putlongdemo();
+	struct demoindex_builder b;
+	if (!build(&b, 10)) return false;
+	bool ret = false;
+	if (!flatten(&b)) goto e;
+	struct demoindex idx;
+	if (!demoindex_init(&idx, idxfile.buf, idxsz)) goto e;
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) goto e;
+	// find where tick 777 really is with a full scan first
+	struct demofile_cmd cmd;
+	usize want = 0;
+	while (demofile_next(&df, &cmd)) {
+		if (cmd.tick == 777) { want = cmd.off; break; }
+	}
+	if (!want) goto e;
+	if (!demoindex_seek(&idx, &df, 777)) goto e;
+	int n = 0;
+	do {
+		if (!demofile_next(&df, &cmd)) goto e;
+		++n;
+	} while (cmd.tick < 777);
+	// 770 to 776 is 7 ticks of 2 commands, then the one we want
+	if (cmd.off != want || n != 15) goto e;
+	// seeking before the first checkpoint should go back to the start
+	if (!demoindex_seek(&idx, &df, -5)) goto e;
+	if (!demofile_next(&df, &cmd) || cmd.off != sizeof(struct demo_hdr)) {
+		goto e;
+	}
+	ret = true;
+e:	demoindex_freebuilder(&b);
+	return ret;
+}
+
+TEST("Index files should be saved and loaded") {
+	putlongdemo();
+	struct demoindex_builder b;
+	if (!build(&b, 66)) return false;
+	bool ret = false;
+	const char *path = ".build/demoindex.test.idx";
+	if (!demoindex_save(&b, path, demosz)) goto e;
+	struct demoindex idx;
+	if (!demoindex_load(&idx, path)) goto e;
+	if (idx.hdr->nentries != b.nentries || idx.hdr->interval != 66) goto f;
+	if (memcmp(idx.entries, b.entries, b.nentries * sizeof(*b.entries))) {
+		goto f;
+	}
+	struct demofile df;
+	if (!demofile_init(&df, demo.buf, demosz)) goto f;
+	if (!demoindex_seek(&idx, &df, 500)) goto f;
+	struct demofile_cmd cmd;
+	if (!demofile_next(&df, &cmd) || cmd.tick != 462) goto f;
+	ret = true;
+f:	demoindex_free(&idx);
+e:	remove(path);
+	demoindex_freebuilder(&b);
+	return ret;
+}
+
+TEST("Stale and invalid indices should be rejected") {
+	putlongdemo();
+	struct demoindex_builder b;
+	if (!build(&b, 10)) return false;
+	bool ret = false;
+	if (!flatten(&b)) goto e;
+	struct demoindex idx;
+	// the demo has since grown, so the offsets can't be trusted
+	struct demofile df;
+	putstop(1001);
+	if (!demofile_init(&df, demo.buf, demosz)) goto e;
+	if (!demoindex_init(&idx, idxfile.buf, idxsz)) goto e;
+	const uchar *cur = df.cur;
+	if (demoindex_seek(&idx, &df, 500) || df.cur != cur) goto e;
+	if (demoindex_init(&idx, idxfile.buf, idxsz - 1)) goto e;
+	if (demoindex_init(&idx, idxfile.buf, 10)) goto e;
+	idxfile.buf[0] = 'X';
+	if (demoindex_init(&idx, idxfile.buf, idxsz)) goto e;
+	if (demoindex_load(&idx, ".build/nonexistent.idx")) goto e;
+	ret = true;
+e:	demoindex_freebuilder(&b);
+	return ret;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,70 @@
+/* This file is dedicated to the public domain. */
+
+#ifndef INC_TEST_FAKEDEMO_H
+#define INC_TEST_FAKEDEMO_H
+
+// Builds up fake demos in memory, with just enough in them to exercise the
+// framing for each protocol. Include after demofile.c. Define FAKEDEMO_SZ first
+// if the tests need a bigger buffer than the default.
+
+#include <string.h>
+
+#ifndef FAKEDEMO_SZ
+#define FAKEDEMO_SZ 16384
+#endif
+
+static union {
+	uchar buf[FAKEDEMO_SZ];
+	struct demo_hdr hdr; // for alignment
+} demo;
+static uint demosz;
+static bool demohasslot; // protocol 4 has a player slot byte in every command
+static int democmdinfosz;
+
+static inline void put(const void *p, uint sz) {
+	memcpy(demo.buf + demosz, p, sz);
+	demosz += sz;
+}
+static inline void put8(uchar x) { put(&x, 1); }
+static inline void put32(s32 x) { put(&x, 4); }
+
+// starts a new demo, throwing away whatever was there before
+static inline void puthdr(int demover, int netver) {
+	memset(&demo.hdr, 0, sizeof(demo.hdr));
+	memcpy(demo.hdr.sig, "HL2DEMO", 8);
+	demo.hdr.demover = demover;
+	demo.hdr.netver = netver;
+	demosz = sizeof(demo.hdr);
+	demohasslot = demover >= 4;
+	// one per splitscreen player: Portal 2 has 2 and L4D has 4
+	democmdinfosz = DEMO_CMDINFO_SZ *
+			(demover < 4 ? 1 : netver == 2001 ? 2 : 4);
+}
+
+static inline void putcmd(int cmd, int tick, int slot) {
+	put8(cmd);
+	put32(tick);
+	if (demohasslot) put8(slot);
+}
+
+// the command info is filled with its own offsets, and the sequence numbers
+// are 100 and 200 more than the tick, so that tests can tell them all apart
+static inline void putpacket(int cmd, int tick, int slot, const void *data,
+		uint len) {
+	putcmd(cmd, tick, slot);
+	for (int i = 0; i < democmdinfosz; ++i) put8(i);
+	put32(100 + tick); put32(200 + tick);
+	put32(len); put(data, len);
+}
+
+static inline void putsized(int cmd, int tick, int slot, const void *data,
+		uint len) {
+	putcmd(cmd, tick, slot);
+	put32(len); put(data, len);
+}
+
+static inline void putstop(int tick) { putcmd(DEMO_CMD_STOP, tick, 0); }
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,204 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "fastspin"};
+
+// Multi-threaded lock and event benchmarks, with pthreads equivalents to
+// compare against. This needs pthreads, so it's for Linux (and other Unixes)
+// only, for now.
+//
+// Each benchmark also doubles as a stress test: lock benchmarks check that no
+// increments of a shared counter went missing, and event benchmarks check for
+// lost wakeups by waiting with a timeout far longer than any wakeup should
+// take. Either failure prints an error and exits with a nonzero status.
+
+#include "../src/chunklets/cacheline.h"
+#include "../src/chunklets/fastspin.c"
+
+#include <pthread.h>
+#include <stdlib.h>
+
+// variant: 2threads -DTHREADS=2
+// variant: 8threads -DTHREADS=8
+
+#ifndef THREADS
+#define THREADS 4 // must be even, since the event benchmarks use pairs
+#endif
+#define OPS 10000 // per thread, per batch
+
+// Work done inside and outside the lock, in empty loop iterations. Outside work
+// is what sets the contention level: with none, threads hammer the lock back
+// to back; with more, they only occasionally collide.
+#ifndef WORK_INSIDE
+#define WORK_INSIDE 20
+#endif
+#ifndef WORK_LIGHT
+#define WORK_LIGHT 2000
+#endif
+#ifndef WORK_MODERATE
+#define WORK_MODERATE 200
+#endif
+
+static inline void work(int n) { for (volatile int i = 0; i < n; ++i); }
+
+static struct bench_hist hists[THREADS];
+
+static void runthreads(void *(*f)(void *)) {
+	pthread_t thr[THREADS];
+	for (int i = 0; i < THREADS; ++i) {
+		if (pthread_create(thr + i, 0, f, (void *)(long)i)) {
+			fprintf(stderr, "fastspin.bench: couldn't create thread\n");
+			exit(1);
+		}
+	}
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_join(thr[i], 0);
+		bench_hist_merge(hists + i);
+	}
+}
+
+static _Alignas(CACHELINE_FALSESHARE_SIZE) volatile int fslock;
+static _Alignas(CACHELINE_FALSESHARE_SIZE) pthread_mutex_t pmutex =
+		PTHREAD_MUTEX_INITIALIZER;
+static unsigned long long counter; // protected by whichever lock is in use
+
+// Measures the time taken to acquire the lock, which is what actually varies
+// with contention; the hold time is fixed.
+#define LOCKTHREAD(name, lock, unlock, outside) \
+	static void *name(void *param) { \
+		struct bench_hist *h = hists + (long)param; \
+		for (int i = 0; i < OPS; ++i) { \
+			unsigned long long t = bench_now(); \
+			lock; \
+			bench_hist_add(h, bench_now() - t); \
+			++counter; \
+			work(WORK_INSIDE); \
+			unlock; \
+			work(outside); \
+		} \
+		return 0; \
+	}
+
+#define LOCKBENCH(desc, thread) \
+	BENCH(desc, .ops = THREADS * OPS) { \
+		counter = 0; \
+		runthreads(&thread); \
+		if (counter != THREADS * OPS) { \
+			fprintf(stderr, "fastspin.bench: %s: lost %llu increments!\n", \
+					desc, THREADS * OPS - counter); \
+			exit(1); \
+		} \
+		return 0; \
+	}
+
+LOCKTHREAD(fsheavy, fastspin_lock(&fslock), fastspin_unlock(&fslock), 0)
+LOCKTHREAD(fsmoderate, fastspin_lock(&fslock), fastspin_unlock(&fslock),
+		WORK_MODERATE)
+LOCKTHREAD(fslight, fastspin_lock(&fslock), fastspin_unlock(&fslock),
+		WORK_LIGHT)
+LOCKTHREAD(pheavy, pthread_mutex_lock(&pmutex), pthread_mutex_unlock(&pmutex),
+		0)
+LOCKTHREAD(pmoderate, pthread_mutex_lock(&pmutex),
+		pthread_mutex_unlock(&pmutex), WORK_MODERATE)
+LOCKTHREAD(plight, pthread_mutex_lock(&pmutex), pthread_mutex_unlock(&pmutex),
+		WORK_LIGHT)
+
+LOCKBENCH("fastspin_lock, heavy contention", fsheavy)
+LOCKBENCH("pthread_mutex, heavy contention", pheavy)
+LOCKBENCH("fastspin_lock, moderate contention", fsmoderate)
+LOCKBENCH("pthread_mutex, moderate contention", pmoderate)
+LOCKBENCH("fastspin_lock, light contention", fslight)
+LOCKBENCH("pthread_mutex, light contention", plight)
+
+// Event benchmarks bounce between pairs of threads: the even thread of each
+// pair raises its partner's event and waits on its own, and the odd one does
+// the reverse. Each side resets its own event before raising the other's, so
+// no raise can ever be clobbered. Latency is the full round trip.
+
+#define LOSTWAKE_MS 1000 // no wakeup should ever take anywhere near this long
+
+static struct {
+	_Alignas(CACHELINE_FALSESHARE_SIZE) volatile int ev;
+	pthread_mutex_t mu;
+	pthread_cond_t cv;
+	int flag;
+} evs[THREADS];
+
+static _Atomic unsigned int lostwakes;
+
+static inline void fsraise(int i) { fastspin_raise(&evs[i].ev, 1); }
+static inline void fswait(int i) {
+	if (!fastspin_wait_timeout(&evs[i].ev, LOSTWAKE_MS)) {
+		++lostwakes;
+		return; // carry on, since we already know we're going to fail
+	}
+	evs[i].ev = 0;
+}
+
+static inline void praise(int i) {
+	pthread_mutex_lock(&evs[i].mu);
+	evs[i].flag = 1;
+	pthread_cond_signal(&evs[i].cv);
+	pthread_mutex_unlock(&evs[i].mu);
+}
+static inline void pwait(int i) {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += LOSTWAKE_MS / 1000; // near enough
+	pthread_mutex_lock(&evs[i].mu);
+	while (!evs[i].flag) {
+		if (pthread_cond_timedwait(&evs[i].cv, &evs[i].mu, &ts)) {
+			++lostwakes;
+			break;
+		}
+	}
+	evs[i].flag = 0;
+	pthread_mutex_unlock(&evs[i].mu);
+}
+
+#define EVTHREAD(name, raise, wait) \
+	static void *name(void *param) { \
+		int self = (long)param, other = self ^ 1; \
+		struct bench_hist *h = hists + self; \
+		if (self & 1) { \
+			for (int i = 0; i < OPS; ++i) { \
+				wait(self); \
+				raise(other); \
+			} \
+		} \
+		else { \
+			for (int i = 0; i < OPS; ++i) { \
+				unsigned long long t = bench_now(); \
+				raise(other); \
+				wait(self); \
+				bench_hist_add(h, bench_now() - t); \
+			} \
+		} \
+		return 0; \
+	}
+
+#define EVBENCH(desc, thread) \
+	BENCH(desc, .ops = THREADS / 2 * OPS) { \
+		runthreads(&thread); \
+		if (lostwakes) { \
+			fprintf(stderr, "fastspin.bench: %s: %u lost wakeups!\n", desc, \
+					lostwakes); \
+			exit(1); \
+		} \
+		return 0; \
+	}
+
+EVTHREAD(fsevents, fsraise, fswait)
+EVTHREAD(pevents, praise, pwait)
+
+EVBENCH("fastspin_raise/wait ping-pong", fsevents)
+EVBENCH("pthread_cond ping-pong", pevents)
+
+__attribute__((constructor(101)))
+static void init(void) {
+	for (int i = 0; i < THREADS; ++i) {
+		pthread_mutex_init(&evs[i].mu, 0);
+		pthread_cond_init(&evs[i].cv, 0);
+	}
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
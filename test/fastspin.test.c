@@ -0,0 +1,291 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "fastspin locks and events"};
+
+#include "../src/chunklets/fastspin.c"
+
+#include "thread.h"
+
+static int threadids[] = {0, 1, 2, 3, 4, 5, 6, 7};
+
+TEST("trylock should only succeed on a free lock") {
+	volatile int lock = 0;
+	if (!fastspin_trylock(&lock)) return false;
+	if (fastspin_trylock(&lock)) return false;
+	fastspin_unlock(&lock);
+	if (lock != 0) return false;
+	return fastspin_trylock(&lock);
+}
+
+TEST("Timed locks should give up on a held lock") {
+	volatile int lock = 0;
+	if (!fastspin_lock_timeout(&lock, 100)) return false;
+	unsigned long long t = nowms();
+	if (fastspin_lock_timeout(&lock, 100)) return false;
+	t = nowms() - t;
+	if (t < 100 || t > 500) return false;
+	// should still be unlockable, and then free
+	fastspin_unlock(&lock);
+	return lock == 0 && fastspin_lock_timeout(&lock, 0);
+}
+
+TEST("Timed waits should return 0 if nothing is raised") {
+	volatile int ev = 0;
+	unsigned long long t = nowms();
+	if (fastspin_wait_timeout(&ev, 100) != 0) return false;
+	t = nowms() - t;
+	if (t < 100 || t > 500) return false;
+	fastspin_raise(&ev, 5);
+	return fastspin_wait_timeout(&ev, 100) == 5 && fastspin_wait(&ev) == 5;
+}
+
+TEST("Reader/writer locks should allow many readers but one writer") {
+	volatile int rw = 0;
+	fastspin_rdlock(&rw);
+	fastspin_rdlock(&rw);
+	if (rw != 2) return false;
+	fastspin_rdunlock(&rw);
+	fastspin_rdunlock(&rw);
+	if (rw != 0) return false;
+	fastspin_wrlock(&rw);
+	if (rw != RW_WRLOCKED) return false;
+	fastspin_wrunlock(&rw);
+	return rw == 0;
+}
+
+// Torture test: every thread mostly reads and sometimes writes. Writers update
+// two counters in separate steps, so readers would see them differ if they ever
+// got in mid-write. Each side also keeps count of who's inside, so that overlap
+// is caught even when it doesn't happen to land mid-update.
+#define RW_THREADS 4
+#define RW_ITERS 20000
+
+static volatile int rwlock = 0, rwfail = 0;
+static _Atomic int rwreaders = 0, rwwriters = 0;
+static volatile int rwa = 0, rwb = 0;
+
+THREADFUNC(rwthread) {
+	int id = *(int *)param;
+	for (int i = 0; i < RW_ITERS; ++i) {
+		if ((i + id) % 8 == 0) {
+			fastspin_wrlock(&rwlock);
+			if (atomic_fetch_add(&rwwriters, 1) || atomic_load(&rwreaders)) {
+				rwfail = 1;
+			}
+			++rwa;
+			for (volatile int j = 0; j < 20; ++j); // widen the window a bit
+			++rwb;
+			atomic_fetch_sub(&rwwriters, 1);
+			fastspin_wrunlock(&rwlock);
+		}
+		else {
+			fastspin_rdlock(&rwlock);
+			atomic_fetch_add(&rwreaders, 1);
+			if (atomic_load(&rwwriters) || rwa != rwb) rwfail = 1;
+			atomic_fetch_sub(&rwreaders, 1);
+			fastspin_rdunlock(&rwlock);
+		}
+	}
+	return 0;
+}
+
+TEST("Reader/writer locks should exclude writers from everyone else",
+		.timeout = 30000) {
+	thread thr[RW_THREADS];
+	for (int i = 0; i < RW_THREADS; ++i) {
+		if (!startthread(thr + i, &rwthread, threadids + i)) return false;
+	}
+	for (int i = 0; i < RW_THREADS; ++i) jointhread(thr[i]);
+	// every write happened exactly once, and nothing's left held
+	return !rwfail && rwa == RW_THREADS * RW_ITERS / 8 && rwb == rwa &&
+			(rwlock & ~SLEEPFLAG) == 0;
+}
+
+static volatile int prefrw = 0;
+static _Atomic int prefwriterdone = 0, preflatereader = 0;
+
+THREADFUNC(prefwriter) {
+	fastspin_wrlock(&prefrw);
+	prefwriterdone = 1;
+	fastspin_wrunlock(&prefrw);
+	return 0;
+}
+
+THREADFUNC(prefreader) {
+	fastspin_rdlock(&prefrw);
+	// if the writer was made to wait for us, writer preference is broken
+	preflatereader = prefwriterdone ? 1 : 2;
+	fastspin_rdunlock(&prefrw);
+	return 0;
+}
+
+TEST("Waiting writers should hold off new readers", .timeout = 10000) {
+	fastspin_rdlock(&prefrw);
+	thread w, r;
+	if (!startthread(&w, &prefwriter, 0)) return false;
+	// once the writer's waiting, new readers should queue up behind it
+	EVENTUALLY(atomic_load((_Atomic int *)&prefrw) & RW_WRWAIT);
+	if (!startthread(&r, &prefreader, 0)) return false;
+	sleepms(50);
+	if (preflatereader || prefwriterdone) return false;
+	fastspin_rdunlock(&prefrw);
+	jointhread(w);
+	jointhread(r);
+	return prefwriterdone && preflatereader == 1;
+}
+
+TEST("Spin calibration should come up with a sane iteration count") {
+	int n = spinlimit(&n);
+	return n >= SPIN_MIN && n <= SPIN_MAX && spinlimit(&n) == n;
+}
+
+TEST("Latches should only let waiters through once counted down") {
+	volatile int latch = 2;
+	fastspin_latch_arrive(&latch);
+	if (latch != 1) return false;
+	fastspin_latch_arrive(&latch);
+	fastspin_latch_wait(&latch); // would hang if it hadn't reached zero
+	return latch == 0;
+}
+
+TEST("Barriers should reset themselves after each use") {
+	volatile int bar = 0;
+	// with one thread, every wait is the last arrival, so returns immediately
+	for (int i = 0; i < 3; ++i) {
+		if (!fastspin_barrier_wait(&bar, 1)) return false;
+	}
+	// count back at zero, generation bumped 3 times
+	return bar == 3 * BAR_GENONE;
+}
+
+TEST("Semaphores should hand out exactly as many units as were posted") {
+	volatile int sem = 1;
+	if (!fastspin_sem_trywait(&sem) || fastspin_sem_trywait(&sem)) return false;
+	fastspin_sem_post(&sem);
+	fastspin_sem_post(&sem);
+	fastspin_sem_wait(&sem);
+	if (sem != 1) return false;
+	fastspin_sem_wait(&sem);
+	return !fastspin_sem_trywait(&sem);
+}
+
+// Barrier torture: each thread counts itself in before every wait, so once
+// released, everyone from that round must have arrived. Exactly one thread per
+// round should be told it was last. Every so often, one thread dawdles, so that
+// everyone else runs out of spins and has to sleep in the OS.
+#define BAR_THREADS 4
+#define BAR_ROUNDS 5000
+#define BAR_DAWDLEEVERY 250
+
+static volatile int bar = 0, barfail = 0;
+static _Atomic int bararrived = 0, barlast[BAR_ROUNDS], barslept = 0;
+
+THREADFUNC(barthread) {
+	int id = *(int *)param;
+	for (int i = 0; i < BAR_ROUNDS; ++i) {
+		if (id == i / BAR_DAWDLEEVERY % BAR_THREADS &&
+				i % BAR_DAWDLEEVERY == 0) {
+			sleepms(5);
+			if (atomic_load((_Atomic int *)&bar) & SLEEPFLAG) {
+				atomic_fetch_add(&barslept, 1);
+			}
+		}
+		atomic_fetch_add(&bararrived, 1);
+		if (fastspin_barrier_wait(&bar, BAR_THREADS)) {
+			atomic_fetch_add(barlast + i, 1);
+		}
+		if (atomic_load(&bararrived) < (i + 1) * BAR_THREADS) barfail = 1;
+	}
+	return 0;
+}
+
+TEST("Barriers should hold every thread until all have arrived",
+		.timeout = 30000) {
+	thread thr[BAR_THREADS];
+	for (int i = 0; i < BAR_THREADS; ++i) {
+		if (!startthread(thr + i, &barthread, threadids + i)) return false;
+	}
+	for (int i = 0; i < BAR_THREADS; ++i) jointhread(thr[i]);
+	if (barfail || !barslept) return false;
+	for (int i = 0; i < BAR_ROUNDS; ++i) if (barlast[i] != 1) return false;
+	// count back at zero, generation bumped once per round
+	return bar == (BAR_ROUNDS * BAR_GENONE & BAR_GEN);
+}
+
+#define LATCH_WAITERS 4
+
+static volatile int latch = 3, latchdata = 0;
+static _Atomic int latchreleased = 0, latchfail = 0;
+
+THREADFUNC(latchwaiter) {
+	fastspin_latch_wait(&latch);
+	// everything done before the last arrival should be visible
+	if (latchdata != 3) latchfail = 1;
+	atomic_fetch_add(&latchreleased, 1);
+	return 0;
+}
+
+TEST("Latches should release every sleeping waiter at once",
+		.timeout = 10000) {
+	thread thr[LATCH_WAITERS];
+	for (int i = 0; i < LATCH_WAITERS; ++i) {
+		if (!startthread(thr + i, &latchwaiter, 0)) return false;
+	}
+	for (int i = 0; i < 3; ++i) {
+		// make sure the waiters have given up spinning and gone to sleep
+		EVENTUALLY(atomic_load((_Atomic int *)&latch) & SLEEPFLAG);
+		sleepms(10);
+		if (atomic_load(&latchreleased)) return false;
+		++latchdata;
+		fastspin_latch_arrive(&latch);
+	}
+	for (int i = 0; i < LATCH_WAITERS; ++i) jointhread(thr[i]);
+	return !latchfail && latchreleased == LATCH_WAITERS && latch == 0;
+}
+
+// Semaphore producers and consumers: consumers check that they never take more
+// than has been posted, and in the end everything posted has been taken once.
+#define SEM_PRODUCERS 2
+#define SEM_CONSUMERS 3
+#define SEM_UNITS 60000 // divisible by both of the above
+
+static volatile int sem = 0;
+static _Atomic int semposted = 0, semtaken = 0, semfail = 0;
+
+THREADFUNC(semproducer) {
+	for (int i = 0; i < SEM_UNITS / SEM_PRODUCERS; ++i) {
+		atomic_fetch_add(&semposted, 1);
+		fastspin_sem_post(&sem);
+		// let the consumers run dry and go back to sleep now and then
+		if (i % 5000 == 4999) sleepms(2);
+	}
+	return 0;
+}
+
+THREADFUNC(semconsumer) {
+	for (int i = 0; i < SEM_UNITS / SEM_CONSUMERS; ++i) {
+		fastspin_sem_wait(&sem);
+		if (atomic_fetch_add(&semtaken, 1) >= atomic_load(&semposted)) {
+			semfail = 1;
+		}
+	}
+	return 0;
+}
+
+TEST("Semaphores should conserve units across threads", .timeout = 30000) {
+	thread prod[SEM_PRODUCERS], cons[SEM_CONSUMERS];
+	for (int i = 0; i < SEM_CONSUMERS; ++i) {
+		if (!startthread(cons + i, &semconsumer, 0)) return false;
+	}
+	// nothing's been posted, so the consumers should end up asleep
+	EVENTUALLY(atomic_load((_Atomic int *)&sem) & SLEEPFLAG);
+	for (int i = 0; i < SEM_PRODUCERS; ++i) {
+		if (!startthread(prod + i, &semproducer, 0)) return false;
+	}
+	for (int i = 0; i < SEM_PRODUCERS; ++i) jointhread(prod[i]);
+	for (int i = 0; i < SEM_CONSUMERS; ++i) jointhread(cons[i]);
+	return !semfail && semtaken == SEM_UNITS && semposted == SEM_UNITS &&
+			(sem & SEM_COUNT) == 0 && !fastspin_sem_trywait(&sem);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
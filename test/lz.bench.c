@@ -0,0 +1,78 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "lz"};
+
+#include "../src/chunklets/lz.c"
+
+#include <stdio.h>
+
+#define N 64 // operations per batch
+#define FRAME 8 // records in a typical frame's worth of democustom data
+#define BIG 4096
+
+// msgpack records with the same keys every time, like real custom data, with
+// some values that change
+static const char rec[] =
+		"\x83\xA4" "type\x01\xA3" "key\xCD\x00\x00\xA4" "down\xC3";
+#define RECSZ (sizeof(rec) - 1)
+
+static unsigned char frame[FRAME * RECSZ], big[BIG], noise[BIG];
+static unsigned char out[LZ_MAXSZ(BIG)], back[BIG];
+static unsigned int framesz, bigsz, noisesz; // compressed sizes
+
+static unsigned long long rng = 0x9E3779B97F4A7C15ull;
+static unsigned int rand32(void) {
+	rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+	return rng >> 32;
+}
+
+static void fillrecs(unsigned char *p, unsigned int sz) {
+	for (unsigned int i = 0; i < sz; ++i) {
+		unsigned int j = i % RECSZ;
+		p[i] = j == 12 ? i / RECSZ : j == 13 ? rand32() & 3 : rec[j];
+	}
+}
+
+__attribute__((constructor(101)))
+static void init(void) {
+	fillrecs(frame, sizeof(frame));
+	fillrecs(big, sizeof(big));
+	for (int i = 0; i < sizeof(noise); ++i) noise[i] = rand32();
+	framesz = lz_compress(out, frame, sizeof(frame));
+	bigsz = lz_compress(out, big, sizeof(big));
+	noisesz = lz_compress(out, noise, sizeof(noise));
+	// the other half of the trade-off, which timings alone don't show
+	fprintf(stderr, "lz.bench: ratios: frame %u -> %u, records %u -> %u, "
+			"noise %u -> %u\n", (unsigned int)sizeof(frame), framesz,
+			BIG, bigsz, BIG, noisesz);
+}
+
+#define COMPRESS(desc, src) \
+	BENCH(desc, .ops = N) { \
+		for (int i = 0; i < N; ++i) { \
+			BENCH_USE(src); \
+			lz_compress(out, src, sizeof(src)); \
+			BENCH_USE(out); \
+		} \
+		return N * sizeof(src); \
+	}
+
+#define DECOMPRESS(desc, src, compsz) \
+	BENCH(desc, .ops = N) { \
+		lz_compress(out, src, sizeof(src)); \
+		for (int i = 0; i < N; ++i) { \
+			BENCH_USE(out); \
+			lz_decompress(back, sizeof(back), out, compsz); \
+			BENCH_USE(back); \
+		} \
+		return N * sizeof(src); \
+	}
+
+COMPRESS("compress, one frame of records", frame)
+COMPRESS("compress, 4096 bytes of records", big)
+COMPRESS("compress, 4096 bytes of noise", noise)
+DECOMPRESS("decompress, one frame of records", frame, framesz)
+DECOMPRESS("decompress, 4096 bytes of records", big, bigsz)
+DECOMPRESS("decompress, 4096 bytes of noise", noise, noisesz)
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
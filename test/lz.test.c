@@ -0,0 +1,95 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "LZ compression"};
+
+#include "../src/chunklets/lz.c"
+
+#include <stdlib.h>
+#include <string.h>
+
+static unsigned long long rng = 0x9E3779B97F4A7C15ull;
+static unsigned int rand32(void) {
+	rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+	return rng >> 32;
+}
+
+static unsigned char src[70000], comp[LZ_MAXSZ(sizeof(src))], dst[sizeof(src)];
+
+static bool roundtrip(unsigned int sz) {
+	unsigned int n = lz_compress(comp, src, sz);
+	if (n > LZ_MAXSZ(sz)) return false;
+	if (lz_decompressedsz(comp, n) != (int)sz) return false;
+	if (lz_decompress(dst, sz, comp, n) != (int)sz) return false;
+	if (memcmp(dst, src, sz)) return false;
+	// too small a buffer should be caught, not overrun
+	if (sz && lz_decompress(dst, sz - 1, comp, n) != -1) return false;
+	return true;
+}
+
+TEST("Random data should round-trip at any size", .timeout = 10000) {
+	for (unsigned int i = 0; i < sizeof(src); ++i) src[i] = rand32();
+	for (unsigned int sz = 0; sz < 300; ++sz) {
+		if (!roundtrip(sz)) return false;
+	}
+	return roundtrip(sizeof(src));
+}
+
+TEST("Repetitive data should round-trip and get smaller", .timeout = 10000) {
+	// records with the same keys every time, and some values changing
+	static const char rec[] =
+			"\x83\xA4" "type\x01\xA3" "key\xCD\x00\x00\xA4" "down\xC3";
+	unsigned int sz = 0;
+	for (int i = 0; sz + sizeof(rec) < sizeof(src); ++i) {
+		memcpy(src + sz, rec, sizeof(rec));
+		src[sz + 12] = i;
+		src[sz + 13] = rand32() & 3;
+		sz += sizeof(rec);
+	}
+	for (unsigned int n = 0; n < 600; n += 7) {
+		if (!roundtrip(n)) return false;
+	}
+	if (!roundtrip(sz)) return false;
+	// a handful of records is about the size of a frame's worth of data
+	if (lz_compress(comp, src, sizeof(rec) * 8) >= sizeof(rec) * 4) {
+		return false;
+	}
+	return lz_compress(comp, src, sz) < sz / 4;
+}
+
+TEST("Runs and overlapping matches should round-trip") {
+	for (unsigned int sz = 0; sz < 2000; sz += 13) {
+		memset(src, 'a', sz);
+		if (!roundtrip(sz)) return false;
+		for (unsigned int i = 0; i < sz; ++i) src[i] = "abc"[i % 3];
+		if (!roundtrip(sz)) return false;
+	}
+	return true;
+}
+
+TEST("Garbage should never be decompressed out of bounds", .timeout = 10000) {
+	for (int i = 0; i < 100000; ++i) {
+		unsigned int sz = rand32() % 64;
+		// exact-sized buffers, so ASan can catch anything out of bounds
+		unsigned char *in = malloc(sz ? sz : 1), *out = malloc(256);
+		if (!in || !out) return false;
+		for (unsigned int j = 0; j < sz; ++j) in[j] = rand32();
+		if (sz) in[0] &= 0x7F; // mostly plausible sizes, to get further in
+		int ret = lz_decompress(out, 256, in, sz);
+		free(in); free(out);
+		if (ret > 256) return false;
+	}
+	// and truncations of valid data should all be caught
+	for (unsigned int i = 0; i < 1000; ++i) src[i] = "hello world"[i % 11];
+	unsigned int n = lz_compress(comp, src, 1000);
+	for (unsigned int i = 0; i < n; ++i) {
+		unsigned char *in = malloc(i ? i : 1); // exact-sized again
+		if (!in) return false;
+		memcpy(in, comp, i);
+		int ret = lz_decompress(dst, 1000, in, i);
+		free(in);
+		if (ret != -1) return false;
+	}
+	return true;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
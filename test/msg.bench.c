@@ -0,0 +1,193 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "msg"};
+
+#include "../src/chunklets/msg.c"
+#include "../src/msgstruct.h"
+
+#include <string.h>
+
+// variant: bswap -DUSE_BSWAP_NONSENSE
+// variant: nobswap -DMSG_NO_BSWAP_NONSENSE
+
+// big enough that branch predictors can't just memorise the whole data set,
+// which they otherwise will, making branchy code look unrealistically good
+#define N 65536
+
+static unsigned char buf[N * 9 + 5];
+
+static signed char s7vals[N], s8vals[N];
+static unsigned char u8vals[N];
+static short s16vals[N];
+static unsigned short u16vals[N];
+static int s32vals[N];
+static unsigned int u32vals[N], u32smallvals[N];
+static long long s64vals[N];
+static unsigned long long u64vals[N];
+static float fvals[N];
+static double dvals[N];
+static int sz4vals[N], sz5vals[N], sz8vals[N], sz16vals[N];
+static unsigned int szvals[N];
+
+// a typical small logged event, encoded by the code build/codegen.c generates
+// (the compile scripts run codegen over this file; run ./compile first)
+DEF_MSGSTRUCT(KeyEvent) {
+	unsigned int vk;
+	unsigned int scan;
+	int tick;
+	bool down;
+};
+
+#include <msgstruct_msg.bench.gen.h> // generated by build/codegen.c
+
+static struct KeyEvent events[N];
+static unsigned char structbuf[N * MSG_MAXSZ_KeyEvent];
+static unsigned char encevents[N * MSG_MAXSZ_KeyEvent]; // for decoding
+static unsigned int encsz;
+
+static unsigned long long rng = 0x9E3779B97F4A7C15ull;
+static unsigned long long rand64(void) {
+	rng ^= rng << 13; rng ^= rng >> 7; rng ^= rng << 17;
+	return rng;
+}
+
+// roughly how real game data looks: mostly small numbers like button codes,
+// indices and flags, with the occasional ID, tick count or hash thrown in
+static unsigned long long skewed(unsigned long long r) {
+	unsigned int pick = r % 100;
+	r >>= 8;
+	if (pick < 70) return r & 0x7F;
+	if (pick < 85) return r & 0xFF;
+	if (pick < 95) return r & 0xFFFF;
+	return r;
+}
+
+__attribute__((constructor(101)))
+static void init(void) {
+	for (int i = 0; i < N; ++i) {
+		unsigned long long r = rand64();
+		s7vals[i] = (signed char)(r % 160) - 32; // all fixnums
+		s8vals[i] = r; u8vals[i] = r >> 8;
+		s16vals[i] = (short)skewed(r) * (r & 1 ? -1 : 1);
+		u16vals[i] = skewed(r);
+		s32vals[i] = (int)skewed(r) * (r & 1 ? -1 : 1);
+		u32smallvals[i] = skewed(r);
+		u32vals[i] = r >> 32;
+		s64vals[i] = (long long)skewed(r) * (r & 1 ? -1 : 1);
+		u64vals[i] = skewed(r);
+		fvals[i] = (float)(int)(r >> 40) / 64.0f;
+		// half of these survive being narrowed to floats; half don't
+		dvals[i] = r & 1 ? (double)fvals[i] : (double)(r >> 11) * 0x1p-53;
+		sz4vals[i] = r & 15; sz5vals[i] = r & 31;
+		sz8vals[i] = r & 255;
+		sz16vals[i] = skewed(r) & 0xFFFF;
+		szvals[i] = skewed(r);
+		events[i] = (struct KeyEvent){
+			r & 0xFF, r >> 8 & 0x1FF, i * 3, r >> 20 & 1
+		};
+		encsz += msg_encode_KeyEvent(encevents + encsz, events + i);
+	}
+}
+
+#define PUT(desc, f, vals) \
+	BENCH(desc, .ops = N) { \
+		unsigned char *p = buf; \
+		for (int i = 0; i < N; ++i) p += f(p, vals[i]); \
+		BENCH_USE(buf); \
+		return p - buf; \
+	}
+
+// for the functions that return nothing because the size is always the same
+#define PUTFIXED(desc, f, vals, sz) \
+	BENCH(desc, .ops = N) { \
+		unsigned char *p = buf; \
+		for (int i = 0; i < N; ++i, p += sz) f(p, vals[i]); \
+		BENCH_USE(buf); \
+		return p - buf; \
+	}
+
+BENCH("msg_putnil", .ops = N) {
+	for (int i = 0; i < N; ++i) msg_putnil(buf + i);
+	BENCH_USE(buf);
+	return N;
+}
+
+PUTFIXED("msg_putbool", msg_putbool, u8vals, 1)
+PUTFIXED("msg_puti7", msg_puti7, s7vals, 1)
+PUT("msg_puts8", msg_puts8, s8vals)
+PUT("msg_putu8", msg_putu8, u8vals)
+PUT("msg_puts16 (skewed)", msg_puts16, s16vals)
+PUT("msg_putu16 (skewed)", msg_putu16, u16vals)
+PUT("msg_puts32 (skewed)", msg_puts32, s32vals)
+PUT("msg_putu32 (skewed)", msg_putu32, u32smallvals)
+PUT("msg_putu32 (uniform)", msg_putu32, u32vals)
+PUT("msg_puts (skewed)", msg_puts, s64vals)
+PUT("msg_putu (skewed)", msg_putu, u64vals)
+PUTFIXED("msg_putf", msg_putf, fvals, 5)
+PUT("msg_putd (half narrowable)", msg_putd, dvals)
+PUTFIXED("msg_putssz5", msg_putssz5, sz5vals, 1)
+PUT("msg_putssz8", msg_putssz8, sz8vals)
+PUT("msg_putssz16", msg_putssz16, sz16vals)
+PUT("msg_putssz (skewed)", msg_putssz, szvals)
+PUTFIXED("msg_putbsz8", msg_putbsz8, sz8vals, 2)
+PUT("msg_putbsz16", msg_putbsz16, sz16vals)
+PUT("msg_putbsz (skewed)", msg_putbsz, szvals)
+PUTFIXED("msg_putasz4", msg_putasz4, sz4vals, 1)
+PUT("msg_putasz16", msg_putasz16, sz16vals)
+PUT("msg_putasz (skewed)", msg_putasz, szvals)
+PUTFIXED("msg_putmsz4", msg_putmsz4, sz4vals, 1)
+PUT("msg_putmsz16", msg_putmsz16, sz16vals)
+PUT("msg_putmsz (skewed)", msg_putmsz, szvals)
+
+BENCH("msg_putarr_u32 (skewed)", .ops = N) {
+	unsigned int n = msg_putarr_u32(buf, u32smallvals, N);
+	BENCH_USE(buf);
+	return n;
+}
+
+BENCH("msg_putarr_s32 (skewed)", .ops = N) {
+	unsigned int n = msg_putarr_s32(buf, s32vals, N);
+	BENCH_USE(buf);
+	return n;
+}
+
+BENCH("msg_putarr_f32", .ops = N) {
+	unsigned int n = msg_putarr_f32(buf, fvals, N);
+	BENCH_USE(buf);
+	return n;
+}
+
+BENCH("msg_encode_KeyEvent (generated)", .ops = N) {
+	unsigned char *p = structbuf;
+	for (int i = 0; i < N; ++i) p += msg_encode_KeyEvent(p, events + i);
+	BENCH_USE(structbuf);
+	return p - structbuf;
+}
+
+// the same thing written out by hand with the generic writer, for comparison
+BENCH("KeyEvent via msg_w* calls", .ops = N) {
+	struct msg_writer w = {structbuf, 0, sizeof(structbuf)};
+	for (int i = 0; i < N; ++i) {
+		msg_wasz(&w, 2);
+		msg_wstr(&w, "KeyEvent", 8);
+		msg_wmsz(&w, 4);
+		msg_wstr(&w, "vk", 2); msg_wu32(&w, events[i].vk);
+		msg_wstr(&w, "scan", 4); msg_wu32(&w, events[i].scan);
+		msg_wstr(&w, "tick", 4); msg_ws32(&w, events[i].tick);
+		msg_wstr(&w, "down", 4); msg_wbool(&w, events[i].down);
+	}
+	BENCH_USE(structbuf);
+	return w.len;
+}
+
+BENCH("msg_decode_KeyEvent (generated)", .ops = N) {
+	struct msg_cursor c = {encevents, encevents + encsz};
+	struct KeyEvent e;
+	for (int i = 0; i < N; ++i) {
+		msg_decode_KeyEvent(&c, &e);
+		BENCH_USE(&e);
+	}
+	return encsz;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,450 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "msgpack encoding and decoding"};
+
+#include "../src/chunklets/msg.c"
+#include "../src/msgstruct.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+// one field of every supported kind, for testing build/codegen.c's output. the
+// compile scripts run codegen over this file along with the plugin's sources
+DEF_MSGSTRUCT(Fixture) {
+	bool flag;
+	signed char tiny;
+	short small;
+	int medium;
+	unsigned char utiny;
+	unsigned short usmall;
+	unsigned int umedium;
+	long long big;
+	unsigned long long ubig;
+	float f;
+	double d;
+};
+
+// strings get their own struct, so as not to disturb all the above. text is
+// long enough to need a str8 header rather than a fixstr
+DEF_MSGSTRUCT(Label) {
+	int id;
+	char tag[5];
+	char text[64];
+};
+
+#include <msgstruct_msg.test.gen.h> // generated by build/codegen.c
+
+TEST("Integers should survive a round trip at every encoded width") {
+	static const long long vals[] = {
+		0, 1, 127, 128, 255, 256, 65535, 65536, 4294967295, 4294967296,
+		-1, -32, -33, -128, -129, -32768, -32769, -2147483648LL,
+		-2147483649LL, 9223372036854775807LL, -9223372036854775807LL - 1
+	};
+	for (int i = 0; i < sizeof(vals) / sizeof(*vals); ++i) {
+		unsigned char buf[9];
+		int n = msg_puts(buf, vals[i]);
+		struct msg_cursor c = {buf, buf + n};
+		long long x;
+		if (msg_peektype(&c) != MSG_INT) return false;
+		if (!msg_gets(&c, &x) || x != vals[i] || c.p != buf + n) return false;
+	}
+	return true;
+}
+
+TEST("Unsigned integers should survive a round trip and refuse negatives") {
+	unsigned char buf[9];
+	int n = msg_putu(buf, 18446744073709551615ull);
+	struct msg_cursor c = {buf, buf + n};
+	unsigned long long u; long long s;
+	if (msg_gets(&c, &s)) return false; // too big for signed
+	if (!msg_getu(&c, &u) || u != 18446744073709551615ull) return false;
+	n = msg_puts(buf, -5);
+	c = (struct msg_cursor){buf, buf + n};
+	if (msg_getu(&c, &u) || c.p != buf) return false;
+	return true;
+}
+
+TEST("32-bit getters should reject out-of-range values") {
+	unsigned char buf[9];
+	int n = msg_putu(buf, 4294967296);
+	struct msg_cursor c = {buf, buf + n};
+	unsigned int u; int s;
+	if (msg_getu32(&c, &u) || msg_gets32(&c, &s)) return false;
+	n = msg_putu32(buf, 4294967295);
+	c = (struct msg_cursor){buf, buf + n};
+	if (msg_gets32(&c, &s)) return false;
+	if (!msg_getu32(&c, &u) || u != 4294967295) return false;
+	n = msg_puts32(buf, -2147483647 - 1);
+	c = (struct msg_cursor){buf, buf + n};
+	if (msg_getu32(&c, &u)) return false;
+	return msg_gets32(&c, &s) && s == -2147483647 - 1;
+}
+
+TEST("Floats and doubles should survive a round trip") {
+	unsigned char buf[9];
+	msg_putf(buf, 1.5f);
+	struct msg_cursor c = {buf, buf + 5};
+	float f; double d;
+	if (!msg_getf(&c, &f) || f != 1.5f) return false;
+	int n = msg_putd(buf, 0.1);
+	if (n != 9) return false;
+	c = (struct msg_cursor){buf, buf + n};
+	if (msg_getf(&c, &f)) return false; // shouldn't silently lose precision
+	if (!msg_getd(&c, &d) || d != 0.1) return false;
+	return true;
+}
+
+TEST("Strings and blobs should be returned in place") {
+	static const char s[] = "a string which is longer than 31 bytes";
+	unsigned char buf[64];
+	int n = msg_putssz(buf, sizeof(s) - 1);
+	memcpy(buf + n, s, sizeof(s) - 1);
+	struct msg_cursor c = {buf, buf + n + sizeof(s) - 1};
+	const char *str; unsigned int sz;
+	if (!msg_getstr(&c, &str, &sz)) return false;
+	if (str != (char *)buf + n || sz != sizeof(s) - 1) return false;
+	if (c.p != c.end) return false;
+	n = msg_putbsz(buf, 3);
+	memcpy(buf + n, "\1\2\3", 3);
+	c = (struct msg_cursor){buf, buf + n + 3};
+	const unsigned char *bin;
+	if (msg_getstr(&c, &str, &sz)) return false; // wrong type
+	return msg_getbin(&c, &bin, &sz) && bin == buf + n && sz == 3;
+}
+
+TEST("Truncated values should be rejected without moving the cursor") {
+	unsigned char buf[16];
+	int n = msg_putu32(buf, 100000);
+	for (int i = 0; i < n; ++i) {
+		struct msg_cursor c = {buf, buf + i};
+		unsigned int u;
+		if (msg_getu32(&c, &u) || c.p != buf) return false;
+	}
+	n = msg_putssz(buf, 10);
+	memcpy(buf + n, "0123456789", 10);
+	struct msg_cursor c = {buf, buf + n + 9};
+	const char *s; unsigned int sz;
+	return !msg_getstr(&c, &s, &sz) && c.p == buf;
+}
+
+TEST("Array and map sizes should be readable") {
+	unsigned char buf[16], *p = buf;
+	p += msg_putasz(p, 3);
+	p += msg_putmsz(p, 70000);
+	msg_putnil(p++);
+	msg_putbool(p++, true);
+	struct msg_cursor c = {buf, p};
+	unsigned int sz; _Bool b;
+	if (msg_peektype(&c) != MSG_ARR || !msg_getasz(&c, &sz) || sz != 3) {
+		return false;
+	}
+	if (msg_getasz(&c, &sz)) return false; // it's a map, not an array
+	if (!msg_getmsz(&c, &sz) || sz != 70000) return false;
+	if (!msg_getnil(&c) || !msg_getbool(&c, &b) || !b) return false;
+	return msg_peektype(&c) == MSG_END;
+}
+
+static unsigned int rng = 12345;
+static unsigned int rand32(void) {
+	rng ^= rng << 13; rng ^= rng >> 17; rng ^= rng << 5;
+	return rng;
+}
+
+// mix of fixnum runs and larger values so that both the SIMD blocks and the
+// per-element fallback get hit, as well as the leftover tail elements
+static unsigned int randval(int i) {
+	unsigned int r = rand32();
+	if (i & 16) return r & 0x7F;
+	switch (r & 3) {
+		case 0: return (r >> 8) & 0xFF;
+		case 1: return (r >> 8) & 0xFFFF;
+		case 2: return r >> 2;
+		default: return -(r >> 27);
+	}
+}
+
+TEST("Bulk arrays should be encoded exactly like individual elements") {
+	static unsigned int u[203]; static float f[203];
+	static unsigned char buf[5 + 5 * 203], ref[5 + 5 * 203];
+	for (int i = 0; i < 203; ++i) {
+		u[i] = randval(i);
+		f[i] = (int)u[i] * 0.25f;
+	}
+	for (unsigned int n = 0; n <= 203; n += 7) {
+		unsigned int len = msg_putasz(ref, n);
+		for (unsigned int i = 0; i < n; ++i) len += msg_putu32(ref + len, u[i]);
+		if (msg_putarr_u32(buf, u, n) != len || memcmp(buf, ref, len)) {
+			return false;
+		}
+		len = msg_putasz(ref, n);
+		for (unsigned int i = 0; i < n; ++i) len += msg_puts32(ref + len, u[i]);
+		if (msg_putarr_s32(buf, (int *)u, n) != len || memcmp(buf, ref, len)) {
+			return false;
+		}
+		len = msg_putasz(ref, n);
+		for (unsigned int i = 0; i < n; ++i, len += 5) {
+			msg_putf(ref + len, f[i]);
+		}
+		if (msg_putarr_f32(buf, f, n) != len || memcmp(buf, ref, len)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+TEST("Skipping should cover whole nested values and nothing more") {
+	static unsigned char buf[128];
+	unsigned char *p = buf;
+	p += msg_putmsz(p, 2);
+	p += msg_putssz(p, 3); memcpy(p, "key", 3); p += 3;
+	p += msg_putasz16(p, 3);
+	p += msg_putu32(p, 100000);
+	p += msg_putasz(p, 0);
+	p += msg_putbsz16(p, 40); p += 40; // contents don't matter
+	msg_putnil(p++);
+	p += msg_putasz(p, 2);
+	p += msg_putd(p, 0.1);
+	*p++ = 0xD6; p += 5; // fixext4
+	unsigned char *valend = p;
+	msg_putbool(p++, false); // trailing value that shouldn't be included
+	if (msg_extent(buf) != valend - buf) return false;
+	struct msg_cursor c = {buf, p};
+	if (!msg_skip(&c) || c.p != valend) return false;
+	if (!msg_skip(&c) || c.p != p) return false;
+	return !msg_skip(&c); // nothing left
+}
+
+TEST("Skipping should reject truncated and malformed input") {
+	static unsigned char buf[64];
+	unsigned char *p = buf;
+	p += msg_putasz(p, 3);
+	p += msg_putssz(p, 20); p += 20;
+	p += msg_putmsz(p, 1);
+	p += msg_puts(p, -1000);
+	p += msg_putu(p, 5000000000);
+	msg_putf(p, 0.5f); p += 5;
+	for (unsigned char *q = buf; q < p; ++q) {
+		struct msg_cursor c = {buf, q};
+		if (msg_skip(&c) || c.p != buf) return false;
+	}
+	struct msg_cursor c = {buf, p};
+	if (!msg_skip(&c)) return false;
+	buf[1] = 0xC1; // the never-used type byte
+	c = (struct msg_cursor){buf, p};
+	if (msg_skip(&c)) return false;
+	// a silly element count should be caught without counting down to zero
+	p = buf + msg_putmsz(buf, 4294967295u);
+	c = (struct msg_cursor){buf, p};
+	return !msg_skip(&c);
+}
+
+static void *testgrow(void *buf, unsigned int sz) { return realloc(buf, sz); }
+
+TEST("Writers should grow, write and roll back") {
+	struct msg_writer w = {0, 0, 0, &testgrow};
+	if (!msg_reserve(&w, MSG_MAXSZ_ARR + MSG_MAXSZ_STR(3) + MSG_MAXSZ_INT32)) {
+		return false;
+	}
+	msg_wasz(&w, 2);
+	msg_wstr(&w, "abc", 3);
+	msg_wu32(&w, 300);
+	unsigned int cp = msg_checkpoint(&w);
+	// big enough to force the buffer to move, probably
+	if (!msg_reserve(&w, MSG_MAXSZ_BIN(1000))) return false;
+	static unsigned char junk[1000];
+	msg_wbin(&w, junk, sizeof(junk));
+	msg_rollback(&w, cp);
+	if (w.len != 8) return false;
+	static const unsigned char expected[] = {
+		0x92, 0xA3, 'a', 'b', 'c', 0xCD, 0x01, 0x2C
+	};
+	bool ret = !memcmp(w.buf, expected, sizeof(expected));
+	free(w.buf);
+	return ret;
+}
+
+TEST("Fixed-size writers should refuse to overflow") {
+	unsigned char buf[8];
+	struct msg_writer w = {buf, 0, sizeof(buf)};
+	if (!msg_reserve(&w, 8) || msg_reserve(&w, 9)) return false;
+	msg_wf(&w, 0.5f);
+	if (!msg_reserve(&w, 3) || msg_reserve(&w, 4)) return false;
+	return w.buf == buf && w.cap == 8;
+}
+
+static const struct Fixture fixture = {
+	true, -100, -30000, -2000000000, 200, 60000, 4000000000u,
+	-9000000000000000000LL, 18000000000000000000ull, 0.25f, 1e300
+};
+
+static bool fixtureeq(const struct Fixture *a, const struct Fixture *b) {
+	return a->flag == b->flag && a->tiny == b->tiny && a->small == b->small &&
+			a->medium == b->medium && a->utiny == b->utiny &&
+			a->usmall == b->usmall && a->umedium == b->umedium &&
+			a->big == b->big && a->ubig == b->ubig && a->f == b->f &&
+			a->d == b->d;
+}
+
+TEST("Generated msgstruct code should round-trip every field type") {
+	unsigned char buf[MSG_MAXSZ_Fixture];
+	unsigned int len = msg_encode_Fixture(buf, &fixture);
+	if (len > sizeof(buf)) return false;
+	struct msg_cursor c = {buf, buf + len};
+	struct Fixture out;
+	if (!msg_decode_Fixture(&c, &out) || c.p != buf + len) return false;
+	if (!fixtureeq(&fixture, &out)) return false;
+	// truncated input should be rejected without moving the cursor
+	c = (struct msg_cursor){buf, buf + len - 1};
+	return !msg_decode_Fixture(&c, &out) && c.p == buf;
+}
+
+TEST("Generated msgstruct encoders should match the generic decoder") {
+	unsigned char buf[MSG_MAXSZ_Fixture];
+	unsigned int len = msg_encode_Fixture(buf, &fixture);
+	struct msg_cursor c = {buf, buf + len};
+	unsigned int n;
+	const char *k;
+	if (!msg_getasz(&c, &n) || n != 2) return false;
+	if (!msg_getstr(&c, &k, &n) || n != 7 || memcmp(k, "Fixture", 7)) {
+		return false;
+	}
+	if (!msg_getmsz(&c, &n) || n != 11) return false;
+	struct Fixture out;
+	for (int i = 0; i < 11; ++i) {
+		if (!msg_getstr(&c, &k, &n)) return false;
+		int x; unsigned int u; long long s64; unsigned long long u64;
+		_Bool b; float f; double d;
+#define KEY(s) (n == sizeof(s) - 1 && !memcmp(k, s, n))
+		if (KEY("flag")) { if (!msg_getbool(&c, &b)) return false;
+				out.flag = b; }
+		else if (KEY("tiny")) { if (!msg_gets32(&c, &x)) return false;
+				out.tiny = x; }
+		else if (KEY("small")) { if (!msg_gets32(&c, &x)) return false;
+				out.small = x; }
+		else if (KEY("medium")) { if (!msg_gets32(&c, &x)) return false;
+				out.medium = x; }
+		else if (KEY("utiny")) { if (!msg_getu32(&c, &u)) return false;
+				out.utiny = u; }
+		else if (KEY("usmall")) { if (!msg_getu32(&c, &u)) return false;
+				out.usmall = u; }
+		else if (KEY("umedium")) { if (!msg_getu32(&c, &u)) return false;
+				out.umedium = u; }
+		else if (KEY("big")) { if (!msg_gets(&c, &s64)) return false;
+				out.big = s64; }
+		else if (KEY("ubig")) { if (!msg_getu(&c, &u64)) return false;
+				out.ubig = u64; }
+		else if (KEY("f")) { if (!msg_getf(&c, &f)) return false; out.f = f; }
+		else if (KEY("d")) { if (!msg_getd(&c, &d)) return false; out.d = d; }
+		else return false;
+#undef KEY
+	}
+	return c.p == buf + len && fixtureeq(&fixture, &out);
+}
+
+TEST("Generated msgstruct encoders should pick the same sizes as msg_put*") {
+	// the integer encoding is all done inline, so check each boundary
+	static const long long vals[] = {
+		0, 127, 128, 255, 256, 65535, 65536, 4294967295, 4294967296,
+		-32, -33, -128, -129, -32768, -32769, -2147483648LL, -2147483649LL
+	};
+	for (int i = 0; i < sizeof(vals) / sizeof(*vals); ++i) {
+		long long v = vals[i];
+		struct Fixture in = {
+			false, v, v, v, v, v, v, v, v, 0.25f, 0.1
+		};
+		unsigned char buf[MSG_MAXSZ_Fixture], want[MSG_MAXSZ_Fixture];
+		unsigned int len = msg_encode_Fixture(buf, &in);
+		struct msg_writer w = {want, 0, sizeof(want)};
+		msg_wasz(&w, 2); msg_wstr(&w, "Fixture", 7); msg_wmsz(&w, 11);
+		msg_wstr(&w, "flag", 4); msg_wbool(&w, in.flag);
+		msg_wstr(&w, "tiny", 4); msg_ws32(&w, in.tiny);
+		msg_wstr(&w, "small", 5); msg_ws32(&w, in.small);
+		msg_wstr(&w, "medium", 6); msg_ws32(&w, in.medium);
+		msg_wstr(&w, "utiny", 5); msg_wu32(&w, in.utiny);
+		msg_wstr(&w, "usmall", 6); msg_wu32(&w, in.usmall);
+		msg_wstr(&w, "umedium", 7); msg_wu32(&w, in.umedium);
+		msg_wstr(&w, "big", 3); msg_ws(&w, in.big);
+		msg_wstr(&w, "ubig", 4); msg_wu(&w, in.ubig);
+		msg_wstr(&w, "f", 1); msg_wf(&w, in.f);
+		msg_wstr(&w, "d", 1); msg_wd(&w, in.d);
+		if (len != w.len || memcmp(buf, want, len)) return false;
+	}
+	return true;
+}
+
+TEST("Generated msgstruct decoders should accept other valid encodings") {
+	// fields out of order, an unknown one thrown in, one missing, and sizes
+	// not written in their smallest form
+	unsigned char buf[128];
+	struct msg_writer w = {buf, 0, sizeof(buf)};
+	buf[w.len++] = 0xDC; buf[w.len++] = 0; buf[w.len++] = 2; // array16
+	msg_wstr(&w, "Fixture", 7);
+	buf[w.len++] = 0xDE; buf[w.len++] = 0; buf[w.len++] = 4; // map16
+	msg_wstr(&w, "medium", 6); msg_ws32(&w, -5);
+	msg_wstr(&w, "unknown", 7); msg_wstr(&w, "skip me", 7);
+	msg_wstr(&w, "d", 1); msg_wf(&w, 0.5f); // float into double is fine
+	msg_wstr(&w, "flag", 4); msg_wbool(&w, true);
+	struct msg_cursor c = {buf, buf + w.len};
+	struct Fixture out;
+	memset(&out, 0xFF, sizeof(out));
+	if (!msg_decode_Fixture(&c, &out) || c.p != buf + w.len) return false;
+	if (out.medium != -5 || out.d != 0.5 || !out.flag) return false;
+	if (out.tiny || out.ubig || out.f) return false; // zeroed when missing
+	// narrow fields should reject values that don't fit
+	w.len = 0;
+	msg_wasz(&w, 2); msg_wstr(&w, "Fixture", 7);
+	msg_wmsz(&w, 1); msg_wstr(&w, "tiny", 4); msg_ws32(&w, 200);
+	c = (struct msg_cursor){buf, buf + w.len};
+	if (msg_decode_Fixture(&c, &out) || c.p != buf) return false;
+	// and anything with the wrong name is a different struct entirely
+	w.len = 0;
+	msg_wasz(&w, 2); msg_wstr(&w, "Fixturf", 7); msg_wmsz(&w, 0);
+	c = (struct msg_cursor){buf, buf + w.len};
+	return !msg_decode_Fixture(&c, &out);
+}
+
+TEST("Generated msgstruct code should round-trip strings") {
+	struct Label in = {
+		-1, "abcd", "a string which is longer than 31 bytes, but still fits"
+	};
+	unsigned char buf[MSG_MAXSZ_Label], want[MSG_MAXSZ_Label];
+	unsigned int len = msg_encode_Label(buf, &in);
+	struct msg_writer w = {want, 0, sizeof(want)};
+	msg_wasz(&w, 2); msg_wstr(&w, "Label", 5); msg_wmsz(&w, 3);
+	msg_wstr(&w, "id", 2); msg_ws32(&w, in.id);
+	msg_wstr(&w, "tag", 3); msg_wstr(&w, in.tag, strlen(in.tag));
+	msg_wstr(&w, "text", 4); msg_wstr(&w, in.text, strlen(in.text));
+	if (len != w.len || memcmp(buf, want, len)) return false;
+	struct msg_cursor c = {buf, buf + len};
+	struct Label out;
+	memset(&out, 0xFF, sizeof(out));
+	if (!msg_decode_Label(&c, &out) || c.p != buf + len) return false;
+	if (out.id != -1 || strcmp(out.tag, "abcd")) return false;
+	return !strcmp(out.text, in.text);
+}
+
+TEST("Generated msgstruct string fields should stay within their bounds") {
+	// no null terminator: only as much as would fit with one gets written
+	struct Label in = {0};
+	memcpy(in.tag, "abcde", 5);
+	unsigned char buf[MSG_MAXSZ_Label];
+	unsigned int len = msg_encode_Label(buf, &in);
+	struct msg_cursor c = {buf, buf + len};
+	struct Label out;
+	if (!msg_decode_Label(&c, &out) || strcmp(out.tag, "abcd")) return false;
+	// anything too long to fit, terminator included, should be rejected
+	unsigned char big[128];
+	struct msg_writer w = {big, 0, sizeof(big)};
+	msg_wasz(&w, 2); msg_wstr(&w, "Label", 5); msg_wmsz(&w, 1);
+	msg_wstr(&w, "tag", 3); msg_wstr(&w, "abcde", 5);
+	c = (struct msg_cursor){big, big + w.len};
+	if (msg_decode_Label(&c, &out) || c.p != big) return false;
+	// and strings that aren't strings at all, for that matter
+	w.len = 0;
+	msg_wasz(&w, 2); msg_wstr(&w, "Label", 5); msg_wmsz(&w, 1);
+	msg_wstr(&w, "tag", 3); msg_ws32(&w, 5);
+	c = (struct msg_cursor){big, big + w.len};
+	return !msg_decode_Label(&c, &out);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
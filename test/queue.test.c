@@ -0,0 +1,144 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "lock-free queues"};
+
+#include "../src/chunklets/fastspin.c"
+#include "../src/chunklets/queue.c"
+
+#include "thread.h"
+
+struct elem { int a; short b; }; // odd size to catch stride/copy mistakes
+
+TEST("SPSC queues should fill up, drain in order and wrap around") {
+	static struct elem buf[8];
+	struct queue_spsc q;
+	queue_spsc_init(&q, buf, sizeof(struct elem), 8);
+	struct elem e;
+	if (queue_spsc_pop(&q, &e)) return false;
+	int in = 0, out = 0;
+	// go round several times with different fill levels to cover wraparound
+	for (int round = 0; round < 5; ++round) {
+		for (;;) {
+			if (!queue_spsc_push(&q, &(struct elem){in, -in})) break;
+			++in;
+		}
+		if (in - out != 8) return false;
+		queue_spsc_wait(&q); // must return immediately
+		for (int i = 0; i < round + 3; ++i, ++out) {
+			if (!queue_spsc_pop(&q, &e) || e.a != out || e.b != -out) {
+				return false;
+			}
+		}
+	}
+	while (queue_spsc_pop(&q, &e)) {
+		if (e.a != out || e.b != -out) return false;
+		++out;
+	}
+	return out == in;
+}
+
+TEST("MPSC queues should fill up, drain in order and wrap around") {
+	static unsigned char buf[QUEUE_MPSC_BUFSZ(sizeof(struct elem), 4)];
+	struct queue_mpsc q;
+	queue_mpsc_init(&q, buf, sizeof(struct elem), 4);
+	struct elem e;
+	if (queue_mpsc_pop(&q, &e)) return false;
+	int in = 0, out = 0;
+	for (int round = 0; round < 5; ++round) {
+		for (;;) {
+			if (!queue_mpsc_push(&q, &(struct elem){in, -in})) break;
+			++in;
+		}
+		if (in - out != 4) return false;
+		queue_mpsc_wait(&q);
+		for (int i = 0; i < (round & 3) + 1; ++i, ++out) {
+			if (!queue_mpsc_pop(&q, &e) || e.a != out || e.b != -out) {
+				return false;
+			}
+		}
+	}
+	while (queue_mpsc_pop(&q, &e)) {
+		if (e.a != out || e.b != -out) return false;
+		++out;
+	}
+	return out == in;
+}
+
+// Stress tests: producer threads push numbered elements through small queues as
+// fast as they can, yielding when full, while the consumer checks that each one
+// arrives exactly once and in order. Every so often producers pause, so that
+// the consumer runs dry and has to park in queue_*_wait(), and the next push
+// has to wake it up; a lost wakeup would hang the test.
+#define STRESS_N 200000
+#define STRESS_PAUSEEVERY 20000
+#define STRESS_PRODUCERS 4
+
+static struct queue_spsc stressspsc;
+static struct elem stressspscbuf[8];
+static struct queue_mpsc stressmpsc;
+static unsigned char stressmpscbuf[QUEUE_MPSC_BUFSZ(sizeof(struct elem), 8)];
+static int producerids[] = {0, 1, 2, 3};
+
+THREADFUNC(spscproducer) {
+	for (int i = 0; i < STRESS_N; ++i) {
+		while (!queue_spsc_push(&stressspsc, &(struct elem){i, 0})) {
+			yieldthread();
+		}
+		if (i % STRESS_PAUSEEVERY == STRESS_PAUSEEVERY - 1) sleepms(2);
+	}
+	return 0;
+}
+
+THREADFUNC(mpscproducer) {
+	short id = *(int *)param;
+	for (int i = 0; i < STRESS_N; ++i) {
+		while (!queue_mpsc_push(&stressmpsc, &(struct elem){i, id})) {
+			yieldthread();
+		}
+		if (i % STRESS_PAUSEEVERY == STRESS_PAUSEEVERY - 1) sleepms(2);
+	}
+	return 0;
+}
+
+TEST("SPSC queues should pass everything across threads in order",
+		.timeout = 30000) {
+	queue_spsc_init(&stressspsc, stressspscbuf, sizeof(struct elem),
+			sizeof(stressspscbuf) / sizeof(*stressspscbuf));
+	thread t;
+	if (!startthread(&t, &spscproducer, 0)) return false;
+	bool ret = true;
+	for (int i = 0; i < STRESS_N; ++i) {
+		struct elem e;
+		while (!queue_spsc_pop(&stressspsc, &e)) queue_spsc_wait(&stressspsc);
+		if (e.a != i) { ret = false; break; }
+	}
+	jointhread(t);
+	struct elem e;
+	return ret && !queue_spsc_pop(&stressspsc, &e);
+}
+
+TEST("MPSC queues should pass everything across threads in order",
+		.timeout = 30000) {
+	queue_mpsc_init(&stressmpsc, stressmpscbuf, sizeof(struct elem), 8);
+	thread t[STRESS_PRODUCERS];
+	for (int i = 0; i < STRESS_PRODUCERS; ++i) {
+		if (!startthread(t + i, &mpscproducer, producerids + i)) return false;
+	}
+	// each producer's elements should come out in the order it pushed them,
+	// with nothing lost or duplicated, however they're interleaved
+	int next[STRESS_PRODUCERS] = {0};
+	bool ret = true;
+	for (int i = 0; i < STRESS_N * STRESS_PRODUCERS; ++i) {
+		struct elem e;
+		while (!queue_mpsc_pop(&stressmpsc, &e)) queue_mpsc_wait(&stressmpsc);
+		if (e.b < 0 || e.b >= STRESS_PRODUCERS || e.a != next[e.b]++) {
+			ret = false;
+			break;
+		}
+	}
+	for (int i = 0; i < STRESS_PRODUCERS; ++i) jointhread(t[i]);
+	struct elem e;
+	return ret && !queue_mpsc_pop(&stressmpsc, &e);
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
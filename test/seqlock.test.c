@@ -0,0 +1,105 @@
+/* This file is dedicated to the public domain. */
+
+{.desc = "seqlocks"};
+
+#include "../src/chunklets/seqlock.c"
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <time.h>
+#endif
+
+TEST("A read with no writes should succeed first time") {
+	static unsigned int seq = 0, shared[3] = {1, 2, 3};
+	unsigned int copy[3];
+	unsigned int s = seqlock_read(&seq, copy, shared, sizeof(copy));
+	if (s != 0 || copy[0] != 1 || copy[1] != 2 || copy[2] != 3) return false;
+	unsigned int start = seqlock_read_begin(&seq);
+	seqlock_write(&seq, shared, (unsigned int[3]){4, 5, 6}, sizeof(shared));
+	// an intervening write must make a reader retry
+	if (!seqlock_read_retry(&seq, start)) return false;
+	s = seqlock_read(&seq, copy, shared, sizeof(copy));
+	return s == 2 && copy[0] == 4 && copy[1] == 5 && copy[2] == 6;
+}
+
+// Torture test: a writer fills a struct with its generation number over and
+// over, while readers check every snapshot they get is entirely one generation,
+// and that generations never go backwards. The odd-sized tail makes sure the
+// byte-wise part of the copy is covered too.
+struct snapshot {
+	unsigned int gen;
+	unsigned int vals[29];
+	unsigned char tail[3];
+};
+#define SNAPSHOT_SZ (sizeof(unsigned int) * 30 + 3)
+
+static unsigned int tortureseq = 0;
+static struct snapshot torturedata;
+static volatile int torturedone = 0, torturefail = 0;
+static volatile unsigned int torturereads = 0;
+
+#ifdef _WIN32
+#define THREADFUNC(name) static unsigned long __stdcall name(void *param)
+#else
+#define THREADFUNC(name) static void *name(void *param)
+#endif
+
+THREADFUNC(torturewriter) {
+	struct snapshot s;
+	for (unsigned int gen = 1; !torturedone; ++gen) {
+		s.gen = gen;
+		for (int i = 0; i < 29; ++i) s.vals[i] = gen;
+		for (int i = 0; i < 3; ++i) s.tail[i] = gen;
+		seqlock_write(&tortureseq, &torturedata, &s, SNAPSHOT_SZ);
+	}
+	return 0;
+}
+
+THREADFUNC(torturereader) {
+	unsigned int lastgen = 0, n = 0;
+	while (!torturedone) {
+		struct snapshot s;
+		seqlock_read(&tortureseq, &s, &torturedata, SNAPSHOT_SZ);
+		if (s.gen < lastgen) torturefail = 1;
+		for (int i = 0; i < 29; ++i) if (s.vals[i] != s.gen) torturefail = 1;
+		for (int i = 0; i < 3; ++i) {
+			if (s.tail[i] != (unsigned char)s.gen) torturefail = 1;
+		}
+		lastgen = s.gen;
+		++n;
+	}
+	torturereads += n; // not atomic, but it's only a rough sanity check
+	return 0;
+}
+
+#define TORTURE_READERS 3
+#define TORTURE_MS 1000
+
+TEST("Readers should never see a torn write", .timeout = TORTURE_MS * 10) {
+#ifdef _WIN32
+	HANDLE thr[TORTURE_READERS + 1];
+	thr[0] = CreateThread(0, 0, &torturewriter, 0, 0, 0);
+	for (int i = 1; i <= TORTURE_READERS; ++i) {
+		thr[i] = CreateThread(0, 0, &torturereader, 0, 0, 0);
+	}
+	for (int i = 0; i <= TORTURE_READERS; ++i) if (!thr[i]) return false;
+	Sleep(TORTURE_MS);
+	torturedone = 1;
+	WaitForMultipleObjects(TORTURE_READERS + 1, thr, TRUE, INFINITE);
+#else
+	pthread_t thr[TORTURE_READERS + 1];
+	if (pthread_create(thr, 0, &torturewriter, 0)) return false;
+	for (int i = 1; i <= TORTURE_READERS; ++i) {
+		if (pthread_create(thr + i, 0, &torturereader, 0)) return false;
+	}
+	struct timespec ts = {TORTURE_MS / 1000, TORTURE_MS % 1000 * 1000000};
+	nanosleep(&ts, 0);
+	torturedone = 1;
+	for (int i = 0; i <= TORTURE_READERS; ++i) pthread_join(thr[i], 0);
+#endif
+	if (torturefail) return false;
+	// make sure everything actually got a chance to run
+	return torturereads > 0 && torturedata.gen > 1;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
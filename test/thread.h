@@ -0,0 +1,53 @@
+/* This file is dedicated to the public domain. */
+
+#ifndef INC_TEST_THREAD_H
+#define INC_TEST_THREAD_H
+
+// Bare-minimum threading helpers for tests which need more than one thread.
+// Include after test.h. Needs -pthread on Linux.
+
+#ifndef _WIN32
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#endif
+
+#ifdef _WIN32
+typedef HANDLE thread;
+#define THREADFUNC(name) static unsigned long __stdcall name(void *param)
+static inline bool startthread(thread *t, LPTHREAD_START_ROUTINE f,
+		void *param) {
+	return !!(*t = CreateThread(0, 0, f, param, 0, 0));
+}
+static inline void jointhread(thread t) {
+	WaitForSingleObject(t, INFINITE);
+	CloseHandle(t);
+}
+static inline void sleepms(int ms) { Sleep(ms); }
+static inline void yieldthread(void) { SwitchToThread(); }
+#else
+typedef pthread_t thread;
+#define THREADFUNC(name) static void *name(void *param)
+static inline bool startthread(thread *t, void *(*f)(void *), void *param) {
+	return !pthread_create(t, 0, f, param);
+}
+static inline void jointhread(thread t) { pthread_join(t, 0); }
+static inline void sleepms(int ms) {
+	struct timespec ts = {ms / 1000, ms % 1000 * 1000000};
+	nanosleep(&ts, 0);
+}
+static inline void yieldthread(void) { sched_yield(); }
+#endif
+
+// polls for a second or so for some other thread to make a condition true,
+// failing the test if it doesn't
+#define EVENTUALLY(cond) do { \
+	for (int _i = 0; !(cond); ++_i) { \
+		if (_i == 1000) return false; \
+		sleepms(1); \
+	} \
+} while (0)
+
+#endif
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
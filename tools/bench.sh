@@ -0,0 +1,46 @@
+#!/bin/sh -e
+# This file is dedicated to the public domain.
+
+# Builds and runs benchmarks (test/*.bench.c) under every available compiler and
+# every build variant declared in each file, collecting the results into a
+# single CSV on stdout. Run from the repo root, optionally giving the names of
+# specific benchmarks, e.g. `tools/bench.sh msg`.
+#
+# Variants are declared in the bench source with lines like:
+#   // variant: name -DSOME_FLAG -DANOTHER_FLAG
+# A default variant with no extra flags is always run as well.
+#
+# Set COMPILERS to override the list of compilers to try, and BENCHFLAGS to add
+# flags to every build (e.g. -march=native).
+
+: "${COMPILERS:=gcc clang}"
+: "${BENCHFLAGS:=}"
+
+mkdir -p .build/bench
+
+if [ $# = 0 ]; then
+	set -- `for f in test/*.bench.c; do basename "$f" .bench.c; done`
+fi
+
+echo "compiler,variant,bench,ns_per_op,mb_per_s,p50_ns,p99_ns,p999_ns"
+for cc in $COMPILERS; do
+	if ! command -v "$cc" >/dev/null 2>&1; then
+		echo "bench.sh: skipping $cc (not found)" >&2
+		continue
+	fi
+	for b in "$@"; do
+		src="test/$b.bench.c"
+		{
+			echo "default"
+			sed -n 's|^// variant: *||p' "$src"
+		} | while read -r variant flags; do
+			out=".build/bench/$b.$cc.$variant"
+			# BENCHFLAGS and flags are deliberately word-split
+			"$cc" -O2 $BENCHFLAGS $flags -I.build/include \
+					-include test/bench.h -o "$out" "$src" -lpthread
+			"$out" | tail -n +2 | sed "s|^|$cc,$variant,|"
+		done
+	done
+done
+
+# vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,97 @@
+// Dumps the header and commands of demo files, using src/demofile.c.
+// With -s, just prints a summary of each file, including how fast it was read,
+// which is handy for checking the parser keeps up with the disk.
+// To compile:
+// Unix: $CC -O2 -include stdbool.h -o.build/demodump tools/demodump.c
+// Windows: clang-cl -fuse-ld=lld -O2 -FIstdbool.h -Fe.build/demodump.exe tools/demodump.c
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/demofile.c"
+
+static double now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void dumphdr(const char *path, const struct demofile *df) {
+	const struct demo_hdr *h = df->hdr;
+	// the strings *should* be terminated, but don't trust random files
+	printf("%s:\n"
+			"  demo protocol %d, network protocol %d\n"
+			"  server: %.*s\n  player: %.*s\n  map: %.*s\n  game: %.*s\n"
+			"  %.3f seconds, %d ticks, %d frames, %d bytes of signon data\n",
+			path, h->demover, h->netver,
+			DEMO_HDR_STRLEN, h->servername, DEMO_HDR_STRLEN, h->playername,
+			DEMO_HDR_STRLEN, h->mapname, DEMO_HDR_STRLEN, h->gamedir,
+			h->realtime, h->nticks, h->nframes, h->signonlen);
+}
+
+static bool dump(const char *path, bool summary) {
+	struct demofile df;
+	double start = now();
+	if (!demofile_open(&df, path)) {
+		fprintf(stderr, "demodump: %s: %s\n", path, df.err);
+		return false;
+	}
+	dumphdr(path, &df);
+	struct demofile_cmd cmd;
+	uvlong counts[256] = {0}, bytes[256] = {0};
+	while (demofile_next(&df, &cmd)) {
+		if (summary) {
+			++counts[cmd.cmd];
+			bytes[cmd.cmd] += cmd.len;
+			continue;
+		}
+		printf("  %10zu  tick %6d  slot %d  %-12s",
+				cmd.off, cmd.tick, cmd.playerslot,
+				demofile_cmdname(&df, cmd.cmd));
+		switch (cmd.cmd) {
+			case DEMO_CMD_SIGNON: case DEMO_CMD_PACKET:
+				printf("  seq %d/%d", cmd.seqin, cmd.seqout);
+				break;
+			case DEMO_CMD_CONCMD:
+				// the command string is null-terminated (hopefully)
+				printf("  \"%.*s\"", cmd.len ? (int)cmd.len - 1 : 0, cmd.data);
+				goto nl;
+			case DEMO_CMD_USERCMD:
+				printf("  seq %d", cmd.arg);
+				break;
+			case DEMO_CMD_CUSTOMDATA:
+				if (df.customdata) printf("  callback %d", cmd.arg);
+		}
+		if (cmd.data) printf("  %u bytes", cmd.len);
+nl:		putchar('\n');
+	}
+	if (df.err) fprintf(stderr, "demodump: %s: %s\n", path, df.err);
+	if (summary) {
+		for (int i = 0; i < 256; ++i) {
+			if (!counts[i]) continue;
+			printf("  %-12s %10llu commands %14llu bytes\n",
+					demofile_cmdname(&df, i), counts[i], bytes[i]);
+		}
+		double secs = now() - start;
+		printf("  read %zu bytes in %.3f seconds (%.1f MB/s)\n", df._mapsz,
+				secs, df._mapsz / secs / 1e6);
+	}
+	bool ret = !df.err;
+	demofile_close(&df);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	bool summary = false;
+	if (argc > 1 && !strcmp(argv[1], "-s")) { summary = true; --argc; ++argv; }
+	if (argc < 2) {
+		fprintf(stderr, "usage: demodump [-s] file.dem...\n");
+		return 1;
+	}
+	int ret = 0;
+	for (int i = 1; i < argc; ++i) if (!dump(argv[i], summary)) ret = 1;
+	return ret;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
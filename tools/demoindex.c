@@ -0,0 +1,122 @@
+// Generates seek index files for demos, using src/demoindex.c, and looks up
+// ticks in them. Indices are saved alongside each demo, as file.dem.idx.
+//   demoindex [-i ticks] file.dem...   -- index every ticks ticks (default 66)
+//   demoindex -t tick file.dem         -- find tick using an existing index
+// To compile:
+// Unix: $CC -O2 -include stdbool.h -o.build/demoindex tools/demoindex.c
+// Windows: clang-cl -fuse-ld=lld -O2 -FIstdbool.h -Fe.build/demoindex.exe
+//     tools/demoindex.c
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../src/demofile.c"
+#include "../src/demoindex.c"
+
+static char *idxpath(const char *path) {
+	usize len = strlen(path);
+	char *ret = malloc(len + 5);
+	if (!ret) {
+		fprintf(stderr, "demoindex: couldn't allocate memory\n");
+		exit(1);
+	}
+	memcpy(ret, path, len);
+	memcpy(ret + len, ".idx", 5);
+	return ret;
+}
+
+static bool build(const char *path, s32 interval) {
+	struct demofile df;
+	if (!demofile_open(&df, path)) {
+		fprintf(stderr, "demoindex: %s: %s\n", path, df.err);
+		return false;
+	}
+	struct demoindex_builder b;
+	demoindex_initbuilder(&b, interval);
+	bool ret = demoindex_build(&b, &df);
+	if (!ret) {
+		fprintf(stderr, "demoindex: %s: %s\n", path,
+				b.oom ? "couldn't allocate memory" : df.err);
+	}
+	else {
+		char *out = idxpath(path);
+		ret = demoindex_save(&b, out, df._mapsz);
+		if (!ret) {
+			fprintf(stderr, "demoindex: %s: %s\n", out, strerror(errno));
+		}
+		else {
+			printf("%s: %u checkpoints\n", out, b.nentries);
+		}
+		free(out);
+	}
+	demoindex_freebuilder(&b);
+	demofile_close(&df);
+	return ret;
+}
+
+static bool find(const char *path, s32 tick) {
+	struct demofile df;
+	if (!demofile_open(&df, path)) {
+		fprintf(stderr, "demoindex: %s: %s\n", path, df.err);
+		return false;
+	}
+	struct demoindex idx;
+	char *ip = idxpath(path);
+	bool ret = false;
+	if (!demoindex_load(&idx, ip)) {
+		fprintf(stderr, "demoindex: %s: %s\n", ip, idx.err);
+		goto e1;
+	}
+	if (!demoindex_seek(&idx, &df, tick)) {
+		fprintf(stderr, "demoindex: %s: index is out of date\n", ip);
+		goto e2;
+	}
+	usize start = df.cur - (const uchar *)df.hdr;
+	printf("starting from offset %zu (%.1f%% of the way in)\n", start,
+			100.0 * start / df._mapsz);
+	struct demofile_cmd cmd;
+	uint n = 0;
+	while (demofile_next(&df, &cmd)) {
+		++n;
+		if (cmd.tick >= tick) {
+			printf("tick %d: %s at offset %zu, after parsing %u commands\n",
+					cmd.tick, demofile_cmdname(&df, cmd.cmd), cmd.off, n);
+			ret = true;
+			goto e2;
+		}
+	}
+	if (df.err) fprintf(stderr, "demoindex: %s: %s\n", path, df.err);
+	else fprintf(stderr, "demoindex: %s: demo ends before tick %d\n", path,
+			tick);
+e2:	demoindex_free(&idx);
+e1:	free(ip);
+	demofile_close(&df);
+	return ret;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: demoindex [-i ticks] file.dem...\n"
+			"       demoindex -t tick file.dem\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	if (argc > 2 && !strcmp(argv[1], "-t")) {
+		if (argc != 4) usage();
+		return !find(argv[3], atoi(argv[2]));
+	}
+	s32 interval = 66; // about a second in most games
+	if (argc > 2 && !strcmp(argv[1], "-i")) {
+		interval = atoi(argv[2]);
+		if (interval < 1) usage();
+		argc -= 2; argv += 2;
+	}
+	if (argc < 2) usage();
+	int ret = 0;
+	for (int i = 1; i < argc; ++i) if (!build(argv[i], interval)) ret = 1;
+	return ret;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,344 @@
+// Verifies the anticheat data in a batch of demo files, spreading the work over
+// a pool of worker threads and printing a single report at the end. Each demo's
+// custom data payloads are extracted with src/demoextract.c and their MACs are
+// checked as described in src/ac.h, which requires the leaderboard's 32-byte
+// X25519 private key, given as a raw binary file.
+// Files are read one at a time, in order, by the main thread, so that spinning
+// disks don't have to seek back and forth; everything else is done in parallel.
+//   demoverify [-v] [-j threads] -k keyfile file.dem...
+// With -v, every demo is listed in the report, rather than just the failures.
+// Demos without a session header fail too, since every demo recorded with the
+// anticheat enabled starts with one.
+// Linux only, for now. To compile:
+// $CC -O2 -pthread -include stdbool.h -o.build/demoverify tools/demoverify.c
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../src/ac.h"
+#include "../src/chunklets/fastspin.c"
+#include "../src/chunklets/lz.c"
+#include "../src/chunklets/queue.c"
+#include "../src/demoextract.c"
+#include "../src/demofile.c"
+// monocypher's u64 is unsigned long on 64-bit Linux, which clashes with ours
+#define u64 monocypher_u64
+#include "../src/crypto.c"
+#undef u64
+
+static uchar lbprv[32], lbpub[32];
+
+struct result {
+	int errnum; // if the file couldn't be read
+	const char *err; // if it couldn't be parsed
+	uint nsessions, nok, nbad;
+	s32 badtick; // tick of the first message that failed to verify
+	usize sz;
+};
+static struct result *results;
+
+// read-ahead per worker: enough to keep everyone busy while the next file is
+// being read in, without holding too many whole demos in memory at once
+#define QDEPTH 2
+#define MAXINFLIGHT ((usize)1 << 30) // bytes of demo data in memory, roughly
+
+struct job {
+	uchar *buf; // null tells the worker to quit
+	usize sz;
+	uint idx;
+};
+
+struct worker {
+	struct queue_spsc q; // from the main thread, which is the only producer
+	struct job jobs[QDEPTH];
+	pthread_t thr;
+	uchar *scratch; // decryption output, which is just thrown away
+	uint scratchsz;
+};
+static struct worker *workers;
+static uint nworkers;
+
+// from all the workers back to the main thread, to free each buffer once done.
+// the main thread never has more jobs outstanding than this has room for (see
+// dispatch()), so every job in flight can finish without it filling up
+struct done { uchar *buf; usize sz; };
+static struct queue_mpsc doneq;
+static uint donecap;
+
+static void derivekey(uchar key[static 32], const uchar sessionpub[static 32]) {
+	uchar tmp[96]; // same layout as the keybox in ac.c
+	crypto_x25519(tmp, lbprv, sessionpub);
+	memcpy(tmp + 32, sessionpub, 32);
+	memcpy(tmp + 64, lbpub, 32);
+	crypto_blake2b(key, 32, tmp, sizeof(tmp));
+	crypto_wipe(tmp, sizeof(tmp));
+}
+
+static void fail(struct result *r, s32 tick) {
+	if (!r->nbad++) r->badtick = tick;
+}
+
+static void verify(struct worker *w, const uchar *buf, usize sz,
+		struct result *r) {
+	struct demofile df;
+	if (!demofile_init(&df, buf, sz)) { r->err = df.err; return; }
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload p;
+	uchar key[32];
+	u64 nonce = 0;
+	bool havekey = false;
+	while (demoextract_next(&x, &p)) {
+		if (p.len == AC_SESSIONHDR_SZ &&
+				!memcmp(p.data, AC_SESSIONHDR_MAGIC, 6)) {
+			derivekey(key, p.data + 6);
+			nonce = 0;
+			for (int i = 7; i >= 0; --i) nonce = nonce << 8 | p.data[38 + i];
+			havekey = true;
+			++r->nsessions;
+			continue;
+		}
+		// anything before the header, or too short for a MAC, can't be valid
+		if (!havekey || p.len < 16) { fail(r, p.tick); continue; }
+		uchar noncebytes[8];
+		++nonce;
+		for (int i = 0; i < 8; ++i) noncebytes[i] = nonce >> (i * 8);
+		uint len = p.len - 16;
+		if (len > w->scratchsz) {
+			uchar *newbuf = realloc(w->scratch, len);
+			if (!newbuf) { r->err = "couldn't allocate memory"; break; }
+			w->scratch = newbuf;
+			w->scratchsz = len;
+		}
+		if (crypto_aead_unlock_djb(w->scratch, p.data + len, key, noncebytes,
+				0, 0, p.data, len)) {
+			fail(r, p.tick);
+		}
+		else {
+			++r->nok;
+		}
+	}
+	if (x.err) r->err = x.err;
+	demoextract_free(&x);
+	crypto_wipe(key, sizeof(key));
+	crypto_wipe(w->scratch, w->scratchsz);
+}
+
+static void *workermain(void *param) {
+	struct worker *w = param;
+	for (;;) {
+		struct job j;
+		while (!queue_spsc_pop(&w->q, &j)) queue_spsc_wait(&w->q);
+		if (!j.buf) break;
+		verify(w, j.buf, j.sz, results + j.idx);
+		// shouldn't ever fill up (see above), but if it somehow does, let the
+		// main thread run rather than spinning
+		while (!queue_mpsc_push(&doneq, &(struct done){j.buf, j.sz})) {
+			sched_yield();
+		}
+	}
+	free(w->scratch);
+	return 0;
+}
+
+static uint njobs, ndone;
+static usize inflight;
+
+// frees whatever the workers are done with, without waiting. returns false if
+// there was nothing
+static bool drain(void) {
+	struct done d;
+	bool ret = false;
+	while (queue_mpsc_pop(&doneq, &d)) {
+		free(d.buf);
+		inflight -= d.sz;
+		++ndone;
+		ret = true;
+	}
+	return ret;
+}
+
+// waits for at least one job to finish, unless one already has
+static void collect(void) {
+	while (!drain()) queue_mpsc_wait(&doneq);
+}
+
+static void dispatch(const struct job *j) {
+	static uint next = 0;
+	// keep doneq from filling up, even if the workers are quicker than us
+	while (njobs - ndone >= donecap) collect();
+	++njobs;
+	// hand the job to the next worker with space in its queue, or if everyone's
+	// busy, wait for something to finish and try again
+	for (;;) {
+		for (uint n = 0; n < nworkers; ++n) {
+			struct worker *w = workers + next;
+			next = (next + 1) % nworkers;
+			if (queue_spsc_push(&w->q, j)) return;
+		}
+		collect();
+	}
+}
+
+static uchar *readdemo(const char *path, usize *sz) {
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd == -1) return 0;
+	struct stat s;
+	if (fstat(fd, &s) == -1) goto e;
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	// demofile wants 4-byte alignment, which malloc gives us anyway
+	uchar *buf = malloc(s.st_size ? s.st_size : 1);
+	if (!buf) goto e;
+	usize off = 0;
+	while (off < (usize)s.st_size) {
+		ssize_t n = read(fd, buf + off, s.st_size - off);
+		if (n == -1) { if (errno == EINTR) continue; free(buf); goto e; }
+		if (!n) break; // truncated while we were reading it
+		off += n;
+	}
+	close(fd);
+	*sz = off;
+	return buf;
+e:	close(fd);
+	return 0;
+}
+
+static bool readkey(const char *path) {
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		fprintf(stderr, "demoverify: %s: %s\n", path, strerror(errno));
+		return false;
+	}
+	bool ok = fread(lbprv, 1, sizeof(lbprv), f) == sizeof(lbprv) &&
+			fgetc(f) == EOF;
+	fclose(f);
+	if (!ok) {
+		fprintf(stderr, "demoverify: %s: key should be exactly 32 bytes\n",
+				path);
+		return false;
+	}
+	crypto_x25519_public_key(lbpub, lbprv);
+	return true;
+}
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: demoverify [-v] [-j threads] -k keyfile "
+			"file.dem...\n");
+	exit(1);
+}
+
+int main(int argc, char **argv) {
+	const char *keyfile = 0;
+	bool verbose = false;
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int opt;
+	while ((opt = getopt(argc, argv, "vj:k:")) != -1) {
+		switch (opt) {
+			case 'v': verbose = true; break;
+			case 'j': nthreads = atoi(optarg); break;
+			case 'k': keyfile = optarg; break;
+			default: usage();
+		}
+	}
+	if (!keyfile || optind == argc || nthreads < 1) usage();
+	if (!readkey(keyfile)) return 1;
+	uint nfiles = argc - optind;
+	char **paths = argv + optind;
+	if (nthreads > nfiles) nthreads = nfiles;
+	nworkers = nthreads;
+
+	results = calloc(nfiles, sizeof(*results));
+	workers = aligned_alloc(_Alignof(struct worker),
+			nworkers * sizeof(*workers));
+	donecap = 1;
+	while (donecap < nworkers * (QDEPTH + 1)) donecap <<= 1;
+	void *donebuf = malloc(QUEUE_MPSC_BUFSZ(sizeof(struct done), donecap));
+	if (!results || !workers || !donebuf) {
+		fprintf(stderr, "demoverify: couldn't allocate memory\n");
+		return 1;
+	}
+	queue_mpsc_init(&doneq, donebuf, sizeof(struct done), donecap);
+	for (uint i = 0; i < nworkers; ++i) {
+		struct worker *w = workers + i;
+		queue_spsc_init(&w->q, w->jobs, sizeof(struct job), QDEPTH);
+		w->scratch = 0;
+		w->scratchsz = 0;
+		if (pthread_create(&w->thr, 0, &workermain, w)) {
+			fprintf(stderr, "demoverify: couldn't start threads\n");
+			return 1;
+		}
+	}
+
+	double start = now();
+	usize total = 0;
+	for (uint i = 0; i < nfiles; ++i) {
+		drain(); // free up memory as soon as possible
+		// don't read too far ahead of the workers if the demos are huge
+		while (inflight >= MAXINFLIGHT && ndone < njobs) collect();
+		usize sz;
+		uchar *buf = readdemo(paths[i], &sz);
+		if (!buf) { results[i].errnum = errno; continue; }
+		results[i].sz = sz;
+		total += sz;
+		inflight += sz;
+		dispatch(&(struct job){buf, sz, i});
+	}
+	for (uint i = 0; i < nworkers; ++i) {
+		while (!queue_spsc_push(&workers[i].q, &(struct job){0})) collect();
+	}
+	while (ndone < njobs) collect();
+	for (uint i = 0; i < nworkers; ++i) pthread_join(workers[i].thr, 0);
+	double elapsed = now() - start;
+	crypto_wipe(lbprv, sizeof(lbprv));
+
+	uint nok = 0, nfailed = 0, nunreadable = 0;
+	u64 nmsgs = 0;
+	for (uint i = 0; i < nfiles; ++i) {
+		const struct result *r = results + i;
+		if (r->errnum || r->err) {
+			++nunreadable;
+			printf("%s: error: %s\n", paths[i],
+					r->errnum ? strerror(r->errnum) : r->err);
+		}
+		else if (!r->nsessions) {
+			// ac.c always writes one, so the custom data has been removed
+			++nfailed;
+			printf("%s: FAILED: no anticheat session header\n", paths[i]);
+		}
+		else if (r->nbad) {
+			++nfailed;
+			printf("%s: FAILED: %u of %u messages didn't verify (first at "
+					"tick %d)\n", paths[i], r->nbad, r->nbad + r->nok,
+					r->badtick);
+		}
+		else {
+			++nok;
+			if (verbose) {
+				printf("%s: ok: %u messages in %u sessions\n", paths[i],
+						r->nok, r->nsessions);
+			}
+		}
+		nmsgs += r->nok + r->nbad;
+	}
+	printf("%u demos (%.1f MiB, %llu messages) in %.2fs on %u threads: "
+			"%u ok, %u failed, %u unreadable\n", nfiles, total / 1048576.0,
+			(unsigned long long)nmsgs, elapsed, nworkers, nok, nfailed,
+			nunreadable);
+	return nfailed || nunreadable;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80
@@ -0,0 +1,84 @@
+// Lists the custom data payloads written by SST in demo files, using
+// src/demoextract.c. With -x, also hex dumps each payload; with -s, just prints
+// totals for each file, including how fast it was read.
+// To compile:
+// Unix: $CC -O2 -include stdbool.h -o.build/extractcustom tools/extractcustom.c
+// Windows: clang-cl -fuse-ld=lld -O2 -FIstdbool.h -Fe.build/extractcustom.exe
+//     tools/extractcustom.c
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "../src/chunklets/lz.c"
+#include "../src/demoextract.c"
+#include "../src/demofile.c"
+
+static double now(void) {
+	struct timespec ts;
+	timespec_get(&ts, TIME_UTC);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void hexdump(const uchar *p, uint len) {
+	for (uint i = 0; i < len; i += 16) {
+		printf("    %.4x ", i);
+		for (uint j = i; j < i + 16; ++j) {
+			if (j < len) printf(" %.2x", p[j]); else fputs("   ", stdout);
+		}
+		fputs("  ", stdout);
+		for (uint j = i; j < i + 16 && j < len; ++j) {
+			putchar(p[j] >= ' ' && p[j] < 0x7F ? p[j] : '.');
+		}
+		putchar('\n');
+	}
+}
+
+static bool extract(const char *path, int mode) {
+	struct demofile df;
+	double start = now();
+	if (!demofile_open(&df, path)) {
+		fprintf(stderr, "extractcustom: %s: %s\n", path, df.err);
+		return false;
+	}
+	struct demoextract x;
+	demoextract_init(&x, &df);
+	struct demoextract_payload pl;
+	uvlong count = 0, bytes = 0;
+	if (mode != 's') printf("%s:\n", path);
+	while (demoextract_next(&x, &pl)) {
+		++count;
+		bytes += pl.len;
+		if (mode == 's') continue;
+		printf("  %10zu  tick %6d  %u bytes\n", pl.off, pl.tick, pl.len);
+		if (mode == 'x') hexdump(pl.data, pl.len);
+	}
+	if (x.err) fprintf(stderr, "extractcustom: %s: %s\n", path, x.err);
+	if (mode == 's') {
+		double secs = now() - start;
+		printf("%s: %llu payloads, %llu bytes; read %zu bytes in %.3f seconds "
+				"(%.1f MB/s)\n", path, count, bytes, df._mapsz, secs,
+				df._mapsz / secs / 1e6);
+	}
+	bool ret = !x.err;
+	demoextract_free(&x);
+	demofile_close(&df);
+	return ret;
+}
+
+int main(int argc, char **argv) {
+	int mode = 0;
+	if (argc > 1 && (!strcmp(argv[1], "-s") || !strcmp(argv[1], "-x"))) {
+		mode = argv[1][1];
+		--argc; ++argv;
+	}
+	if (argc < 2) {
+		fprintf(stderr, "usage: extractcustom [-s | -x] file.dem...\n");
+		return 1;
+	}
+	int ret = 0;
+	for (int i = 1; i < argc; ++i) if (!extract(argv[i], mode)) ret = 1;
+	return ret;
+}
+
+// vi: sw=4 ts=4 noet tw=80 cc=80